@@ -0,0 +1,519 @@
+// Micro-benchmarks of the parser, formatter and calendar code in main.c, see README.md.
+// Built from main.c with main renamed and sim.c as the driverlib, none of the measured
+// paths touch a peripheral. Reports ns/op and user-space instructions/op, and
+// compares a run with a baseline written by --json.
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RUNS              7       // best of, per benchmark
+#define BENCH_RUN_NS            20000000 // target length of one run
+#define BENCH_MAX               32
+#define BENCH_NAME_SIZE         32
+
+// main.c is compiled into this file for its types and globals, with main renamed
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+// measured entry points are called through pointers the compiler cannot see through,
+// so constant inputs are not folded into the benchmark loops
+static uint8_t (*volatile batch_parse)(const char *, command_line_t *, const command_t **, command_arg_t *) = BatchParse;
+static error_t (*volatile parse_integer_until)(const char *, char, uint8_t *, uint32_t *) = ParseIntegerUntil;
+static void (*volatile stringify_date)(uint16_t, uint8_t, uint8_t, char *) = StringifyDate;
+static void (*volatile stringify_time)(uint32_t, char *) = StringifyTime;
+static void (*volatile stringify_number)(int64_t, char *) = StringifyNumber;
+static uint8_t (*volatile get_day_of_month)(uint16_t, uint8_t) = GetDayOfMonth;
+static void (*volatile epoch_civil)(int64_t, datetime_t *) = EpochCivil;
+static void (*volatile rtc_update)(uint32_t) = RTCUpdate;
+static void (*volatile display_flow_render)(void) = DisplayFlowRender;
+
+typedef struct bench {
+    const char *name;
+    const char *about;
+    void (*setup)(void);
+    uint32_t (*run)(void);      // one pass over the inputs, returns the operations done
+} bench_t;
+
+typedef struct bench_result {
+    char name[BENCH_NAME_SIZE];
+    uint64_t ops;
+    double ns;                  // per op, best run
+    double instructions;        // per op, best run, negative if not counted
+} bench_result_t;
+
+volatile uint32_t bench_sink; // results land here so nothing is optimized out
+
+static int perf_fd = -1;
+static int perf_errno;
+
+/* ---- inputs ---- */
+
+// typical traffic, every one a valid command
+static const char *const commands_known[] = {
+    "GET DATE", "GET TIME", "get date", "SET TIME 12:34:56", "SET DATE 2024/06/18", "SET ALARM 07:30:00",
+    "ALARM ADD 07:30:00 MON,WED,15", "ALARM DEL 3", "DATE DIFF 2024/02/29 2025/03/01", "GET EPOCH",
+    "SET ZONE EST5EDT,M3.2.0,M11.1.0", "MUTE",
+};
+
+// worst cases for the lexer and the hash probes, nothing here matches
+static char commands_unknown[4][UART0_RX_LINE_SIZE] = {"GET NOTHING", "XYZZY PLUGH", "SETT TIME 12:00:00"};
+
+// long runs of spaces, the last two are rejected for leading and trailing spaces
+static char commands_spaces[4][UART0_RX_LINE_SIZE];
+
+static const char *const integers[] = {"2024/", "06/", "18", "12:", "34:", "56", "65535", "1x"};
+
+static char scratch[UART0_RX_LINE_SIZE]; // output of the formatters
+
+static void SetupCommands(void) {
+    // lines as long as the receive buffer allows
+    memset(commands_unknown[3], 'Q', UART0_RX_LINE_SIZE - 1);
+    commands_unknown[3][UART0_RX_LINE_SIZE - 1] = '\0';
+
+    snprintf(commands_spaces[0], UART0_RX_LINE_SIZE, "GET%*sDATE", 100, "");
+    snprintf(commands_spaces[1], UART0_RX_LINE_SIZE, "SET%*sTIME%*s12:00:00", 50, "", 50, "");
+    snprintf(commands_spaces[2], UART0_RX_LINE_SIZE, "%*sGET DATE", 110, "");
+    snprintf(commands_spaces[3], UART0_RX_LINE_SIZE, "GET DATE%*s", 110, "");
+
+    command_quiet = 1; // argument errors are reported on UART0 otherwise
+    CommandTableInit();
+}
+
+static uint32_t ParseList(const char *const *list, uint32_t count) {
+    command_line_t line;
+    command_arg_t args[COMMAND_MAX_ARGS];
+    const command_t *cmd;
+    uint32_t i, status = 0;
+
+    for (i = 0; i < count; ++i) {
+        status += batch_parse(list[i], &line, &cmd, args);
+    }
+    bench_sink += status;
+    return count;
+}
+
+static uint32_t RunParseKnown(void) {
+    return ParseList(commands_known, sizeof(commands_known) / sizeof(commands_known[0]));
+}
+
+static uint32_t RunParseUnknown(void) {
+    const char *list[4] = {commands_unknown[0], commands_unknown[1], commands_unknown[2], commands_unknown[3]};
+
+    return ParseList(list, 4);
+}
+
+static uint32_t RunParseSpaces(void) {
+    const char *list[4] = {commands_spaces[0], commands_spaces[1], commands_spaces[2], commands_spaces[3]};
+
+    return ParseList(list, 4);
+}
+
+static uint32_t RunParseInteger(void) {
+    uint32_t i, sum = 0;
+    uint8_t index;
+    uint32_t value;
+
+    for (i = 0; i < sizeof(integers) / sizeof(integers[0]); ++i) {
+        index = 0;
+        sum += parse_integer_until(integers[i], integers[i][strlen(integers[i]) - 1] == '/' ? '/' : ':', &index, &value);
+        sum += value + index;
+    }
+    bench_sink += sum;
+    return i;
+}
+
+static uint32_t RunStringifyDate(void) {
+    uint32_t i;
+
+    for (i = 0; i < 372; ++i) {
+        stringify_date(1970 + i, i % 12 + 1, i % 31 + 1, scratch);
+    }
+    bench_sink += scratch[9];
+    return i;
+}
+
+static uint32_t RunStringifyTime(void) {
+    uint32_t i;
+
+    for (i = 0; i < 86400; i += 233) {
+        stringify_time(i, scratch);
+    }
+    bench_sink += scratch[7];
+    return (86400 + 232) / 233;
+}
+
+static uint32_t RunStringifyNumber(void) {
+    static const int64_t numbers[] = {0, 7, -42, 86399, 1718668800, -2208988800LL, INT64_MAX, INT64_MIN};
+    uint32_t i;
+
+    for (i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+        stringify_number(numbers[i], scratch);
+    }
+    bench_sink += scratch[0];
+    return i;
+}
+
+static uint32_t RunDaysInMonth(void) {
+    uint32_t year, month, sum = 0;
+
+    for (year = 1900; year < 2300; ++year) {
+        for (month = 1; month <= 12; ++month) {
+            sum += get_day_of_month(year, month);
+        }
+    }
+    bench_sink += sum;
+    return 400 * 12;
+}
+
+static uint32_t RunEpochCivil(void) {
+    // 1970 to 2100 in strides of a day and 7s
+    datetime_t date;
+    int64_t seconds;
+    uint32_t count = 0;
+
+    for (seconds = 0; seconds < 4102444800LL; seconds += 86407 * 97, ++count) {
+        epoch_civil(seconds, &date);
+        bench_sink += date.day;
+    }
+    return count;
+}
+
+static uint32_t rtc_next;
+
+static void SetupRtc(void) {
+    memset(&tz_rule, 0, sizeof(tz_rule)); // UTC
+    rtc_epoch = 1718668800; // 2024/06/18
+    TzExpand(rtc_epoch);
+    tz_view_offset = tz_offset;
+    rtc_next = 86400 - 500;
+    RTCDecode(rtc_next);
+}
+
+static void SetupRtcZone(void) {
+    static const char zone[] = "EST5EDT,M3.2.0,M11.1.0";
+    tz_rule_t rule;
+
+    if (TzParse(zone, sizeof(zone) - 1, &rule)) {
+        tz_rule = rule;
+    }
+    rtc_epoch = 1710054000 - 1000; // shortly before 2024/03/10 07:00 UTC, the spring-forward
+    TzExpand(rtc_epoch);
+    tz_view_offset = tz_offset;
+    rtc_next = 0;
+    RTCDecode(rtc_next);
+}
+
+static uint32_t RunRtcTick(void) {
+    // the once-a-second path, crosses midnight every 86400 calls
+    uint32_t i;
+
+    for (i = 0; i < 1000; ++i) {
+        rtc_update(++rtc_next);
+    }
+    bench_sink += datetime.time;
+    return i;
+}
+
+static uint32_t RunRtcMidnight(void) {
+    // every call lands on another day, the civil conversion runs each time
+    uint32_t i;
+
+    for (i = 0; i < 1000; ++i) {
+        rtc_next += 86400;
+        rtc_update(rtc_next);
+    }
+    bench_sink += datetime.day;
+    return i;
+}
+
+static void SetupDisplay(void) {
+    SetupRtc();
+    DisplayFlowInvalidate();
+    DisplayFlowRender();
+}
+
+static uint32_t RunDisplayTick(void) {
+    // incremental digit update for consecutive seconds, a full render at midnight
+    uint32_t i;
+
+    for (i = 0; i < 1000; ++i) {
+        rtc_update(++rtc_next);
+        display_flow_render();
+    }
+    bench_sink += datetime.time;
+    return i;
+}
+
+static const bench_t benches[] = {
+    {"parse_known",         "BatchParse, 12 valid commands",                SetupCommands,  RunParseKnown},
+    {"parse_unknown",       "BatchParse, unmatched and 127-char tokens",    SetupCommands,  RunParseUnknown},
+    {"parse_spaces",        "BatchParse, runs of 50-110 spaces",            SetupCommands,  RunParseSpaces},
+    {"parse_integer",       "ParseIntegerUntil, date and time fields",      NULL,           RunParseInteger},
+    {"stringify_date",      "StringifyDate",                                NULL,           RunStringifyDate},
+    {"stringify_time",      "StringifyTime",                                NULL,           RunStringifyTime},
+    {"stringify_number",    "StringifyNumber, 1 to 20 digits",              NULL,           RunStringifyNumber},
+    {"days_in_month",       "GetDayOfMonth, 1900 to 2299",                  NULL,           RunDaysInMonth},
+    {"epoch_civil",         "EpochCivil, 1970 to 2100",                     NULL,           RunEpochCivil},
+    {"rtc_tick",            "RTCUpdate, consecutive seconds",               SetupRtc,       RunRtcTick},
+    {"rtc_tick_dst",        "RTCUpdate, EST5EDT across spring-forward",     SetupRtcZone,   RunRtcTick},
+    {"rtc_midnight",        "RTCUpdate, a new day every call",              SetupRtc,       RunRtcMidnight},
+    {"display_tick",        "RTCUpdate and DisplayFlowRender per second",   SetupDisplay,   RunDisplayTick},
+};
+
+/* ---- measurement ---- */
+
+static uint64_t BenchNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void PerfOpen(void) {
+    // user-space instructions, unavailable in some containers and VMs
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    perf_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    perf_errno = errno;
+}
+
+static uint64_t PerfRead(void) {
+    uint64_t count = 0;
+
+    if (perf_fd < 0 || read(perf_fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    return count;
+}
+
+static void BenchRun(const bench_t *bench, bench_result_t *result) {
+    uint64_t passes = 1, ops, start, elapsed, instructions, i;
+    uint32_t run;
+
+    if (bench->setup) {
+        bench->setup();
+    }
+
+    // grow the pass count until one run is long enough to time
+    for (;;) {
+        start = BenchNow();
+        for (i = 0; i < passes; ++i) {
+            bench->run();
+        }
+        elapsed = BenchNow() - start;
+        if (elapsed >= BENCH_RUN_NS / 4 || passes >= (1ull << 40)) {
+            break;
+        }
+        passes *= 2;
+    }
+    passes = passes * BENCH_RUN_NS / (elapsed ? elapsed : 1) + 1;
+
+    snprintf(result->name, sizeof(result->name), "%s", bench->name);
+    result->ns = -1;
+    result->instructions = -1;
+    for (run = 0; run < BENCH_RUNS; ++run) {
+        if (bench->setup) {
+            bench->setup(); // same inputs every run, so instruction counts repeat
+        }
+        ops = 0;
+        if (perf_fd >= 0) {
+            ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        start = BenchNow();
+        for (i = 0; i < passes; ++i) {
+            ops += bench->run();
+        }
+        elapsed = BenchNow() - start;
+        if (perf_fd >= 0) {
+            ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        instructions = PerfRead();
+
+        if (result->ns < 0 || (double)elapsed / ops < result->ns) {
+            result->ns = (double)elapsed / ops;
+        }
+        if (instructions && (result->instructions < 0 || (double)instructions / ops < result->instructions)) {
+            result->instructions = (double)instructions / ops;
+        }
+        result->ops = ops;
+    }
+}
+
+/* ---- output ---- */
+
+static void BenchJson(FILE *file, const bench_result_t *results, uint32_t count) {
+    // one benchmark per line, BenchLoad reads it back
+    uint32_t i;
+
+    fprintf(file, "{\"unit\": \"ns/op\", \"benchmarks\": [\n");
+    for (i = 0; i < count; ++i) {
+        fprintf(file, "  {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"instructions_per_op\": ",
+            results[i].name, (unsigned long long)results[i].ops, results[i].ns);
+        if (results[i].instructions < 0) {
+            fprintf(file, "null}%s\n", i + 1 < count ? "," : "");
+        } else {
+            fprintf(file, "%.1f}%s\n", results[i].instructions, i + 1 < count ? "," : "");
+        }
+    }
+    fprintf(file, "]}\n");
+}
+
+static uint32_t BenchLoad(const char *path, bench_result_t *results) {
+    char text[256], name[BENCH_NAME_SIZE], instructions[32];
+    FILE *file = fopen(path, "r");
+    uint32_t count = 0;
+
+    if (!file) {
+        fprintf(stderr, "bench: cannot open %s: %s\n", path, strerror(errno));
+        exit(2);
+    }
+    while (count < BENCH_MAX && fgets(text, sizeof(text), file)) {
+        unsigned long long ops;
+        double ns;
+
+        if (sscanf(text, " {\"name\": \"%31[^\"]\", \"ops\": %llu, \"ns_per_op\": %lf, \"instructions_per_op\": %31[^}]",
+            name, &ops, &ns, instructions) == 4) {
+            snprintf(results[count].name, sizeof(results[count].name), "%s", name);
+            results[count].ops = ops;
+            results[count].ns = ns;
+            results[count].instructions = strcmp(instructions, "null") ? atof(instructions) : -1;
+            ++count;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static double BenchChange(double base, double now) {
+    return base > 0 && now >= 0 ? 100.0 * (now - base) / base : 0.0;
+}
+
+static void Usage(void) {
+    fprintf(stderr,
+        "usage: bench [--json FILE] [--compare BASELINE] [--fail-above PCT] [--filter TEXT] [--list]\n"
+        "  --json FILE        write results as JSON, - for stdout\n"
+        "  --compare FILE     show the change against a baseline written by --json\n"
+        "  --fail-above PCT   exit 1 if instructions/op (ns/op when not counted) grew by more than PCT\n"
+        "  --filter TEXT      only benchmarks whose name contains TEXT\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bench_result_t results[BENCH_MAX], baseline[BENCH_MAX];
+    const char *json = NULL, *compare = NULL, *filter = NULL;
+    double fail_above = -1;
+    uint32_t i, j, count = 0, baseline_count = 0;
+    int status = 0, list = 0, arg;
+
+    for (arg = 1; arg < argc; ++arg) {
+        if (strcmp(argv[arg], "--json") == 0 && arg + 1 < argc) {
+            json = argv[++arg];
+        } else if (strcmp(argv[arg], "--compare") == 0 && arg + 1 < argc) {
+            compare = argv[++arg];
+        } else if (strcmp(argv[arg], "--fail-above") == 0 && arg + 1 < argc) {
+            fail_above = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--filter") == 0 && arg + 1 < argc) {
+            filter = argv[++arg];
+        } else if (strcmp(argv[arg], "--list") == 0) {
+            list = 1;
+        } else {
+            Usage();
+        }
+    }
+
+    if (list) {
+        for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+            printf("%-20s %s\n", benches[i].name, benches[i].about);
+        }
+        return 0;
+    }
+    if (compare) {
+        baseline_count = BenchLoad(compare, baseline);
+    }
+
+    PerfOpen();
+    printf("%-20s %12s %12s", "benchmark", "ns/op", "instr/op");
+    if (compare) {
+        printf(" %9s %9s", "ns", "instr");
+    }
+    printf("\n");
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        const bench_result_t *base = NULL;
+        bench_result_t *result = &results[count];
+
+        if (filter && !strstr(benches[i].name, filter)) {
+            continue;
+        }
+        BenchRun(&benches[i], result);
+        ++count;
+
+        printf("%-20s %12.2f ", result->name, result->ns);
+        if (result->instructions < 0) {
+            printf("%12s", "n/a");
+        } else {
+            printf("%12.1f", result->instructions);
+        }
+
+        for (j = 0; j < baseline_count; ++j) {
+            if (strcmp(baseline[j].name, result->name) == 0) {
+                base = &baseline[j];
+            }
+        }
+        if (base) {
+            double ns = BenchChange(base->ns, result->ns);
+            double instructions = BenchChange(base->instructions, result->instructions);
+            int counted = base->instructions >= 0 && result->instructions >= 0;
+
+            printf(" %+8.1f%%", ns);
+            if (counted) {
+                printf(" %+8.1f%%", instructions);
+            } else {
+                printf(" %9s", "n/a");
+            }
+            if (fail_above >= 0 && (counted ? instructions : ns) > fail_above) {
+                printf("  regressed");
+                status = 1;
+            }
+        } else if (compare) {
+            printf(" %9s %9s", "new", "new");
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    if (perf_fd < 0) {
+        fprintf(stderr, "bench: instruction counter unavailable (%s), only ns/op is reported\n", strerror(perf_errno));
+    }
+
+    if (json) {
+        FILE *file = strcmp(json, "-") ? fopen(json, "w") : stdout;
+
+        if (!file) {
+            fprintf(stderr, "bench: cannot write %s: %s\n", json, strerror(errno));
+            return 2;
+        }
+        BenchJson(file, results, count);
+        if (file != stdout) {
+            fclose(file);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,8 @@
+// Simulated driverlib debug.h
+
+#ifndef __DRIVERLIB_DEBUG_H__
+#define __DRIVERLIB_DEBUG_H__
+
+#define ASSERT(expr)
+
+#endif // __DRIVERLIB_DEBUG_H__
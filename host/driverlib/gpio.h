@@ -0,0 +1,37 @@
+// Simulated driverlib gpio.h, only the TCA6424 INT line on PM3 is modelled
+
+#ifndef __DRIVERLIB_GPIO_H__
+#define __DRIVERLIB_GPIO_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GPIO_PIN_0              0x00000001
+#define GPIO_PIN_1              0x00000002
+#define GPIO_PIN_2              0x00000004
+#define GPIO_PIN_3              0x00000008
+#define GPIO_PIN_4              0x00000010
+#define GPIO_PIN_5              0x00000020
+#define GPIO_PIN_6              0x00000040
+#define GPIO_PIN_7              0x00000080
+
+#define GPIO_STRENGTH_2MA       0x00000001
+#define GPIO_PIN_TYPE_STD_WPU   0x0000000A
+#define GPIO_FALLING_EDGE       0x00000000
+
+void GPIOPinConfigure(uint32_t config);
+void GPIOPinTypeGPIOInput(uint32_t port, uint8_t pins);
+void GPIOPinTypeGPIOOutput(uint32_t port, uint8_t pins);
+void GPIOPinTypeUART(uint32_t port, uint8_t pins);
+void GPIOPinTypeI2C(uint32_t port, uint8_t pins);
+void GPIOPinTypeI2CSCL(uint32_t port, uint8_t pins);
+void GPIOPinTypePWM(uint32_t port, uint8_t pins);
+void GPIOPadConfigSet(uint32_t port, uint8_t pins, uint32_t strength, uint32_t type);
+void GPIOIntTypeSet(uint32_t port, uint8_t pins, uint32_t type);
+void GPIOIntEnable(uint32_t port, uint32_t flags);
+void GPIOIntDisable(uint32_t port, uint32_t flags);
+uint32_t GPIOIntStatus(uint32_t port, bool masked);
+void GPIOIntClear(uint32_t port, uint32_t flags);
+int32_t GPIOPinRead(uint32_t port, uint8_t pins);
+
+#endif // __DRIVERLIB_GPIO_H__
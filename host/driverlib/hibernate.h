@@ -0,0 +1,37 @@
+// Simulated driverlib hibernate.h
+
+#ifndef __DRIVERLIB_HIBERNATE_H__
+#define __DRIVERLIB_HIBERNATE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HIBERNATE_WAKE_PIN          0x00000010
+#define HIBERNATE_WAKE_RTC          0x00000008
+#define HIBERNATE_OSC_LOWDRIVE      0x00010000
+#define HIBERNATE_COUNTER_RTC       0x00000000
+#define HIBERNATE_INT_RTC_MATCH_0   0x00000001
+
+bool HibernateIsActive(void);
+void HibernateEnableExpClk(uint32_t clock);
+void HibernateClockConfig(uint32_t config);
+void HibernateRTCEnable(void);
+void HibernateCounterMode(uint32_t config);
+void HibernateRTCSet(uint32_t seconds);
+uint32_t HibernateRTCGet(void);
+uint32_t HibernateRTCSSGet(void);
+void HibernateRTCMatchSet(uint32_t match, uint32_t value);
+uint32_t HibernateRTCMatchGet(uint32_t match);
+void HibernateRTCSSMatchSet(uint32_t match, uint32_t value);
+void HibernateRTCTrimSet(uint32_t trim);
+uint32_t HibernateRTCTrimGet(void);
+void HibernateDataSet(uint32_t *data, uint32_t count);
+void HibernateDataGet(uint32_t *data, uint32_t count);
+void HibernateIntEnable(uint32_t flags);
+void HibernateIntDisable(uint32_t flags);
+void HibernateIntClear(uint32_t flags);
+uint32_t HibernateIntStatus(bool masked);
+void HibernateWakeSet(uint32_t flags);
+void HibernateRequest(void);
+
+#endif // __DRIVERLIB_HIBERNATE_H__
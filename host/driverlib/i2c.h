@@ -0,0 +1,41 @@
+// Simulated driverlib i2c.h
+
+#ifndef __DRIVERLIB_I2C_H__
+#define __DRIVERLIB_I2C_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// I2CMasterControl commands are built from the MCS register bits
+#define I2C_MASTER_CMD_SINGLE_SEND              0x00000007
+#define I2C_MASTER_CMD_SINGLE_RECEIVE           0x00000007
+#define I2C_MASTER_CMD_BURST_SEND_START         0x00000003
+#define I2C_MASTER_CMD_BURST_SEND_CONT          0x00000001
+#define I2C_MASTER_CMD_BURST_SEND_FINISH        0x00000005
+#define I2C_MASTER_CMD_BURST_SEND_STOP          0x00000004
+#define I2C_MASTER_CMD_BURST_SEND_ERROR_STOP    0x00000004
+#define I2C_MASTER_CMD_BURST_RECEIVE_START      0x0000000b
+#define I2C_MASTER_CMD_BURST_RECEIVE_CONT       0x00000009
+#define I2C_MASTER_CMD_BURST_RECEIVE_FINISH     0x00000005
+#define I2C_MASTER_CMD_BURST_RECEIVE_ERROR_STOP 0x00000004
+
+#define I2C_MASTER_ERR_NONE     0
+#define I2C_MASTER_ERR_ADDR_ACK 0x00000004
+#define I2C_MASTER_ERR_DATA_ACK 0x00000008
+#define I2C_MASTER_ERR_ARB_LOST 0x00000010
+#define I2C_MASTER_ERR_CLK_TOUT 0x00000080
+
+void I2CMasterInitExpClk(uint32_t base, uint32_t clock, bool fast);
+void I2CMasterEnable(uint32_t base);
+void I2CMasterIntEnable(uint32_t base);
+void I2CMasterIntDisable(uint32_t base);
+void I2CMasterIntClear(uint32_t base);
+bool I2CMasterIntStatus(uint32_t base, bool masked);
+void I2CMasterSlaveAddrSet(uint32_t base, uint8_t address, bool receive);
+void I2CMasterDataPut(uint32_t base, uint8_t data);
+uint32_t I2CMasterDataGet(uint32_t base);
+void I2CMasterControl(uint32_t base, uint32_t command);
+uint32_t I2CMasterErr(uint32_t base);
+bool I2CMasterBusy(uint32_t base);
+
+#endif // __DRIVERLIB_I2C_H__
@@ -0,0 +1,14 @@
+// Simulated driverlib interrupt.h
+
+#ifndef __DRIVERLIB_INTERRUPT_H__
+#define __DRIVERLIB_INTERRUPT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool IntMasterEnable(void);
+bool IntMasterDisable(void);
+void IntEnable(uint32_t interrupt);
+void IntDisable(uint32_t interrupt);
+
+#endif // __DRIVERLIB_INTERRUPT_H__
@@ -0,0 +1,12 @@
+// Simulated driverlib pin_map.h, pin muxing has no effect on the host
+
+#ifndef __DRIVERLIB_PIN_MAP_H__
+#define __DRIVERLIB_PIN_MAP_H__
+
+#define GPIO_PA0_U0RX           0x00000001
+#define GPIO_PA1_U0TX           0x00000401
+#define GPIO_PB2_I2C0SCL        0x00010802
+#define GPIO_PB3_I2C0SDA        0x00010C02
+#define GPIO_PF3_M0PWM3         0x00050C06
+
+#endif // __DRIVERLIB_PIN_MAP_H__
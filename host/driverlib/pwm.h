@@ -0,0 +1,24 @@
+// Simulated driverlib pwm.h, only the generator period and enable state are modelled
+
+#ifndef __DRIVERLIB_PWM_H__
+#define __DRIVERLIB_PWM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PWM_GEN_1               0x00000080
+#define PWM_OUT_3               0x00000083
+#define PWM_OUT_3_BIT           0x00000008
+
+#define PWM_GEN_MODE_DOWN       0x00000000
+#define PWM_GEN_MODE_NO_SYNC    0x00000000
+
+void PWMGenConfigure(uint32_t base, uint32_t gen, uint32_t config);
+void PWMGenPeriodSet(uint32_t base, uint32_t gen, uint32_t period);
+uint32_t PWMGenPeriodGet(uint32_t base, uint32_t gen);
+void PWMGenEnable(uint32_t base, uint32_t gen);
+void PWMGenDisable(uint32_t base, uint32_t gen);
+void PWMPulseWidthSet(uint32_t base, uint32_t out, uint32_t width);
+void PWMOutputState(uint32_t base, uint32_t out_bits, bool enable);
+
+#endif // __DRIVERLIB_PWM_H__
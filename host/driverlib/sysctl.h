@@ -0,0 +1,35 @@
+// Simulated driverlib sysctl.h
+
+#ifndef __DRIVERLIB_SYSCTL_H__
+#define __DRIVERLIB_SYSCTL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SYSCTL_PERIPH_TIMER0    0xf0000400
+#define SYSCTL_PERIPH_GPIOA     0xf0000800
+#define SYSCTL_PERIPH_GPIOB     0xf0000801
+#define SYSCTL_PERIPH_GPIOF     0xf0000805
+#define SYSCTL_PERIPH_GPIOJ     0xf0000808
+#define SYSCTL_PERIPH_GPIOM     0xf000080b
+#define SYSCTL_PERIPH_GPION     0xf000080c
+#define SYSCTL_PERIPH_HIBERNATE 0xf0001400
+#define SYSCTL_PERIPH_UART0     0xf0001800
+#define SYSCTL_PERIPH_I2C0      0xf0002000
+#define SYSCTL_PERIPH_PWM0      0xf0004000
+#define SYSCTL_PERIPH_EEPROM0   0xf0005800
+
+#define SYSCTL_OSC_INT          0x00000010
+#define SYSCTL_USE_PLL          0x00000000
+#define SYSCTL_CFG_VCO_480      0xF1000000
+
+uint32_t SysCtlClockFreqSet(uint32_t config, uint32_t freq);
+void SysCtlPeripheralEnable(uint32_t peripheral);
+bool SysCtlPeripheralReady(uint32_t peripheral);
+void SysCtlPeripheralSleepEnable(uint32_t peripheral);
+void SysCtlPeripheralSleepDisable(uint32_t peripheral);
+void SysCtlPeripheralClockGating(bool enable);
+void SysCtlSleep(void);
+void SysCtlReset(void);
+
+#endif // __DRIVERLIB_SYSCTL_H__
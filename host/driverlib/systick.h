@@ -0,0 +1,16 @@
+// Simulated driverlib systick.h
+
+#ifndef __DRIVERLIB_SYSTICK_H__
+#define __DRIVERLIB_SYSTICK_H__
+
+#include <stdint.h>
+
+void SysTickEnable(void);
+void SysTickDisable(void);
+void SysTickIntEnable(void);
+void SysTickIntDisable(void);
+void SysTickPeriodSet(uint32_t period);
+uint32_t SysTickPeriodGet(void);
+uint32_t SysTickValueGet(void);
+
+#endif // __DRIVERLIB_SYSTICK_H__
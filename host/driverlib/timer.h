@@ -0,0 +1,21 @@
+// Simulated driverlib timer.h, only timer A is modelled, periodic or one-shot
+
+#ifndef __DRIVERLIB_TIMER_H__
+#define __DRIVERLIB_TIMER_H__
+
+#include <stdint.h>
+
+#define TIMER_CFG_ONE_SHOT      0x00000021
+#define TIMER_CFG_PERIODIC      0x00000022
+#define TIMER_A                 0x000000ff
+#define TIMER_TIMA_TIMEOUT      0x00000001
+
+void TimerConfigure(uint32_t base, uint32_t config);
+void TimerLoadSet(uint32_t base, uint32_t timer, uint32_t value);
+void TimerEnable(uint32_t base, uint32_t timer);
+void TimerDisable(uint32_t base, uint32_t timer);
+void TimerIntEnable(uint32_t base, uint32_t flags);
+void TimerIntDisable(uint32_t base, uint32_t flags);
+void TimerIntClear(uint32_t base, uint32_t flags);
+
+#endif // __DRIVERLIB_TIMER_H__
@@ -0,0 +1,14 @@
+// Simulated TM4C1294 I2C register offsets
+
+#ifndef __HW_I2C_H__
+#define __HW_I2C_H__
+
+#define I2C_O_MSA               0x00000000  // I2C Master Slave Address
+#define I2C_O_MCS               0x00000004  // I2C Master Control/Status
+#define I2C_O_MDR               0x00000008  // I2C Master Data
+#define I2C_O_MTPR              0x0000000C  // I2C Master Timer Period
+#define I2C_O_MIMR              0x00000010  // I2C Master Interrupt Mask
+#define I2C_O_MRIS              0x00000014  // I2C Master Raw Interrupt Status
+#define I2C_O_MICR              0x0000001C  // I2C Master Interrupt Clear
+
+#endif // __HW_I2C_H__
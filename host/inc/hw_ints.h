@@ -0,0 +1,14 @@
+// Simulated TM4C1294 interrupt assignments
+
+#ifndef __HW_INTS_H__
+#define __HW_INTS_H__
+
+#define FAULT_SYSTICK           15
+#define INT_UART0               21
+#define INT_I2C0                24
+#define INT_TIMER0A             35
+#define INT_HIBERNATE           59
+#define INT_GPIOM               88
+#define NUM_INTERRUPTS          130
+
+#endif // __HW_INTS_H__
@@ -0,0 +1,20 @@
+// Simulated TM4C1294 memory map, base addresses only identify peripherals in host/sim.c
+
+#ifndef __HW_MEMMAP_H__
+#define __HW_MEMMAP_H__
+
+#define GPIO_PORTA_BASE         0x40004000
+#define GPIO_PORTB_BASE         0x40005000
+#define UART0_BASE              0x4000C000
+#define I2C0_BASE               0x40020000
+#define GPIO_PORTF_BASE         0x40025000
+#define PWM0_BASE               0x40028000
+#define TIMER0_BASE             0x40030000
+#define GPIO_PORTJ_BASE         0x4003D000
+#define GPIO_PORTM_BASE         0x40063000
+#define GPIO_PORTN_BASE         0x40064000
+#define EEPROM_BASE             0x400AF000
+#define HIB_BASE                0x400FC000
+#define SYSCTL_BASE             0x400FE000
+
+#endif // __HW_MEMMAP_H__
@@ -0,0 +1,14 @@
+// Register access macros. The simulated peripherals are reached through driverlib, the
+// few registers firmware touches directly (the DWT cycle counter) are backed by sim.c
+
+#ifndef __HW_TYPES_H__
+#define __HW_TYPES_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+volatile uint32_t *SimRegister(uint32_t address);
+
+#define HWREG(x)                (*SimRegister(x))
+
+#endif // __HW_TYPES_H__
@@ -0,0 +1,1586 @@
+// Simulated driverlib and board for the host build, see sim.h and README.md.
+// Peripherals are modelled on virtual time: SysTick, timer 0A, I2C0 with the TCA6424 and
+// PCA9557 expanders, UART0 on stdin/stdout or a pty, the hibernate RTC, EEPROM backed by
+// a file, the buzzer PWM as a logged frequency and the TCA6424 INT line on PM3. Firmware code that spins without calling
+// driverlib is preempted by a timer signal and treated as waiting for the next event.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "driverlib/eeprom.h"
+#include "driverlib/gpio.h"
+#include "driverlib/hibernate.h"
+#include "driverlib/i2c.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/pwm.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/systick.h"
+#include "driverlib/timer.h"
+#include "driverlib/uart.h"
+
+#define NS_PER_SECOND           1000000000ull
+#define NS_PER_MS               1000000ull
+#define SIM_UART_FIFO           16
+#define SIM_UART_OUTPUT         4096    // bytes buffered before writing the output fd
+#define SIM_RTC_SUBSECONDS      32768
+#define SIM_EEPROM_WORDS        1536    // 6KB in 96 blocks of 16 words
+#define SIM_EEPROM_WORD_NS      110000  // program time of one word
+#define SIM_KEY_EVENTS          64
+#define SIM_HIB_WORDS           16
+#define SIM_PREEMPT_US          50      // host time in firmware code before it counts as spinning
+
+#define TCA6424_ADDRESS         0x22
+#define TCA6424_INT_PIN         GPIO_PIN_3 // of port M, low while port0 differs from its last read
+#define PCA9557_ADDRESS         0x18
+
+#define DWT_CTRL                0xe0001000
+#define DWT_CYCCNT              0xe0001004
+#define DWT_CTRL_CYCCNTENA      0x00000001
+#define CORE_DEMCR              0xe000edfc
+#define CORE_DEMCR_TRCENA       0x01000000
+#define NVIC_INT_CTRL           0xe000ed04
+#define NVIC_INT_CTRL_PEND_SYST 0x04000000
+
+#define I2C_MCS_RUN             0x01
+#define I2C_MCS_START           0x02
+#define I2C_MCS_STOP            0x04
+
+void SysTick_Handler(void);
+void UART0_Handler(void);
+void I2C0_Handler(void);
+void TIMER0A_Handler(void);
+void HIBERNATE_Handler(void);
+void GPIOM_Handler(void) __attribute__((weak)); // only built with interrupt driven keys
+
+// main.o has its .text renamed by the Makefile, the linker provides the bounds,
+// other programs linking sim.o (the benchmarks) are never preempted
+extern const char __start_fw_text[] __attribute__((weak)), __stop_fw_text[] __attribute__((weak));
+
+sim_counters_t sim_counters;
+sim_board_t sim_board = {{0}, {0}, 0xff, {0}, 0};
+
+static void (*const sim_handlers[SIM_IRQ_COUNT])(void) = {
+    SysTick_Handler, UART0_Handler, I2C0_Handler, TIMER0A_Handler, HIBERNATE_Handler, GPIOM_Handler
+};
+static const char *const sim_irq_names[SIM_IRQ_COUNT] = {"systick", "uart0", "i2c0", "timer0a", "hibernate", "gpiom"};
+static const char *const sim_device_names[SIM_DEVICE_COUNT] = {"tca6424", "pca9557"};
+
+static struct {
+    int realtime;               // pace virtual time to the wall clock
+    int log;                    // events and statistics on stderr
+    int in_fd, out_fd;
+    const char *eeprom_path;
+    const char *stats_path;
+    uint64_t duration_ns;       // stop after this virtual time, 0 to run until idle
+    uint64_t idle_ns;           // stop this long after input ended and the output went quiet
+    uint64_t line_gap_ns;       // pause before each scripted input line
+    uint32_t nak_every;         // inject a data NAK every n data bytes, 0 for none
+    int64_t rtc_ppb;            // RTC crystal error, positive runs fast
+    struct { uint64_t at; uint8_t keys; } key_events[SIM_KEY_EVENTS];
+    uint8_t key_count, key_next;
+} config;
+
+static struct {
+    uint64_t now;
+    uint64_t wall_start;        // monotonic ns at virtual time 0, realtime mode
+    uint32_t cpu_hz;
+    uint64_t cycle_ns;
+    bool masked;                // PRIMASK
+    bool in_handler;
+    bool nvic[NUM_INTERRUPTS];
+} core = {0, 0, 20000000, 50, true, false, {false}};
+
+static struct {
+    bool enabled, inten, pending;
+    uint32_t reload;
+    uint32_t cycles;            // length of the running period
+    uint64_t start, wrap_at;
+} systick;
+
+static struct {
+    bool enabled, one_shot;     // a one-shot timer stops at its timeout
+    uint32_t load, ris, im;
+    uint64_t expire_at;
+} timer0;
+
+static uint64_t display_lit_at = SIM_NEVER; // a digit has shown segments since, SIM_NEVER while dark
+
+static struct {
+    uint64_t bit_ns;
+    uint8_t slave, data_tx, data_rx;
+    bool receive, busy, ris, im, bus_active, pointer_next;
+    int device;                 // addressed expander, -1 if none answered
+    uint32_t error;
+    uint64_t done_at, start_at;
+    uint64_t data_bytes;        // for NAK injection
+    uint8_t pointer[SIM_DEVICE_COUNT];
+    bool auto_increment;
+} i2c = {2500};
+
+static struct {
+    uint32_t baud;
+    uint64_t byte_ns;
+    uint32_t ris, im, tx_trigger, rx_trigger;
+    uint8_t tx_fifo[SIM_UART_FIFO], tx_head, tx_count, tx_byte;
+    bool tx_shifting;
+    uint64_t tx_done_at;
+    uint8_t rx_fifo[SIM_UART_FIFO], rx_head, rx_count;
+    uint64_t rx_at;             // next input byte lands, SIM_NEVER while waiting for input
+    bool rx_prompt;             // scripted input waits for the firmware to go back to sleep
+    uint64_t rt_at;             // receive timeout
+    uint8_t *input;
+    size_t input_length, input_position, input_capacity;
+    bool input_eof;
+    uint64_t quiet_at;          // input ended or the last byte left, whichever is later
+    uint8_t output[SIM_UART_OUTPUT];
+    size_t output_length;
+} uart = {115200, 86806, 0, 0, 2, 8};
+
+static struct {
+    bool active, enabled;
+    uint32_t seconds;           // counter at set_at
+    uint32_t ticks;             // sub-seconds at set_at
+    uint64_t set_at;
+    uint32_t match, ss_match, ris, im, trim;
+    uint64_t match_at;
+    uint32_t data[SIM_HIB_WORDS];
+} hib = {false, false, 0, 0, 0, 0, 0, 0, 0, 0x7fff, SIM_NEVER};
+
+static struct {
+    uint32_t period;
+    bool enabled;
+} pwm;
+
+static struct {
+    uint8_t latched;            // TCA6424 port0 input at its last read
+    bool level;                 // INT line
+    uint32_t im, ris;           // port M, falling edges only
+} gpio = {0xff, true, 0, 0};
+
+static struct {
+    uint32_t ctrl, cyccnt, demcr;
+    uint64_t cyccnt_at;         // virtual time cyccnt was last brought up to date
+} dwt;
+
+static uint32_t nvic_int_ctrl;  // read only, rebuilt from the pending state on every access
+
+static uint32_t eeprom[SIM_EEPROM_WORDS];
+static int eeprom_fd = -1;
+
+// resumed after SysCtlReset, what survives a reset on the board
+typedef struct sim_resume {
+    uint64_t now;
+    sim_counters_t counters;
+    uint32_t rtc_seconds, rtc_ticks;
+    uint64_t rtc_set_at;
+    uint32_t rtc_match, rtc_ss_match, rtc_trim;
+    uint32_t hib_data[SIM_HIB_WORDS];
+    uint64_t rx_at;
+    uint8_t rx_prompt, input_eof;
+    uint64_t quiet_at;
+    uint8_t key_next, keys;
+    uint64_t input_length;      // followed by the unread input
+} sim_resume_t;
+
+static void SimAdvance(uint64_t target);
+static void SimCall(void);
+static void SimExit(const char *reason, int status);
+static void SimPreempt(int signal, siginfo_t *info, void *context);
+static void SimLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static uint64_t SimWallNow(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+static uint64_t SimEnvMs(const char *name, uint64_t fallback) {
+    const char *value = getenv(name);
+
+    return value && *value ? strtoull(value, NULL, 10) * NS_PER_MS : fallback;
+}
+
+static void SimLog(const char *format, ...) {
+    va_list args;
+
+    if (!config.log) {
+        return;
+    }
+    fprintf(stderr, "[sim %llu.%06llu] ", (unsigned long long)(core.now / NS_PER_SECOND),
+        (unsigned long long)(core.now % NS_PER_SECOND / 1000));
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+uint64_t SimNow(void) {
+    return core.now;
+}
+
+/* ---- UART0 output and input ---- */
+
+static void SimOutputFlush(void) {
+    size_t done = 0;
+
+    while (done < uart.output_length) {
+        ssize_t n = write(config.out_fd, uart.output + done, uart.output_length - done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            break; // nobody listening on the pty, the bytes are lost like on an open line
+        }
+        done += n;
+    }
+    uart.output_length = 0;
+}
+
+static void SimOutputByte(uint8_t byte) {
+    uart.output[uart.output_length++] = byte;
+    if (uart.output_length == SIM_UART_OUTPUT) {
+        SimOutputFlush();
+    }
+}
+
+static bool SimInputRead(bool block) {
+    // append what the input fd has, true if anything arrived
+    ssize_t n;
+
+    if (uart.input_eof) {
+        return false;
+    }
+    if (!block) {
+        struct pollfd fd = {config.in_fd, POLLIN, 0};
+
+        if (poll(&fd, 1, 0) <= 0) {
+            return false;
+        }
+    }
+    if (uart.input_position == uart.input_length) {
+        uart.input_position = uart.input_length = 0;
+    }
+    if (uart.input_capacity - uart.input_length < 4096) {
+        uart.input_capacity = uart.input_capacity * 2 + 4096;
+        uart.input = realloc(uart.input, uart.input_capacity);
+    }
+
+    SimOutputFlush(); // a script may wait for the answer before sending more
+    do {
+        n = read(config.in_fd, uart.input + uart.input_length, uart.input_capacity - uart.input_length);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        if (n < 0 && errno == EAGAIN) {
+            return false;
+        }
+        if (n < 0 && errno == EIO && isatty(config.in_fd) == 0) {
+            return false; // pty without a client
+        }
+        uart.input_eof = true;
+        uart.quiet_at = core.now;
+        return false;
+    }
+    uart.input_length += n;
+    return true;
+}
+
+static void SimUartShift(void) {
+    // move the oldest FIFO byte into the shift register, TX interrupts at the trigger level
+    if (uart.tx_count > uart.tx_trigger && uart.tx_count - 1 <= uart.tx_trigger) {
+        uart.ris |= UART_INT_TX;
+    }
+    uart.tx_byte = uart.tx_fifo[uart.tx_head];
+    uart.tx_head = (uart.tx_head + 1) % SIM_UART_FIFO;
+    --uart.tx_count;
+    uart.tx_shifting = true;
+    uart.tx_done_at = core.now + uart.byte_ns;
+    sim_counters.uart_tx_busy_ns += uart.byte_ns;
+}
+
+static void SimUartReceive(void) {
+    // the next input byte lands in the receive FIFO
+    uint8_t byte;
+
+    if (uart.input_position == uart.input_length && !SimInputRead(!config.realtime)) {
+        uart.rx_at = SIM_NEVER; // realtime mode polls in SysCtlSleep
+        return;
+    }
+
+    byte = uart.input[uart.input_position++];
+    ++sim_counters.uart_rx_bytes;
+    if (uart.rx_count == SIM_UART_FIFO) {
+        ++sim_counters.uart_rx_overruns;
+    } else {
+        uart.rx_fifo[(uart.rx_head + uart.rx_count) % SIM_UART_FIFO] = byte;
+        if (++uart.rx_count == uart.rx_trigger) {
+            uart.ris |= UART_INT_RX;
+        }
+    }
+
+    uart.rt_at = core.now + uart.byte_ns * 32 / 10; // 32 bit periods
+    uart.rx_at = core.now + uart.byte_ns;
+    if (byte == '\n' && !config.realtime) { // the next line once this one has been answered
+        uart.rx_at = SIM_NEVER;
+        uart.rx_prompt = true;
+    }
+}
+
+/* ---- I2C0 and the expanders ---- */
+
+static uint8_t SimTca6424Read(uint8_t reg) {
+    uint8_t port = reg & 0x03;
+
+    if (port == 3 || reg > 0x0e) {
+        return 0xff;
+    }
+    if (reg < 0x04) { // input ports follow the outputs or the external pins
+        uint8_t pins = (port == 0) ? sim_board.keys : 0xff;
+
+        return ((sim_board.tca6424[0x0c + port] & pins) | (~sim_board.tca6424[0x0c + port] & sim_board.tca6424[0x04 + port]))
+            ^ sim_board.tca6424[0x08 + port];
+    }
+    return sim_board.tca6424[reg];
+}
+
+static void SimTca6424Int(void) {
+    // INT is open drain and pulls low while port0 differs from what was last read
+    bool level = SimTca6424Read(0x00) == gpio.latched;
+
+    if (gpio.level && !level) {
+        gpio.ris |= TCA6424_INT_PIN;
+    }
+    gpio.level = level;
+}
+
+static uint8_t SimPca9557Read(uint8_t reg) {
+    if (reg == 0) {
+        return ((sim_board.pca9557[3] & 0xff) | (~sim_board.pca9557[3] & sim_board.pca9557[1])) ^ sim_board.pca9557[2];
+    }
+    return sim_board.pca9557[reg & 0x03];
+}
+
+static void SimI2CWrite(uint8_t byte) {
+    // first byte after the address selects the register, the rest are written to it
+    uint8_t *pointer = &i2c.pointer[i2c.device];
+
+    if (i2c.pointer_next) {
+        i2c.pointer_next = false;
+        if (i2c.device == SIM_DEVICE_TCA6424) {
+            i2c.auto_increment = byte & 0x80;
+            *pointer = byte & 0x7f;
+        } else {
+            *pointer = byte & 0x03;
+        }
+        return;
+    }
+
+    ++sim_counters.i2c_writes[i2c.device];
+    if (i2c.device == SIM_DEVICE_TCA6424) {
+        if (*pointer >= 0x04 && *pointer <= 0x0e && (*pointer & 0x03) != 3) {
+            sim_board.tca6424[*pointer] = byte; // input ports ignore writes
+        }
+        if (i2c.auto_increment) { // rolls over within the group of 3 ports
+            *pointer = (*pointer & ~0x03) | (((*pointer & 0x03) + 1) % 3);
+        }
+    } else if (*pointer) {
+        sim_board.pca9557[*pointer] = byte;
+    }
+}
+
+static uint8_t SimI2CRead(void) {
+    uint8_t *pointer = &i2c.pointer[i2c.device];
+    uint8_t value;
+
+    ++sim_counters.i2c_reads[i2c.device];
+    if (i2c.device == SIM_DEVICE_TCA6424) {
+        value = SimTca6424Read(*pointer);
+        if (*pointer == 0x00) {
+            gpio.latched = value;
+            SimTca6424Int();
+        }
+        if (i2c.auto_increment) {
+            *pointer = (*pointer & ~0x03) | (((*pointer & 0x03) + 1) % 3);
+        }
+        return value;
+    }
+    return SimPca9557Read(*pointer);
+}
+
+static void SimDisplayLit(bool lit) {
+    // accumulate the time any segment is driven, the brightness the eye sees
+    if (display_lit_at != SIM_NEVER) {
+        sim_counters.display_lit_ns += core.now - display_lit_at;
+    }
+    display_lit_at = lit ? core.now : SIM_NEVER;
+}
+
+static void SimI2CStop(void) {
+    uint64_t latency = core.now - i2c.start_at;
+    uint8_t select = sim_board.tca6424[0x06], digit;
+
+    i2c.bus_active = false;
+    ++sim_counters.i2c_transactions;
+    sim_counters.i2c_latency_ns += latency;
+    if (latency > sim_counters.i2c_latency_max_ns) {
+        sim_counters.i2c_latency_max_ns = latency;
+    }
+
+    // port2 selects one digit, port1 drives its segments
+    if (i2c.device == SIM_DEVICE_TCA6424 && select && !(select & (select - 1))) {
+        for (digit = 0; !(select & (1 << digit)); ++digit);
+        sim_board.digits[digit] = sim_board.tca6424[0x05];
+    }
+    if (i2c.device == SIM_DEVICE_TCA6424) {
+        SimDisplayLit(select && sim_board.tca6424[0x05]);
+    }
+}
+
+/* ---- events and interrupts ---- */
+
+static bool SimIdleExit(void) {
+    // the script has been read and answered, and the firmware made it to its main loop
+    return uart.input_eof && config.idle_ns && sim_counters.sleeps && !uart.tx_shifting && !uart.tx_count;
+}
+
+static uint64_t SimNextEvent(void) {
+    uint64_t next = SIM_NEVER;
+
+#define SIM_EARLIER(t) do { if ((t) < next) next = (t); } while (0)
+    if (systick.enabled) SIM_EARLIER(systick.wrap_at);
+    if (timer0.enabled) SIM_EARLIER(timer0.expire_at);
+    if (i2c.busy) SIM_EARLIER(i2c.done_at);
+    if (uart.tx_shifting) SIM_EARLIER(uart.tx_done_at);
+    SIM_EARLIER(uart.rx_at);
+    SIM_EARLIER(uart.rt_at);
+    SIM_EARLIER(hib.match_at);
+    if (config.key_next < config.key_count) SIM_EARLIER(config.key_events[config.key_next].at);
+    if (config.duration_ns) SIM_EARLIER(config.duration_ns);
+    if (SimIdleExit()) SIM_EARLIER(uart.quiet_at + config.idle_ns);
+#undef SIM_EARLIER
+
+    return next;
+}
+
+static void SimEvents(void) {
+    // everything due at core.now
+    if (systick.enabled && systick.wrap_at <= core.now) {
+        systick.pending |= systick.inten;
+        systick.cycles = systick.reload + 1; // the reload value is taken at the wrap
+        systick.start = systick.wrap_at;
+        systick.wrap_at += systick.cycles * core.cycle_ns;
+    }
+    if (timer0.enabled && timer0.expire_at <= core.now) {
+        timer0.ris |= TIMER_TIMA_TIMEOUT;
+        if (timer0.one_shot) {
+            timer0.enabled = false;
+        } else {
+            timer0.expire_at += ((uint64_t)timer0.load + 1) * core.cycle_ns;
+        }
+    }
+    if (i2c.busy && i2c.done_at <= core.now) {
+        i2c.busy = false;
+        i2c.ris = true;
+    }
+    if (uart.tx_shifting && uart.tx_done_at <= core.now) {
+        uart.tx_shifting = false;
+        ++sim_counters.uart_tx_bytes;
+        SimOutputByte(uart.tx_byte);
+        uart.quiet_at = core.now;
+        if (uart.tx_count) {
+            SimUartShift();
+        }
+    }
+    if (uart.rx_at <= core.now) {
+        SimUartReceive();
+    }
+    if (uart.rt_at <= core.now) {
+        uart.rt_at = SIM_NEVER;
+        if (uart.rx_count) {
+            uart.ris |= UART_INT_RT;
+        }
+    }
+    if (hib.match_at <= core.now) {
+        hib.match_at = SIM_NEVER;
+        hib.ris |= HIBERNATE_INT_RTC_MATCH_0;
+    }
+    while (config.key_next < config.key_count && config.key_events[config.key_next].at <= core.now) {
+        sim_board.keys = config.key_events[config.key_next++].keys;
+        SimLog("keys %02x", sim_board.keys);
+        SimTca6424Int();
+    }
+
+    if (config.duration_ns && core.now >= config.duration_ns) {
+        SimExit("duration reached", 0);
+    }
+    if (SimIdleExit() && core.now >= uart.quiet_at + config.idle_ns) {
+        SimExit("input ended", 0);
+    }
+}
+
+static void SimAdvance(uint64_t target) {
+    uint64_t next;
+
+    while ((next = SimNextEvent()) <= target) {
+        if (next > core.now) {
+            core.now = next;
+        }
+        SimEvents();
+    }
+    if (target > core.now) {
+        core.now = target;
+    }
+    sim_counters.now_ns = core.now;
+}
+
+static int SimIrqPending(void) {
+    // highest priority pending and enabled source, -1 if none
+    if (systick.pending) return SIM_IRQ_SYSTICK;
+    if (core.nvic[INT_UART0] && (uart.ris & uart.im)) return SIM_IRQ_UART0;
+    if (core.nvic[INT_I2C0] && i2c.ris && i2c.im) return SIM_IRQ_I2C0;
+    if (core.nvic[INT_TIMER0A] && (timer0.ris & timer0.im)) return SIM_IRQ_TIMER0A;
+    if (core.nvic[INT_HIBERNATE] && (hib.ris & hib.im)) return SIM_IRQ_HIBERNATE;
+    if (core.nvic[INT_GPIOM] && (gpio.ris & gpio.im) && GPIOM_Handler) return SIM_IRQ_GPIOM;
+    return -1;
+}
+
+static void SimDispatch(void) {
+    // equal priorities, so handlers never nest and run one after another in vector order
+    int irq;
+
+    if (core.masked || core.in_handler) {
+        return;
+    }
+    core.in_handler = true;
+    while ((irq = SimIrqPending()) >= 0) {
+        if (irq == SIM_IRQ_SYSTICK) {
+            systick.pending = false; // exceptions clear on entry
+        }
+        ++sim_counters.irq[irq];
+        sim_handlers[irq]();
+    }
+    core.in_handler = false;
+}
+
+static void SimCall(void) {
+    ++sim_counters.calls;
+    SimAdvance(core.now + SIM_CALL_CYCLES * core.cycle_ns);
+    SimDispatch();
+}
+
+static void SimWait(uint64_t target) {
+    // realtime mode, sleep until the wall clock reaches target or input arrives
+    for (;;) {
+        uint64_t wall = SimWallNow() - core.wall_start;
+        struct pollfd fd = {config.in_fd, POLLIN, 0};
+        int timeout;
+
+        if (wall >= target) {
+            return;
+        }
+        SimOutputFlush();
+        timeout = (int)((target - wall + NS_PER_MS - 1) / NS_PER_MS);
+        if (poll(&fd, uart.input_eof ? 0 : 1, timeout > 1000 ? 1000 : timeout) > 0 && SimInputRead(false)) {
+            wall = SimWallNow() - core.wall_start;
+            SimAdvance(wall < target ? wall : target);
+            if (uart.rx_at == SIM_NEVER) {
+                uart.rx_at = core.now;
+            }
+            return;
+        }
+    }
+}
+
+/* ---- statistics and lifecycle ---- */
+
+void SimStatsPrint(FILE *file) {
+    double seconds = (double)core.now / NS_PER_SECOND;
+    int i;
+
+    SimDisplayLit(display_lit_at != SIM_NEVER);
+
+    fprintf(file, "[sim] virtual time %.6f s, %llu driverlib calls, asleep %.1f%% in %llu sleeps, "
+        "spinning %.1f%% in %llu preemptions\n", seconds, (unsigned long long)sim_counters.calls,
+        core.now ? 100.0 * sim_counters.sleep_ns / core.now : 0.0, (unsigned long long)sim_counters.sleeps,
+        core.now ? 100.0 * sim_counters.spin_ns / core.now : 0.0, (unsigned long long)sim_counters.preemptions);
+    fprintf(file, "[sim] interrupts:");
+    for (i = 0; i < SIM_IRQ_COUNT; ++i) {
+        fprintf(file, " %s %llu", sim_irq_names[i], (unsigned long long)sim_counters.irq[i]);
+    }
+    fprintf(file, "\n[sim] i2c: %llu transactions, %llu bytes, bus busy %.1f%%, latency avg %.1f us max %.1f us, %llu naks\n",
+        (unsigned long long)sim_counters.i2c_transactions, (unsigned long long)sim_counters.i2c_bytes,
+        core.now ? 100.0 * sim_counters.i2c_busy_ns / core.now : 0.0,
+        sim_counters.i2c_transactions ? sim_counters.i2c_latency_ns / 1000.0 / sim_counters.i2c_transactions : 0.0,
+        sim_counters.i2c_latency_max_ns / 1000.0, (unsigned long long)sim_counters.i2c_naks);
+    for (i = 0; i < SIM_DEVICE_COUNT; ++i) {
+        fprintf(file, "[sim] %s: %llu register writes, %llu reads\n", sim_device_names[i],
+            (unsigned long long)sim_counters.i2c_writes[i], (unsigned long long)sim_counters.i2c_reads[i]);
+    }
+    fprintf(file, "[sim] uart0: %llu bytes out, %llu bytes in, %llu overruns, line busy %.1f%%\n",
+        (unsigned long long)sim_counters.uart_tx_bytes, (unsigned long long)sim_counters.uart_rx_bytes,
+        (unsigned long long)sim_counters.uart_rx_overruns, core.now ? 100.0 * sim_counters.uart_tx_busy_ns / core.now : 0.0);
+    fprintf(file, "[sim] eeprom: %llu words programmed, %llu read; pwm: %llu changes; resets: %llu\n",
+        (unsigned long long)sim_counters.eeprom_words_programmed, (unsigned long long)sim_counters.eeprom_words_read,
+        (unsigned long long)sim_counters.pwm_changes, (unsigned long long)sim_counters.resets);
+    fprintf(file, "[sim] display: lit %.1f%%\n", core.now ? 100.0 * sim_counters.display_lit_ns / core.now : 0.0);
+}
+
+void SimStatsJson(FILE *file) {
+    int i;
+
+    SimDisplayLit(display_lit_at != SIM_NEVER);
+
+    fprintf(file, "{\"now_ns\": %llu, \"calls\": %llu, \"sleep_ns\": %llu, \"sleeps\": %llu, "
+        "\"spin_ns\": %llu, \"preemptions\": %llu, \"irq\": {", (unsigned long long)core.now,
+        (unsigned long long)sim_counters.calls, (unsigned long long)sim_counters.sleep_ns,
+        (unsigned long long)sim_counters.sleeps, (unsigned long long)sim_counters.spin_ns,
+        (unsigned long long)sim_counters.preemptions);
+    for (i = 0; i < SIM_IRQ_COUNT; ++i) {
+        fprintf(file, "%s\"%s\": %llu", i ? ", " : "", sim_irq_names[i], (unsigned long long)sim_counters.irq[i]);
+    }
+    fprintf(file, "}, \"i2c_transactions\": %llu, \"i2c_bytes\": %llu, \"i2c_busy_ns\": %llu, "
+        "\"i2c_latency_ns\": %llu, \"i2c_latency_max_ns\": %llu, \"i2c_naks\": %llu",
+        (unsigned long long)sim_counters.i2c_transactions, (unsigned long long)sim_counters.i2c_bytes,
+        (unsigned long long)sim_counters.i2c_busy_ns, (unsigned long long)sim_counters.i2c_latency_ns,
+        (unsigned long long)sim_counters.i2c_latency_max_ns, (unsigned long long)sim_counters.i2c_naks);
+    for (i = 0; i < SIM_DEVICE_COUNT; ++i) {
+        fprintf(file, ", \"%s_writes\": %llu, \"%s_reads\": %llu", sim_device_names[i],
+            (unsigned long long)sim_counters.i2c_writes[i], sim_device_names[i], (unsigned long long)sim_counters.i2c_reads[i]);
+    }
+    fprintf(file, ", \"uart_tx_bytes\": %llu, \"uart_rx_bytes\": %llu, \"uart_rx_overruns\": %llu, \"uart_tx_busy_ns\": %llu, "
+        "\"eeprom_words_programmed\": %llu, \"eeprom_words_read\": %llu, \"pwm_changes\": %llu, \"resets\": %llu, "
+        "\"display_lit_ns\": %llu}\n",
+        (unsigned long long)sim_counters.uart_tx_bytes, (unsigned long long)sim_counters.uart_rx_bytes,
+        (unsigned long long)sim_counters.uart_rx_overruns, (unsigned long long)sim_counters.uart_tx_busy_ns,
+        (unsigned long long)sim_counters.eeprom_words_programmed, (unsigned long long)sim_counters.eeprom_words_read,
+        (unsigned long long)sim_counters.pwm_changes, (unsigned long long)sim_counters.resets,
+        (unsigned long long)sim_counters.display_lit_ns);
+}
+
+static void SimExit(const char *reason, int status) {
+    SimOutputFlush();
+    SimLog("%s", reason);
+    if (config.log) {
+        SimStatsPrint(stderr);
+    }
+    if (config.stats_path) {
+        FILE *file = fopen(config.stats_path, "w");
+
+        if (file) {
+            SimStatsJson(file);
+            fclose(file);
+        }
+    }
+    exit(status);
+}
+
+static void SimParseKeys(const char *script) {
+    // "ms:hex,ms:hex", port0 pin levels from a virtual time on
+    while (script && *script && config.key_count < SIM_KEY_EVENTS) {
+        char *end;
+        uint64_t ms = strtoull(script, &end, 10);
+
+        if (*end != ':') {
+            break;
+        }
+        config.key_events[config.key_count].at = ms * NS_PER_MS;
+        config.key_events[config.key_count++].keys = (uint8_t)strtoul(end + 1, &end, 16);
+        script = (*end == ',') ? end + 1 : NULL;
+    }
+}
+
+static void SimOpenPty(void) {
+    struct termios raw;
+    int slave;
+
+    config.in_fd = config.out_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (config.in_fd < 0 || grantpt(config.in_fd) || unlockpt(config.in_fd)) {
+        perror("[sim] pty");
+        exit(1);
+    }
+    fcntl(config.in_fd, F_SETFL, O_NONBLOCK);
+
+    // raw line discipline, kept open so the master does not see a hangup between clients
+    slave = open(ptsname(config.in_fd), O_RDWR | O_NOCTTY);
+    if (slave >= 0 && tcgetattr(slave, &raw) == 0) {
+        cfmakeraw(&raw);
+        tcsetattr(slave, TCSANOW, &raw);
+    }
+    fprintf(stderr, "[sim] uart0 on %s\n", ptsname(config.in_fd));
+}
+
+static void SimResume(const char *path) {
+    FILE *file = fopen(path, "rb");
+    sim_resume_t state;
+
+    if (!file || fread(&state, sizeof(state), 1, file) != 1) {
+        fprintf(stderr, "[sim] cannot resume from %s\n", path);
+        exit(1);
+    }
+    core.now = state.now;
+    sim_counters = state.counters;
+    hib.active = hib.enabled = true; // the RTC kept counting through the reset
+    hib.seconds = state.rtc_seconds;
+    hib.ticks = state.rtc_ticks;
+    hib.set_at = state.rtc_set_at;
+    hib.match = state.rtc_match;
+    hib.ss_match = state.rtc_ss_match;
+    hib.trim = state.rtc_trim;
+    memcpy(hib.data, state.hib_data, sizeof(hib.data));
+    uart.rx_at = state.rx_at;
+    uart.rx_prompt = state.rx_prompt;
+    uart.input_eof = state.input_eof;
+    uart.quiet_at = state.quiet_at;
+    config.key_next = state.key_next;
+    sim_board.keys = state.keys;
+    uart.input_capacity = state.input_length + 4096;
+    uart.input = malloc(uart.input_capacity);
+    uart.input_length = fread(uart.input, 1, state.input_length, file);
+    fclose(file);
+    unlink(path);
+    unsetenv("SIM_RESUME");
+}
+
+__attribute__((constructor)) static void SimInit(void) {
+    const char *value;
+
+    config.in_fd = STDIN_FILENO;
+    config.out_fd = STDOUT_FILENO;
+    config.log = !(getenv("SIM_LOG") && strcmp(getenv("SIM_LOG"), "0") == 0);
+    config.eeprom_path = getenv("SIM_EEPROM");
+    config.stats_path = getenv("SIM_STATS");
+    config.duration_ns = SimEnvMs("SIM_DURATION_MS", 0);
+    config.idle_ns = SimEnvMs("SIM_IDLE_MS", NS_PER_SECOND);
+    config.line_gap_ns = SimEnvMs("SIM_LINE_GAP_MS", 20 * NS_PER_MS);
+    config.nak_every = getenv("SIM_I2C_NAK_EVERY") ? strtoul(getenv("SIM_I2C_NAK_EVERY"), NULL, 10) : 0;
+    config.rtc_ppb = getenv("SIM_RTC_PPM") ? (int64_t)(strtod(getenv("SIM_RTC_PPM"), NULL) * 1000) : 0;
+    SimParseKeys(getenv("SIM_KEYS"));
+
+    config.realtime = isatty(STDIN_FILENO);
+    if ((value = getenv("SIM_PTY")) && strcmp(value, "0") != 0) {
+        SimOpenPty();
+        config.realtime = 1;
+    }
+    if ((value = getenv("SIM_REALTIME"))) {
+        config.realtime = strcmp(value, "0") != 0;
+    }
+    if (config.realtime) {
+        config.idle_ns = 0; // runs until interrupted
+    }
+
+    uart.rx_at = SIM_NEVER;
+    uart.rx_prompt = !config.realtime; // scripts start once initialization is done
+    uart.rt_at = SIM_NEVER;
+    if ((value = getenv("SIM_RESUME"))) {
+        SimResume(value);
+    }
+    core.wall_start = SimWallNow() - core.now;
+
+    if (__start_fw_text) {
+        struct sigaction action;
+        struct itimerval interval = {{0, SIM_PREEMPT_US}, {0, SIM_PREEMPT_US}};
+
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = SimPreempt;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigaction(SIGALRM, &action, NULL);
+        setitimer(ITIMER_REAL, &interval, NULL); // CPU time timers only have scheduler tick resolution
+    }
+}
+
+/* ---- memory-mapped registers ---- */
+
+volatile uint32_t *SimRegister(uint32_t address) {
+    // the cycle counter is brought up to date on every access, so a write through the
+    // returned pointer restarts it from the written value
+    uint64_t cycles;
+
+    SimCall();
+    switch (address) {
+        case DWT_CTRL:
+            return &dwt.ctrl;
+        case CORE_DEMCR:
+            return &dwt.demcr;
+        case DWT_CYCCNT:
+            cycles = (core.now - dwt.cyccnt_at) / core.cycle_ns;
+            if ((dwt.ctrl & DWT_CTRL_CYCCNTENA) && (dwt.demcr & CORE_DEMCR_TRCENA)) {
+                dwt.cyccnt += (uint32_t)cycles;
+            }
+            dwt.cyccnt_at += cycles * core.cycle_ns;
+            return &dwt.cyccnt;
+        case NVIC_INT_CTRL:
+            nvic_int_ctrl = systick.pending ? NVIC_INT_CTRL_PEND_SYST : 0;
+            return &nvic_int_ctrl;
+        default:
+            fprintf(stderr, "[sim] register 0x%08x is not simulated\n", address);
+            abort();
+    }
+}
+
+/* ---- sysctl ---- */
+
+uint32_t SysCtlClockFreqSet(uint32_t config_, uint32_t freq) {
+    SimCall();
+    core.cpu_hz = freq;
+    core.cycle_ns = NS_PER_SECOND / freq;
+    return freq;
+}
+
+void SysCtlPeripheralEnable(uint32_t peripheral) {
+    SimCall();
+}
+
+bool SysCtlPeripheralReady(uint32_t peripheral) {
+    SimCall();
+    return true;
+}
+
+void SysCtlPeripheralSleepEnable(uint32_t peripheral) {
+    SimCall();
+}
+
+void SysCtlPeripheralSleepDisable(uint32_t peripheral) {
+    SimCall();
+}
+
+void SysCtlPeripheralClockGating(bool enable) {
+    SimCall();
+}
+
+static uint64_t SimIdle(void) {
+    // advance until an enabled interrupt is pending, even while masked
+    uint64_t start = core.now;
+
+    while (SimIrqPending() < 0) {
+        uint64_t next = SimNextEvent();
+
+        if (next == SIM_NEVER) {
+            SimExit("asleep with nothing to wake up", 1);
+        }
+        if (config.realtime) {
+            SimWait(next);
+            if (next > core.now && SimNextEvent() < next) {
+                continue; // input arrived first
+            }
+        }
+        SimAdvance(next);
+    }
+    return core.now - start;
+}
+
+static void SimPreempt(int signal, siginfo_t *info, void *context) {
+    // the firmware has been running its own code for a while, it is polling a flag that
+    // only an interrupt can change (or computing, which is charged the same way)
+    const ucontext_t *uc = context;
+    int saved = errno;
+#if defined(__x86_64__)
+    uintptr_t pc = uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    uintptr_t pc = uc->uc_mcontext.pc;
+#else
+    uintptr_t pc = 0;
+#endif
+
+    if (pc >= (uintptr_t)__start_fw_text && pc < (uintptr_t)__stop_fw_text && !core.masked && !core.in_handler) {
+        ++sim_counters.preemptions;
+        sim_counters.spin_ns += SimIdle();
+        SimDispatch();
+    }
+    errno = saved;
+}
+
+void SysCtlSleep(void) {
+    // WFI
+    SimCall();
+    if (uart.rx_prompt) {
+        uart.rx_prompt = false;
+        uart.rx_at = core.now + config.line_gap_ns;
+    }
+    sim_counters.sleep_ns += SimIdle();
+    ++sim_counters.sleeps;
+}
+
+void SysCtlReset(void) {
+    // the hibernate module, the EEPROM file and the unread input survive, main.c starts over
+    char path[] = "/tmp/sim-resume-XXXXXX";
+    sim_resume_t state;
+    int fd = mkstemp(path);
+    FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+
+    SimAdvance(core.now + SIM_CALL_CYCLES * core.cycle_ns);
+    while (uart.tx_shifting) { // let the last response leave
+        SimAdvance(uart.tx_done_at);
+    }
+    SimOutputFlush();
+    if (!file) {
+        SimExit("reset, cannot save state", 1);
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.now = core.now;
+    state.counters = sim_counters;
+    ++state.counters.resets;
+    state.rtc_seconds = hib.seconds;
+    state.rtc_ticks = hib.ticks;
+    state.rtc_set_at = hib.set_at;
+    state.rtc_match = hib.match;
+    state.rtc_ss_match = hib.ss_match;
+    state.rtc_trim = hib.trim;
+    memcpy(state.hib_data, hib.data, sizeof(hib.data));
+    state.rx_at = uart.rx_at;
+    state.rx_prompt = uart.rx_prompt;
+    state.input_eof = uart.input_eof;
+    state.quiet_at = uart.quiet_at;
+    state.key_next = config.key_next;
+    state.keys = sim_board.keys;
+    state.input_length = uart.input_length - uart.input_position;
+    fwrite(&state, sizeof(state), 1, file);
+    fwrite(uart.input + uart.input_position, 1, state.input_length, file);
+    fclose(file);
+
+    SimLog("reset");
+    fflush(stderr);
+    setenv("SIM_RESUME", path, 1);
+    setitimer(ITIMER_REAL, &(struct itimerval){{0, 0}, {0, 0}}, NULL); // survives exec
+    execl("/proc/self/exe", program_invocation_name, (char *)NULL);
+    SimExit("reset, exec failed", 1);
+}
+
+/* ---- NVIC ---- */
+
+bool IntMasterEnable(void) {
+    bool masked = core.masked;
+
+    core.masked = false;
+    SimCall(); // pending interrupts are taken here
+    return masked;
+}
+
+bool IntMasterDisable(void) {
+    bool masked = core.masked;
+
+    SimCall();
+    core.masked = true;
+    return masked;
+}
+
+void IntEnable(uint32_t interrupt) {
+    SimCall();
+    if (interrupt < NUM_INTERRUPTS) {
+        core.nvic[interrupt] = true;
+    }
+}
+
+void IntDisable(uint32_t interrupt) {
+    SimCall();
+    if (interrupt < NUM_INTERRUPTS) {
+        core.nvic[interrupt] = false;
+    }
+}
+
+/* ---- SysTick ---- */
+
+void SysTickEnable(void) {
+    SimCall();
+    if (!systick.enabled) {
+        systick.enabled = true;
+        systick.cycles = systick.reload + 1;
+        systick.start = core.now;
+        systick.wrap_at = core.now + systick.cycles * core.cycle_ns;
+    }
+}
+
+void SysTickDisable(void) {
+    SimCall();
+    systick.enabled = false;
+}
+
+void SysTickIntEnable(void) {
+    SimCall();
+    systick.inten = true;
+}
+
+void SysTickIntDisable(void) {
+    SimCall();
+    systick.inten = false;
+}
+
+void SysTickPeriodSet(uint32_t period) {
+    SimCall();
+    systick.reload = period - 1; // takes effect at the next wrap
+}
+
+uint32_t SysTickPeriodGet(void) {
+    SimCall();
+    return systick.reload + 1;
+}
+
+uint32_t SysTickValueGet(void) {
+    uint64_t elapsed;
+
+    SimCall();
+    elapsed = (core.now - systick.start) / core.cycle_ns;
+    return elapsed >= systick.cycles ? 0 : systick.cycles - 1 - (uint32_t)elapsed;
+}
+
+/* ---- GPIO, only the TCA6424 INT line is modelled, other inputs read high ---- */
+
+void GPIOPinConfigure(uint32_t config_) { SimCall(); }
+void GPIOPinTypeGPIOInput(uint32_t port, uint8_t pins) { SimCall(); }
+void GPIOPinTypeGPIOOutput(uint32_t port, uint8_t pins) { SimCall(); }
+void GPIOPinTypeUART(uint32_t port, uint8_t pins) { SimCall(); }
+void GPIOPinTypeI2C(uint32_t port, uint8_t pins) { SimCall(); }
+void GPIOPinTypeI2CSCL(uint32_t port, uint8_t pins) { SimCall(); }
+void GPIOPinTypePWM(uint32_t port, uint8_t pins) { SimCall(); }
+void GPIOPadConfigSet(uint32_t port, uint8_t pins, uint32_t strength, uint32_t type) { SimCall(); }
+void GPIOIntTypeSet(uint32_t port, uint8_t pins, uint32_t type) { SimCall(); }
+
+void GPIOIntEnable(uint32_t port, uint32_t flags) {
+    SimCall();
+    if (port == GPIO_PORTM_BASE) {
+        gpio.im |= flags;
+    }
+}
+
+void GPIOIntDisable(uint32_t port, uint32_t flags) {
+    SimCall();
+    if (port == GPIO_PORTM_BASE) {
+        gpio.im &= ~flags;
+    }
+}
+
+uint32_t GPIOIntStatus(uint32_t port, bool masked) {
+    SimCall();
+    if (port != GPIO_PORTM_BASE) {
+        return 0;
+    }
+    return masked ? gpio.ris & gpio.im : gpio.ris;
+}
+
+void GPIOIntClear(uint32_t port, uint32_t flags) {
+    SimCall();
+    if (port == GPIO_PORTM_BASE) {
+        gpio.ris &= ~flags;
+    }
+}
+
+int32_t GPIOPinRead(uint32_t port, uint8_t pins) {
+    SimCall();
+    if (port == GPIO_PORTM_BASE && !gpio.level) {
+        return pins & ~TCA6424_INT_PIN;
+    }
+    return pins;
+}
+
+/* ---- UART0 ---- */
+
+void UARTConfigSetExpClk(uint32_t base, uint32_t clock, uint32_t baud, uint32_t config_) {
+    // like UARTDisable, waits for the transmitter and flushes the FIFOs
+    SimCall();
+    while (uart.tx_shifting || uart.tx_count) {
+        SimAdvance(uart.tx_done_at);
+    }
+    uart.rx_count = 0;
+    uart.baud = baud;
+    uart.byte_ns = NS_PER_SECOND * 10 / baud; // start, 8 data and stop bits
+    SimLog("uart0 %u baud", baud);
+}
+
+void UARTFIFOLevelSet(uint32_t base, uint32_t tx_level, uint32_t rx_level) {
+    static const uint8_t levels[] = {2, 4, 8, 12, 14}; // of 16 bytes
+
+    SimCall();
+    uart.tx_trigger = levels[tx_level % 5];
+    uart.rx_trigger = levels[(rx_level >> 3) % 5];
+}
+
+void UARTIntEnable(uint32_t base, uint32_t flags) {
+    SimCall();
+    uart.im |= flags;
+}
+
+void UARTIntDisable(uint32_t base, uint32_t flags) {
+    SimCall();
+    uart.im &= ~flags;
+}
+
+uint32_t UARTIntStatus(uint32_t base, bool masked) {
+    SimCall();
+    return masked ? uart.ris & uart.im : uart.ris;
+}
+
+void UARTIntClear(uint32_t base, uint32_t flags) {
+    SimCall();
+    uart.ris &= ~flags;
+}
+
+bool UARTCharsAvail(uint32_t base) {
+    SimCall();
+    return uart.rx_count > 0;
+}
+
+bool UARTSpaceAvail(uint32_t base) {
+    SimCall();
+    return uart.tx_count < SIM_UART_FIFO;
+}
+
+int32_t UARTCharGetNonBlocking(uint32_t base) {
+    uint8_t byte;
+
+    SimCall();
+    if (!uart.rx_count) {
+        return -1;
+    }
+    byte = uart.rx_fifo[uart.rx_head];
+    uart.rx_head = (uart.rx_head + 1) % SIM_UART_FIFO;
+    --uart.rx_count;
+    return byte;
+}
+
+bool UARTCharPutNonBlocking(uint32_t base, unsigned char data) {
+    SimCall();
+    if (uart.tx_count == SIM_UART_FIFO) {
+        return false;
+    }
+    uart.tx_fifo[(uart.tx_head + uart.tx_count) % SIM_UART_FIFO] = data;
+    ++uart.tx_count;
+    if (!uart.tx_shifting) {
+        SimUartShift();
+    }
+    return true;
+}
+
+bool UARTBusy(uint32_t base) {
+    SimCall();
+    return uart.tx_shifting || uart.tx_count;
+}
+
+/* ---- I2C0 ---- */
+
+void I2CMasterInitExpClk(uint32_t base, uint32_t clock, bool fast) {
+    SimCall();
+    i2c.bit_ns = NS_PER_SECOND / (fast ? 400000 : 100000);
+}
+
+void I2CMasterEnable(uint32_t base) {
+    SimCall();
+}
+
+void I2CMasterIntEnable(uint32_t base) {
+    SimCall();
+    i2c.im = true;
+}
+
+void I2CMasterIntDisable(uint32_t base) {
+    SimCall();
+    i2c.im = false;
+}
+
+void I2CMasterIntClear(uint32_t base) {
+    SimCall();
+    i2c.ris = false;
+}
+
+bool I2CMasterIntStatus(uint32_t base, bool masked) {
+    SimCall();
+    return masked ? i2c.ris && i2c.im : i2c.ris;
+}
+
+void I2CMasterSlaveAddrSet(uint32_t base, uint8_t address, bool receive) {
+    SimCall();
+    i2c.slave = address;
+    i2c.receive = receive;
+}
+
+void I2CMasterDataPut(uint32_t base, uint8_t data) {
+    SimCall();
+    i2c.data_tx = data;
+}
+
+uint32_t I2CMasterDataGet(uint32_t base) {
+    SimCall();
+    return i2c.data_rx;
+}
+
+void I2CMasterControl(uint32_t base, uint32_t command) {
+    // START sends the address, RUN one data byte and STOP ends the transaction,
+    // the interrupt is raised once the bits have been clocked out
+    uint32_t bits = 0;
+
+    SimCall();
+    i2c.error = I2C_MASTER_ERR_NONE;
+
+    if (command & I2C_MCS_START) {
+        if (!i2c.bus_active) {
+            i2c.start_at = core.now;
+        }
+        i2c.bus_active = true;
+        bits += 1 + 9;
+        ++sim_counters.i2c_bytes;
+        i2c.device = (i2c.slave == TCA6424_ADDRESS) ? SIM_DEVICE_TCA6424
+            : (i2c.slave == PCA9557_ADDRESS) ? SIM_DEVICE_PCA9557 : -1;
+        i2c.pointer_next = !i2c.receive;
+        if (i2c.device < 0) {
+            i2c.error = I2C_MASTER_ERR_ADDR_ACK;
+            ++sim_counters.i2c_naks;
+            command &= ~I2C_MCS_RUN;
+        }
+    }
+
+    if ((command & I2C_MCS_RUN) && i2c.bus_active && i2c.device >= 0) {
+        bits += 9;
+        ++sim_counters.i2c_bytes;
+        if (config.nak_every && ++i2c.data_bytes % config.nak_every == 0) {
+            i2c.error = I2C_MASTER_ERR_DATA_ACK;
+            ++sim_counters.i2c_naks;
+            command &= ~I2C_MCS_STOP; // the master holds the bus until told to stop
+        } else if (i2c.receive) {
+            i2c.data_rx = SimI2CRead();
+        } else {
+            SimI2CWrite(i2c.data_tx);
+        }
+    }
+
+    if (command & I2C_MCS_STOP) {
+        bits += 1;
+        if (i2c.bus_active) {
+            SimI2CStop();
+        }
+    }
+
+    i2c.busy = true;
+    i2c.done_at = core.now + bits * i2c.bit_ns;
+    sim_counters.i2c_busy_ns += bits * i2c.bit_ns;
+}
+
+uint32_t I2CMasterErr(uint32_t base) {
+    SimCall();
+    return i2c.busy ? I2C_MASTER_ERR_NONE : i2c.error;
+}
+
+bool I2CMasterBusy(uint32_t base) {
+    SimCall();
+    return i2c.busy;
+}
+
+/* ---- PWM, the buzzer ---- */
+
+void PWMGenConfigure(uint32_t base, uint32_t gen, uint32_t config_) {
+    SimCall();
+}
+
+void PWMGenPeriodSet(uint32_t base, uint32_t gen, uint32_t period) {
+    SimCall();
+    pwm.period = period;
+}
+
+uint32_t PWMGenPeriodGet(uint32_t base, uint32_t gen) {
+    SimCall();
+    return pwm.period;
+}
+
+void PWMPulseWidthSet(uint32_t base, uint32_t out, uint32_t width) {
+    SimCall();
+}
+
+void PWMOutputState(uint32_t base, uint32_t out_bits, bool enable) {
+    SimCall();
+}
+
+void PWMGenEnable(uint32_t base, uint32_t gen) {
+    uint32_t hz;
+
+    SimCall();
+    hz = pwm.period ? core.cpu_hz / pwm.period : 0; // PWM clock is the system clock
+    if (hz != sim_board.buzzer_hz) {
+        ++sim_counters.pwm_changes;
+        SimLog("buzzer %u Hz", hz);
+    }
+    sim_board.buzzer_hz = hz;
+}
+
+void PWMGenDisable(uint32_t base, uint32_t gen) {
+    SimCall();
+    if (sim_board.buzzer_hz) {
+        ++sim_counters.pwm_changes;
+        SimLog("buzzer off");
+    }
+    sim_board.buzzer_hz = 0;
+}
+
+/* ---- timer 0A ---- */
+
+void TimerConfigure(uint32_t base, uint32_t config_) {
+    SimCall();
+    timer0.one_shot = (config_ == TIMER_CFG_ONE_SHOT);
+}
+
+void TimerLoadSet(uint32_t base, uint32_t timer, uint32_t value) {
+    SimCall();
+    timer0.load = value;
+}
+
+void TimerEnable(uint32_t base, uint32_t timer) {
+    SimCall();
+    if (!timer0.enabled) {
+        timer0.enabled = true;
+        timer0.expire_at = core.now + ((uint64_t)timer0.load + 1) * core.cycle_ns;
+    }
+}
+
+void TimerDisable(uint32_t base, uint32_t timer) {
+    SimCall();
+    timer0.enabled = false;
+}
+
+void TimerIntEnable(uint32_t base, uint32_t flags) {
+    SimCall();
+    timer0.im |= flags;
+}
+
+void TimerIntDisable(uint32_t base, uint32_t flags) {
+    SimCall();
+    timer0.im &= ~flags;
+}
+
+void TimerIntClear(uint32_t base, uint32_t flags) {
+    SimCall();
+    timer0.ris &= ~flags;
+}
+
+/* ---- hibernate module and RTC ---- */
+
+static unsigned __int128 SimRtcRate(unsigned __int128 *denominator) {
+    // sub-seconds per ns as a fraction: the crystal error, then the trim averaged over its 64s period,
+    // the first second of every 64 lasts trim + 1 sub-seconds
+    *denominator = (unsigned __int128)NS_PER_SECOND * NS_PER_SECOND * (64 * SIM_RTC_SUBSECONDS + hib.trim - 0x7fff);
+    return (unsigned __int128)SIM_RTC_SUBSECONDS * 64 * SIM_RTC_SUBSECONDS * (NS_PER_SECOND + config.rtc_ppb);
+}
+
+static uint64_t SimRtcTicks(void) {
+    // sub-seconds counted since the counter read hib.seconds
+    unsigned __int128 denominator, rate = SimRtcRate(&denominator);
+
+    return hib.ticks + (uint64_t)((core.now - hib.set_at) * rate / denominator);
+}
+
+static void SimRtcRebase(void) {
+    // fold the time counted so far into seconds and ticks, before the rate changes
+    uint64_t ticks = SimRtcTicks();
+
+    hib.seconds += (uint32_t)(ticks / SIM_RTC_SUBSECONDS);
+    hib.ticks = (uint32_t)(ticks % SIM_RTC_SUBSECONDS);
+    hib.set_at = core.now;
+}
+
+static void SimRtcSchedule(void) {
+    // the match interrupt fires when the counter steps onto the match value and sub-second
+    unsigned __int128 denominator, rate = SimRtcRate(&denominator);
+    uint64_t target = (uint64_t)(hib.match - hib.seconds) * SIM_RTC_SUBSECONDS + hib.ss_match;
+
+    if (hib.enabled && hib.match >= hib.seconds && hib.match - hib.seconds < (1u << 24) // months, no overflow
+        && target > hib.ticks) {
+        uint64_t ticks = target - hib.ticks;
+
+        hib.match_at = hib.set_at + (uint64_t)((ticks * denominator + rate - 1) / rate);
+        if (hib.match_at <= core.now) {
+            hib.match_at = SIM_NEVER;
+        }
+    } else {
+        hib.match_at = SIM_NEVER;
+    }
+}
+
+bool HibernateIsActive(void) {
+    SimCall();
+    return hib.active;
+}
+
+void HibernateEnableExpClk(uint32_t clock) {
+    SimCall();
+}
+
+void HibernateClockConfig(uint32_t config_) {
+    SimCall();
+}
+
+void HibernateRTCEnable(void) {
+    SimCall();
+    if (!hib.enabled) {
+        hib.enabled = true;
+        if (!hib.active) {
+            hib.set_at = core.now;
+        }
+        hib.active = true;
+        SimRtcSchedule();
+    }
+}
+
+void HibernateCounterMode(uint32_t config_) {
+    SimCall();
+}
+
+void HibernateRTCSet(uint32_t seconds) {
+    SimCall();
+    hib.seconds = seconds;
+    hib.ticks = 0; // also clears the sub-second counter
+    hib.set_at = core.now;
+    SimRtcSchedule();
+}
+
+uint32_t HibernateRTCGet(void) {
+    SimCall();
+    return hib.enabled ? hib.seconds + (uint32_t)(SimRtcTicks() / SIM_RTC_SUBSECONDS) : hib.seconds;
+}
+
+uint32_t HibernateRTCSSGet(void) {
+    SimCall();
+    return hib.enabled ? (uint32_t)(SimRtcTicks() % SIM_RTC_SUBSECONDS) : 0;
+}
+
+void HibernateRTCMatchSet(uint32_t match, uint32_t value) {
+    SimCall();
+    hib.match = value;
+    SimRtcSchedule();
+}
+
+uint32_t HibernateRTCMatchGet(uint32_t match) {
+    SimCall();
+    return hib.match;
+}
+
+void HibernateRTCSSMatchSet(uint32_t match, uint32_t value) {
+    SimCall();
+    hib.ss_match = value % SIM_RTC_SUBSECONDS;
+    SimRtcSchedule();
+}
+
+void HibernateRTCTrimSet(uint32_t trim) {
+    SimCall();
+    if (hib.enabled) {
+        SimRtcRebase();
+    }
+    hib.trim = trim;
+    SimRtcSchedule();
+}
+
+uint32_t HibernateRTCTrimGet(void) {
+    SimCall();
+    return hib.trim;
+}
+
+void HibernateDataSet(uint32_t *data, uint32_t count) {
+    SimCall();
+    memcpy(hib.data, data, (count < SIM_HIB_WORDS ? count : SIM_HIB_WORDS) * sizeof(uint32_t));
+}
+
+void HibernateDataGet(uint32_t *data, uint32_t count) {
+    SimCall();
+    memcpy(data, hib.data, (count < SIM_HIB_WORDS ? count : SIM_HIB_WORDS) * sizeof(uint32_t));
+}
+
+void HibernateIntEnable(uint32_t flags) {
+    SimCall();
+    hib.im |= flags;
+}
+
+void HibernateIntDisable(uint32_t flags) {
+    SimCall();
+    hib.im &= ~flags;
+}
+
+void HibernateIntClear(uint32_t flags) {
+    SimCall();
+    hib.ris &= ~flags;
+}
+
+uint32_t HibernateIntStatus(bool masked) {
+    SimCall();
+    return masked ? hib.ris & hib.im : hib.ris;
+}
+
+void HibernateWakeSet(uint32_t flags) {
+    SimCall();
+}
+
+void HibernateRequest(void) {
+    SimCall();
+    SimExit("hibernate requested", 0);
+}
+
+/* ---- EEPROM ---- */
+
+uint32_t EEPROMInit(void) {
+    SimCall();
+    if (eeprom_fd >= 0) {
+        return EEPROM_INIT_OK;
+    }
+
+    memset(eeprom, 0xff, sizeof(eeprom)); // erased
+    if (config.eeprom_path) {
+        eeprom_fd = open(config.eeprom_path, O_RDWR | O_CREAT, 0644);
+        if (eeprom_fd < 0) {
+            perror("[sim] eeprom");
+            return EEPROM_INIT_ERROR;
+        }
+        if (pread(eeprom_fd, eeprom, sizeof(eeprom), 0) != (ssize_t)sizeof(eeprom)) {
+            memset(eeprom, 0xff, sizeof(eeprom));
+            if (pwrite(eeprom_fd, eeprom, sizeof(eeprom), 0) != (ssize_t)sizeof(eeprom)) {
+                perror("[sim] eeprom");
+            }
+        }
+    }
+    return EEPROM_INIT_OK;
+}
+
+uint32_t EEPROMSizeGet(void) {
+    SimCall();
+    return sizeof(eeprom);
+}
+
+uint32_t EEPROMBlockCountGet(void) {
+    SimCall();
+    return SIM_EEPROM_WORDS / 16;
+}
+
+void EEPROMRead(uint32_t *data, uint32_t address, uint32_t count) {
+    SimCall();
+    if (address + count > sizeof(eeprom)) {
+        count = address < sizeof(eeprom) ? sizeof(eeprom) - address : 0;
+    }
+    memcpy(data, (uint8_t *)eeprom + address, count);
+    sim_counters.eeprom_words_read += count / 4;
+}
+
+uint32_t EEPROMProgram(uint32_t *data, uint32_t address, uint32_t count) {
+    // blocks for the program time of every word
+    SimCall();
+    if (address % 4 || count % 4 || address + count > sizeof(eeprom)) {
+        return 1;
+    }
+    memcpy((uint8_t *)eeprom + address, data, count);
+    sim_counters.eeprom_words_programmed += count / 4;
+    SimAdvance(core.now + (uint64_t)count / 4 * SIM_EEPROM_WORD_NS);
+    if (eeprom_fd >= 0 && pwrite(eeprom_fd, (uint8_t *)eeprom + address, count, address) != (ssize_t)count) {
+        perror("[sim] eeprom");
+    }
+    return 0;
+}
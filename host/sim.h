@@ -0,0 +1,74 @@
+// Simulated TM4C1294 board for running main.c on a Linux host.
+// Virtual time advances by SIM_CALL_CYCLES in every driverlib call and jumps to the next
+// peripheral event in SysCtlSleep, interrupt handlers run between calls while unmasked.
+// Firmware code that polls a flag without calling driverlib is preempted every
+// SIM_PREEMPT_US of host CPU time and skips ahead the same way.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIM_CALL_CYCLES         20      // CPU cycles charged per driverlib call
+#define SIM_NEVER               UINT64_MAX
+
+enum {
+    SIM_IRQ_SYSTICK,                    // in vector order, lower runs first
+    SIM_IRQ_UART0,
+    SIM_IRQ_I2C0,
+    SIM_IRQ_TIMER0A,
+    SIM_IRQ_HIBERNATE,
+    SIM_IRQ_GPIOM,
+    SIM_IRQ_COUNT
+};
+
+enum {
+    SIM_DEVICE_TCA6424,
+    SIM_DEVICE_PCA9557,
+    SIM_DEVICE_COUNT
+};
+
+typedef struct sim_counters {
+    uint64_t now_ns;                    // virtual time at the last update
+    uint64_t calls;                     // driverlib calls
+    uint64_t sleep_ns;                  // virtual time in SysCtlSleep
+    uint64_t sleeps;
+    uint64_t spin_ns;                   // virtual time skipped while firmware code was polling
+    uint64_t preemptions;
+    uint64_t irq[SIM_IRQ_COUNT];        // handler runs per source
+    uint64_t i2c_transactions;          // START to STOP
+    uint64_t i2c_bytes;                 // address and data bytes on the bus
+    uint64_t i2c_busy_ns;               // bus occupied
+    uint64_t i2c_latency_ns;            // sum of START to STOP times
+    uint64_t i2c_latency_max_ns;
+    uint64_t i2c_naks;                  // address and injected data NAKs
+    uint64_t i2c_writes[SIM_DEVICE_COUNT]; // register bytes written per expander
+    uint64_t i2c_reads[SIM_DEVICE_COUNT];
+    uint64_t uart_tx_bytes;
+    uint64_t uart_rx_bytes;
+    uint64_t uart_rx_overruns;          // bytes lost to a full receive FIFO
+    uint64_t uart_tx_busy_ns;           // shift register occupied
+    uint64_t eeprom_words_programmed;
+    uint64_t eeprom_words_read;
+    uint64_t pwm_changes;               // buzzer started, stopped or retuned
+    uint64_t display_lit_ns;            // a digit showed segments
+    uint64_t resets;
+} sim_counters_t;
+
+typedef struct sim_board {
+    uint8_t tca6424[16];                // register file, inputs 0x00-0x02 read the pins
+    uint8_t pca9557[4];
+    uint8_t keys;                       // pins of TCA6424 port0, low while a key is pressed
+    uint8_t digits[8];                  // segments on each digit when its transaction stopped
+    uint32_t buzzer_hz;                 // 0 while silent
+} sim_board_t;
+
+extern sim_counters_t sim_counters;
+extern sim_board_t sim_board;
+
+uint64_t SimNow(void);
+void SimStatsPrint(FILE *file);
+void SimStatsJson(FILE *file);
+
+#endif // SIM_H
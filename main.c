@@ -18,8 +18,18 @@
 #include "driverlib/pwm.h"
 #include "driverlib/hibernate.h"
 #include "driverlib/eeprom.h"
+#include "driverlib/timer.h"
 
 #define SYSTICK_FREQUENCY       1000
+#define SYSTICK_DYNAMIC         1       // 1: stretch each SysTick period to the next counter deadline, 0: fixed 1ms tick
+#define SYSTICK_MAX_RELOAD      0x01000000 // SysTick is a 24-bit counter
+#define POWER_SLEEP             1       // 1: WFI when the main loop has no work, 0: spin
+#define PERF_ENABLE             1       // 1: time main loop stages with the DWT cycle counter, 0: counters only
+#define KEY_INTERRUPT           0       // 1: read the keypad when the TCA6424 INT line falls, 0: poll it every 20ms
+#define KEY_INT_PERIPH          SYSCTL_PERIPH_GPIOM // TCA6424 INT, open drain, not yet checked against the schematic
+#define KEY_INT_BASE            GPIO_PORTM_BASE
+#define KEY_INT_PIN             GPIO_PIN_3
+#define KEY_INT_VECTOR          INT_GPIOM
 
 #define PCA9557_I2CADDR         0x18
 #define PCA9557_INPUT           0x00
@@ -37,7 +47,42 @@
 #define TCA6424_CONFIG_PORT0    0x0c
 #define TCA6424_CONFIG_PORT1    0x0d
 #define TCA6424_CONFIG_PORT2    0x0e
-#define TCA6424_DELAY           10000
+#define TCA6424_AUTO_INCREMENT  0x80    // command bit, address rolls over within a group of 3 ports
+
+#define UART0_TX_BUFFER_SIZE    4096    // must be power of 2, holds the whole help message
+#define UART0_TX_BLOCK          0       // wait until the message fits
+#define UART0_TX_DROP           1       // drop the whole message and the rest of its line
+#define UART0_TX_TRUNCATE       2       // keep what fits, end with UART0_TX_TRUNCATE_MARK, drop the rest of the line
+#define UART0_TX_OVERFLOW       UART0_TX_TRUNCATE
+#define UART0_TX_TRUNCATE_MARK  "~\r\n"
+
+#define UART0_BAUD_DEFAULT      115200  // power-on rate and fallback
+#define UART0_BAUD_MIN          1200
+#define UART0_BAUD_TOLERANCE    2       // largest baud divisor error in percent
+#define UART0_BAUD_TIMEOUT      10000   // ms to receive a valid command at a new rate before falling back
+
+#define UART0_RX_LINE_SIZE      128     // longest command including terminating '\0'
+#define UART0_RX_LINES          8       // completed lines waiting for main loop, must be power of 2
+#define UART0_LINE_NONE         0
+#define UART0_LINE_OK           1
+#define UART0_LINE_TOO_LONG     2
+
+#define I2C0_QUEUE_SIZE         32      // pending transactions, must be power of 2
+#define I2C0_MAX_DATA           4       // payload bytes of one transaction
+#define I2C0_OP_WRITE           0
+#define I2C0_OP_READ            1
+#define I2C0_STATE_IDLE         0
+#define I2C0_STATE_WRITE        1       // sending payload
+#define I2C0_STATE_READ_ADDR    2       // register address sent, restart as receiver
+#define I2C0_STATE_READ         3       // receiving payload
+
+#define DISPLAY_DIGITS          8
+#define DISPLAY_REFRESH_RATE    60      // full frames per second, one digit per timer interrupt
+#define DISPLAY_BURST_WRITE     1       // 1: one auto-increment transaction per digit, 0: three single writes
+#define DISPLAY_BRIGHTNESS_MIN  5       // percent, shorter on-times are swallowed by the I2C write that ends them
+#define DISPLAY_FLOW_LENGTH     16      // digits of the scrolling datetime, YYYY.MM.DD HH.MM.SS
+#define DISPLAY_FLOW_STALE      0xffffffff // display_flow_time when the cached datetime must be rendered again
+#define DISPLAY_FLOW_NONE       0xff    // display_flow_window when the back buffer holds something else
 
 #define BUTTON_UP               4
 #define BUTTON_DOWN             3
@@ -49,8 +94,16 @@
 #define BUTTON_3                2
 #define BUTTON_BACK             7
 
-#define KEY_CONFIG_PRESS        0x01
-#define KEY_DELAY               10      // time interval for holding button, times of 20ms
+#define KEY_PRESS               0x01    // gestures, press and repeat set keystate_t.flag, the others .gesture
+#define KEY_REPEAT              0x02    // held past delay_ms, again every repeat_ms, faster the longer it is held
+#define KEY_LONG                0x04    // held for long_ms, once per press
+#define KEY_RELEASE             0x08
+#define KEY_DOUBLE              0x10    // pressed again within KEY_DOUBLE_MS of the release
+#define KEY_CHORD               0x20    // may form a chord in key_chord with other KEY_CHORD keys
+#define KEY_DEBOUNCE_MS         20      // an accepted edge masks bounces of the key for this long
+#define KEY_DOUBLE_MS           300
+#define KEY_CHORD_MS            100     // presses this close together form a chord
+#define KEY_REPEAT_ACCEL        8       // repeats before the interval halves
 
 #define MODE_DISPLAY            0x01
 #define MODE_SETDATE            0x02
@@ -64,10 +117,149 @@
 #define ERROR_PARTIAL           0x0800
 #define ERROR_FORMAT            0x1000
 
+#define COMMAND_MAX_TOKENS      8
+#define COMMAND_MAX_ARGS        4
+#define COMMAND_RESPONSE_SIZE   64      // single line response without CRLF
+#define COMMAND_HASH_SIZE       256     // slots of the command index, must be power of 2
+#define VERB_HASH_SIZE          64      // slots of the verb index, must be power of 2
+#define COMMAND_SEED_TRIES      256     // seeds tried for a collision-free index, then collisions are probed
+#define COMMAND_FLAG_STREAM     0x01    // writes its own (multi-line) output
+#define COMMAND_FLAG_NO_BATCH   0x02    // restarts, sleeps or depends on state changed earlier in the batch
+
+#define BATCH_MAX_COMMANDS      8       // commands separated by ';' in one line
+#define BATCH_OK                0       // status codes of the aggregated batch response
+#define BATCH_UNKNOWN           1       // unknown command
+#define BATCH_ARGUMENT          2       // wrong sub-verb or number of arguments
+#define BATCH_FORMAT            3       // malformed or out of range argument
+#define BATCH_NOT_ALLOWED       4       // command cannot run in a batch
+
+#define FRAME_MAX_PAYLOAD       48      // largest response payload, after opcode and status
+#define FRAME_RESPONSE          0x80    // set in the opcode of a response frame
+#define FRAME_OP_GET_DATE       0x01
+#define FRAME_OP_GET_TIME       0x02
+#define FRAME_OP_GET_DATETIME   0x03
+#define FRAME_OP_GET_ALARM      0x04
+#define FRAME_OP_GET_I2C        0x05
+#define FRAME_OP_GET_UART       0x06
+#define FRAME_OP_GET_POWER      0x07
+#define FRAME_OP_GET_ROM        0x08
+#define FRAME_OP_GET_EPOCH      0x09
+#define FRAME_OP_GET_CALENDAR   0x0a
+#define FRAME_OP_GET_ZONE       0x0b
+#define FRAME_OP_SET_DATE       0x11
+#define FRAME_OP_SET_TIME       0x12
+#define FRAME_OP_SET_ALARM      0x13
+#define FRAME_OP_SET_BAUD       0x14
+#define FRAME_OP_SET_ZONE       0x15
+#define FRAME_OP_SET_DISPLAY    0x16
+#define FRAME_OP_SET_BRIGHTNESS 0x17
+#define FRAME_OP_SET_DIM        0x18
+#define FRAME_OP_MUTE           0x21
+#define FRAME_OP_CLOCK_INIT     0x31
+#define FRAME_OP_CLOCK_RESTART  0x32
+#define FRAME_OP_CLOCK_HIB      0x33
+#define FRAME_OP_ALARM_GET      0x40
+#define FRAME_OP_ALARM_ADD      0x41
+#define FRAME_OP_ALARM_DEL      0x42
+#define FRAME_OP_ALARM_SNOOZE   0x43
+#define FRAME_OP_DATE_DIFF      0x50
+#define FRAME_OP_TEXT           0x7f    // reserved, back to text commands
+#define FRAME_OK                0       // status byte of a response frame
+#define FRAME_BAD_CRC           1       // CRC mismatch or malformed COBS, opcode is not trusted
+#define FRAME_UNKNOWN           2       // unknown opcode
+#define FRAME_BAD_LENGTH        3       // payload length does not match the opcode
+#define FRAME_BAD_ARGUMENT      4       // field out of range
+#define FRAME_TOO_LONG          5       // frame longer than UART0_RX_LINE_SIZE - 1 encoded bytes
+
+#define HIB_DATA_ANCHOR         0       // hibernate memory word of the date at RTC second 0, the next one holds its complement
+#define HIB_DATA_ROM_HEAD       2       // hibernate memory word of the newest journal slot, the next one holds its complement
+#define HIB_DATA_WORDS          4       // words of hibernate memory in use
+
+#define RTC_SUBSECONDS          32768   // sub-second counter of the hibernate RTC
+#define RTC_TRIM_NOMINAL        0x7fff  // the first second of every 64 lasts trim + 1 sub-seconds
+#define RTC_TRIM_RANGE          511     // HibernateRTCTrimSet accepts 0x7e00 to 0x81ff
+
+#define SYNC_STEP_US            128000  // offsets from SYNC ADJUST this large are stepped, smaller ones slewed
+#define SYNC_STEP_LEAD          64      // sub-seconds before a step the RTC match wakes SyncPoll, the rest is waited out
+#define SYNC_SLEW_MAX           256     // trim units of slew per 64s, about 120ppm
+#define SYNC_FREQ_MAX_PPB       200000  // frequency correction limit, one trim unit is 477ppb
+#define SYNC_FREQ_GAIN          2       // each drift estimate moves the frequency by this fraction of its error
+#define SYNC_FREQ_MIN_INTERVAL  60      // seconds between exchanges before the drift is estimated
+#define SYNC_FREQ_SAVE_PPB      1000    // journal the frequency when it moved this far
+#define SYNC_DELAY_MAX_US       100000  // exchanges with a longer round trip are rejected
+
+#define CALENDAR_EPOCH_SHIFT    719468  // days from 0000/03/01 to the epoch 1970/01/01
+#define CALENDAR_ERA_DAYS       146097  // days in 400 years, also whole weeks
+#define CALENDAR_EPOCH_WEEKDAY  4       // 1970/01/01 was a Thursday
+
+#define TZ_TRANSITIONS          4       // upcoming DST transitions kept expanded
+#define TZ_NEVER                0x7fffffffffffffffLL // instant of a transition that does not exist
+#define TZ_NAME_SIZE            12      // zone name with terminating '\0', like CST or <+08:00>
+#define TZ_DEFAULT_TIME         7200    // DST transitions at 02:00:00 if the rule gives no time
+#define TZ_MAX_OFFSET           86400   // largest offset from UTC accepted
+
 #define ROM_MAGIC               0xbeefcafe
-#define ROM_ADDRESS             0x0400
+#define ROM_VERSION             2       // layout of rom_record_t, records of other versions are ignored
+#define ROM_ADDRESS             0x0400  // first journal slot, must be block aligned
+#define ROM_SLOTS               16      // four 64-byte EEPROM blocks per slot, written round robin
+#define ROM_ENDURANCE           500000  // write cycles of an EEPROM block
+#define ROM_COALESCE_MS         2000    // commit once changes stop for this long
+#define ROM_MAX_DELAY_MS        10000   // or at the latest this long after the first change
+
+#define ALARM_COUNT             16      // alarm slots, alarm 0 is the one SET ALARM and the keypad edit
+#define ALARM_NEVER             0xffffffff // due of an alarm that is not queued
+#define ALARM_DAILY             0x7f    // weekday mask of every day
+#define ALARM_SEARCH_DAYS       64      // longest gap of a day-of-month mask is 61 days, Aug 31 to Oct 31
+#define ALARM_SNOOZE_SECONDS    300
+
+#define PERF_STAGE_KEYS         0       // DetectKey
+#define PERF_STAGE_MODE         1       // ProcDisplay, ProcSetDate or ProcSetTime
+#define PERF_STAGE_SCAN         2       // TIMER0A_Handler, one digit of the display scan
+#define PERF_STAGE_COMMAND      3       // ProcessCommand or ProcessFrame
+#define PERF_STAGE_TICK         4       // the 1s tick: RTC phase, refresh and alarm poll
+#define PERF_STAGE_LOOP         5       // main loop from wakeup to sleep
+#define PERF_STAGE_COUNT        6
+#define PERF_BINS               8       // histogram <16us, <64us, <256us, <1ms, <4ms, <16ms, <64ms, more
+#define PERF_BIN_FIRST_US       16      // upper edge of the first bin, each bin is 4 times wider
+
+#define EVENT_QUEUE_SIZE        16      // events posted by interrupt handlers, must be power of 2
+#define EVENT_TICK_20MS         0       // key sampling period
+#define EVENT_TICK_250MS        1       // fast flow, focus flash and alarm beeps
+#define EVENT_TICK_500MS        2       // flow
+#define EVENT_TICK_1S           3       // SysTick second, kept in phase with the RTC
+#define EVENT_KEYS              4       // TCA6424 port0 sampled, data is the port value
+#define EVENT_ALARM             5       // RTC match, the earliest alarm is due
+#define EVENT_TYPES             6
+#define EVENT_MERGE_NONE        0       // every event takes a slot
+#define EVENT_MERGE_COUNT       1       // folded into a pending event of the same type, count adds up
+#define EVENT_MERGE_LATEST      2       // same, and the newer data replaces the pending one
+
+#define SUBSCRIBE_TICK          0x01    // topics of SUBSCRIBE, RTC second boundaries every subscribe_rate seconds
+#define SUBSCRIBE_ALARM         0x02    // ring, mute, snooze, set and delete of each alarm
+#define SUBSCRIBE_TIME          0x04    // date, time or zone set from keys, text or frames
+#define SUBSCRIBE_MODE          0x08    // keypad setting modes
+#define SUBSCRIBE_TOPICS        4
+#define SUBSCRIBE_ALL           0x0f
+#define SUBSCRIBE_RATE_MAX      3600    // seconds between ticks
+#define SUBSCRIBE_TX_RESERVE    256     // TX ring bytes events leave free for command responses
+#define SUBSCRIBE_LINE_SIZE     64
+#define SUBSCRIBE_ALARM_RING    0       // actions of an alarm event
+#define SUBSCRIBE_ALARM_MUTE    1
+#define SUBSCRIBE_ALARM_SNOOZE  2
+#define SUBSCRIBE_ALARM_SET     3
+#define SUBSCRIBE_ALARM_DEL     4
+
+// DWT, debug and NVIC registers of the Cortex-M4, not covered by driverlib
+#define DWT_CTRL                0xe0001000
+#define DWT_CYCCNT              0xe0001004
+#define DWT_CTRL_CYCCNTENA      0x00000001
+#define CORE_DEMCR              0xe000edfc
+#define CORE_DEMCR_TRCENA       0x01000000
+#define NVIC_INT_CTRL           0xe000ed04
+#define NVIC_INT_CTRL_PEND_SYST 0x04000000
 
 #define MAX(a, b)               (((a) > (b)) ? (a) : (b))
+#define MIN(a, b)               (((a) < (b)) ? (a) : (b))
 
 //#define ENABLE_DEBUG
 
@@ -85,52 +277,451 @@ typedef struct datetime {
 } datetime_t;
 
 typedef struct keystate {
-    uint8_t config;
-    uint8_t state;  // including previous state by shifting bit
-    uint8_t timer;
-    uint8_t flag;   // true if need to be handled
+    uint8_t flag;       // true if a press or repeat needs to be handled
+    uint8_t gesture;    // KEY_LONG, KEY_RELEASE and KEY_DOUBLE not yet handled
+    uint8_t pressed;    // debounced state
+    uint8_t pending;    // KEY_LONG and KEY_REPEAT still to come in this press
+    uint8_t taps;       // presses in a row, each within KEY_DOUBLE_MS of the last release
+    uint8_t repeats;    // auto repeats in this press
+    uint32_t edge;      // GetMillis of the last accepted press or release
+    uint32_t deadline;  // GetMillis of the next auto repeat
 } keystate_t;
 
+typedef struct key_config {
+    uint8_t gestures;   // KEY_* reported for the key
+    uint16_t long_ms;
+    uint16_t delay_ms;  // before the first repeat
+    uint16_t repeat_ms; // halved every KEY_REPEAT_ACCEL repeats
+    uint16_t repeat_min_ms;
+} key_config_t;
+
 typedef uint16_t error_t;
 
+typedef struct perf_stage {
+    uint32_t count;
+    uint32_t min;                       // cycles
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[PERF_BINS];
+} perf_stage_t;
+
+typedef struct event {
+    uint8_t type;
+    uint8_t data;                       // EVENT_KEYS: port value
+    uint16_t count;                     // occurrences merged into it, saturates
+    uint32_t time;                      // GetMillis of the first occurrence
+} event_t;
+
+typedef struct event_stats {
+    uint32_t posted;
+    uint32_t merged;                    // folded into a pending event
+    uint32_t dropped;                   // queue full and nothing to merge into
+    uint32_t latency_max;               // ms from the first occurrence to the main loop
+} event_stats_t;
+
+typedef struct command_line {
+    char text[UART0_RX_LINE_SIZE];          // upper case, separated by single spaces
+    uint8_t count;                          // number of tokens
+    uint8_t start[COMMAND_MAX_TOKENS];      // token offset in text
+    uint8_t length[COMMAND_MAX_TOKENS];
+    uint8_t source[COMMAND_MAX_TOKENS];     // token offset in the raw command, for error carets
+} command_line_t;
+
+typedef struct command_arg {
+    datetime_t datetime;    // 'D' and 'T' arguments
+    uint32_t number;        // 'N' arguments
+    const char *word;       // token of the argument, upper case, not terminated
+    uint8_t length;         // token length, 0 if an optional argument is omitted
+} command_arg_t;
+
+typedef void (*command_handler_t)(const command_arg_t *args, char *response);
+typedef error_t (*command_check_t)(const command_arg_t *args); // reports unless command_quiet
+
+typedef struct command {
+    const char *verb;
+    const char *sub;        // "" if the verb takes no sub-verb
+    const char *schema;     // one char per argument: D date, T time, N number, W word, lower case if optional
+    uint8_t flags;
+    command_handler_t handler;
+    command_check_t check;  // runs while parsing, so a batch is rejected before any command runs
+} command_t;
+
+typedef uint8_t (*frame_handler_t)(const uint8_t *request, uint8_t *response, uint8_t *length);
+
+typedef struct frame_command {
+    uint8_t opcode;
+    uint8_t length;         // request payload bytes
+    frame_handler_t handler; // returns the status, fills response payload and its length
+} frame_command_t;
+
+// Command table, the only place a command is declared: verb, sub-verb, argument schema, flags, handler,
+// check of the parsed arguments (NULL if the schema says it all)
+#define COMMAND_LIST(X) \
+    X("?",      "",         "",     COMMAND_FLAG_STREAM | COMMAND_FLAG_NO_BATCH, CmdHelp,           NULL) \
+    X("MUTE",   "",         "",     0,                      CmdMute,           NULL) \
+    X("CLOCK",  "INIT",     "",     COMMAND_FLAG_NO_BATCH,  CmdClockInit,      NULL) \
+    X("CLOCK",  "RESTART",  "",     COMMAND_FLAG_NO_BATCH,  CmdClockRestart,   NULL) \
+    X("CLOCK",  "HIB",      "",     COMMAND_FLAG_NO_BATCH,  CmdClockHib,       NULL) \
+    X("GET",    "DATE",     "",     0,                      CmdGetDate,        NULL) \
+    X("GET",    "TIME",     "",     0,                      CmdGetTime,        NULL) \
+    X("GET",    "ALARM",    "",     0,                      CmdGetAlarm,       NULL) \
+    X("GET",    "I2C",      "",     COMMAND_FLAG_STREAM,    CmdGetI2C,         NULL) \
+    X("GET",    "UART",     "",     COMMAND_FLAG_STREAM,    CmdGetUart,        NULL) \
+    X("GET",    "POWER",    "",     COMMAND_FLAG_STREAM,    CmdGetPower,       NULL) \
+    X("GET",    "ROM",      "",     COMMAND_FLAG_STREAM,    CmdGetRom,         NULL) \
+    X("GET",    "WEEKDAY",  "",     0,                      CmdGetWeekday,     NULL) \
+    X("GET",    "YEARDAY",  "",     0,                      CmdGetYearday,     NULL) \
+    X("GET",    "EPOCH",    "",     0,                      CmdGetEpoch,       NULL) \
+    X("GET",    "ZONE",     "",     COMMAND_FLAG_STREAM,    CmdGetZone,        NULL) \
+    X("GET",    "SYNC",     "",     COMMAND_FLAG_STREAM,    CmdGetSync,        NULL) \
+    X("SET",    "DATE",     "D",    0,                      CmdSetDate,        NULL) \
+    X("SET",    "TIME",     "T",    0,                      CmdSetTime,        NULL) \
+    X("SET",    "ALARM",    "T",    0,                      CmdSetAlarm,       NULL) \
+    X("SET",    "BAUD",     "Nw",   COMMAND_FLAG_NO_BATCH,  CmdSetBaud,        NULL) \
+    X("SET",    "ZONE",     "W",    0,                      CmdSetZone,        CmdSetZoneCheck) \
+    X("SET",    "DISPLAY",  "W",    0,                      CmdSetDisplay,     CmdSetDisplayCheck) \
+    X("SET",    "BRIGHTNESS", "N",  0,                      CmdSetBrightness,  CmdSetBrightnessCheck) \
+    X("SET",    "DIM",      "NTT",  0,                      CmdSetDim,         CmdSetDimCheck) \
+    X("ALARM",  "ADD",      "Tw",   COMMAND_FLAG_NO_BATCH,  CmdAlarmAdd,       NULL) \
+    X("ALARM",  "LIST",     "",     COMMAND_FLAG_STREAM,    CmdAlarmList,      NULL) \
+    X("ALARM",  "DEL",      "N",    COMMAND_FLAG_NO_BATCH,  CmdAlarmDelete,    NULL) \
+    X("ALARM",  "SNOOZE",   "",     0,                      CmdAlarmSnooze,    NULL) \
+    X("DATE",   "DIFF",     "Dd",   0,                      CmdDateDiff,       NULL) \
+    X("SYNC",   "",         "",     COMMAND_FLAG_NO_BATCH,  CmdSync,           NULL) \
+    X("SYNC",   "ADJUST",   "WW",   COMMAND_FLAG_NO_BATCH,  CmdSyncAdjust,     NULL) \
+    X("SUBSCRIBE", "",      "Wn",   0,                      CmdSubscribe,      CmdSubscribeCheck) \
+    X("UNSUBSCRIBE", "",    "w",    0,                      CmdUnsubscribe,    CmdUnsubscribeCheck) \
+    X("STATS",  "",         "",     COMMAND_FLAG_STREAM,    CmdStats,          NULL) \
+    X("STATS",  "RESET",    "",     0,                      CmdStatsReset,     NULL) \
+    X("MODE",   "BINARY",   "",     COMMAND_FLAG_NO_BATCH,  CmdModeBinary,     NULL)
+
+#define COMMAND_ENTRY(verb, sub, schema, flags, handler, check) {verb, sub, schema, flags, handler, check},
+#define COMMAND_PROTOTYPE(verb, sub, schema, flags, handler, check) void handler(const command_arg_t *args, char *response);
+
+// Binary frame table: opcode, request payload length, handler
+#define FRAME_LIST(X) \
+    X(FRAME_OP_GET_DATE,        0,  FrameGetDate) \
+    X(FRAME_OP_GET_TIME,        0,  FrameGetTime) \
+    X(FRAME_OP_GET_DATETIME,    0,  FrameGetDatetime) \
+    X(FRAME_OP_GET_ALARM,       0,  FrameGetAlarm) \
+    X(FRAME_OP_GET_I2C,         0,  FrameGetI2C) \
+    X(FRAME_OP_GET_UART,        0,  FrameGetUart) \
+    X(FRAME_OP_GET_POWER,       0,  FrameGetPower) \
+    X(FRAME_OP_GET_ROM,         0,  FrameGetRom) \
+    X(FRAME_OP_GET_EPOCH,       0,  FrameGetEpoch) \
+    X(FRAME_OP_GET_CALENDAR,    0,  FrameGetCalendar) \
+    X(FRAME_OP_GET_ZONE,        0,  FrameGetZone) \
+    X(FRAME_OP_SET_DATE,        4,  FrameSetDate) \
+    X(FRAME_OP_SET_TIME,        4,  FrameSetTime) \
+    X(FRAME_OP_SET_ALARM,       4,  FrameSetAlarm) \
+    X(FRAME_OP_SET_BAUD,        5,  FrameSetBaud) \
+    X(FRAME_OP_SET_ZONE,        16, FrameSetZone) \
+    X(FRAME_OP_SET_DISPLAY,     1,  FrameSetDisplay) \
+    X(FRAME_OP_SET_BRIGHTNESS,  1,  FrameSetBrightness) \
+    X(FRAME_OP_SET_DIM,         9,  FrameSetDim) \
+    X(FRAME_OP_MUTE,            0,  FrameMute) \
+    X(FRAME_OP_CLOCK_INIT,      0,  FrameClockInit) \
+    X(FRAME_OP_CLOCK_RESTART,   0,  FrameClockRestart) \
+    X(FRAME_OP_CLOCK_HIB,       0,  FrameClockHib) \
+    X(FRAME_OP_ALARM_GET,       1,  FrameAlarmGet) \
+    X(FRAME_OP_ALARM_ADD,       9,  FrameAlarmAdd) \
+    X(FRAME_OP_ALARM_DEL,       1,  FrameAlarmDelete) \
+    X(FRAME_OP_ALARM_SNOOZE,    0,  FrameAlarmSnooze) \
+    X(FRAME_OP_DATE_DIFF,       8,  FrameDateDiff) \
+    X(FRAME_OP_TEXT,            0,  FrameText)
+
+#define FRAME_ENTRY(opcode, size, handler) {opcode, size, handler},
+#define FRAME_PROTOTYPE(opcode, size, handler) uint8_t handler(const uint8_t *request, uint8_t *response, uint8_t *length);
+
+struct i2c_transaction;
+typedef void (*i2c_callback_t)(const struct i2c_transaction *transaction);
+
+typedef struct i2c_transaction {
+    uint8_t device;
+    uint8_t reg;
+    uint8_t op;         // I2C0_OP_WRITE or I2C0_OP_READ
+    uint8_t length;     // bytes in data, 1 to I2C0_MAX_DATA
+    uint8_t data[I2C0_MAX_DATA];
+    uint8_t error;      // result of I2CMasterErr, valid on completion
+    i2c_callback_t callback; // called from I2C0_Handler on completion, may be NULL
+    volatile uint8_t *done;  // set to 1 on completion, may be NULL
+    uint32_t timestamp; // enqueue time in us
+} i2c_transaction_t;
+
+typedef struct shadow_register {
+    uint8_t device;
+    uint8_t reg;
+    uint8_t value;  // last value sent to the register
+    uint8_t valid;  // cleared when the device state is unknown
+} shadow_register_t;
+
+typedef struct tz_rule {
+    int32_t std_offset;     // seconds east of UTC
+    int32_t dst_offset;     // daylight time, seconds east of UTC
+    uint32_t start;         // DST start: time << 12 | weekday << 8 | week << 4 | month, time in standard time, 0 if no DST
+    uint32_t end;           // DST end, time in daylight time
+    char std_name[TZ_NAME_SIZE]; // "" prints as the numeric offset
+    char dst_name[TZ_NAME_SIZE];
+} tz_rule_t;
+
+typedef struct tz_transition {
+    int64_t at;             // UTC epoch second
+    int32_t offset;         // offset from then on
+} tz_transition_t;
+
+typedef struct rom_record {
+    uint32_t magic;         // ROM_MAGIC, erased EEPROM reads 0xffffffff
+    uint32_t sequence;      // commit number, the newest valid record has the largest
+    uint32_t version;       // ROM_VERSION
+    uint32_t date;          // year << 16 | month << 8 | day, UTC
+    uint32_t time;          // seconds of day, UTC
+    uint32_t baud;          // UART0 rate saved by SET BAUD ... SAVE
+    int32_t flow_speed;
+    uint32_t alarms[ALARM_COUNT][2]; // used << 31 | weekdays << 17 | time, then the day-of-month mask
+    tz_rule_t zone;         // zero in older records, UTC without DST
+    uint32_t display_utc;
+    uint32_t brightness;    // zero in older records, full brightness
+    uint32_t dim_level;
+    uint32_t dim_start;     // seconds of day in the display view, equal to dim_end if not dimmed
+    uint32_t dim_end;
+    uint32_t display_off;
+    int32_t sync_freq;      // ppb the RTC runs fast, zero in older records
+    uint32_t reserved[7];   // zero, room for new fields without moving crc
+    uint32_t crc;           // CRC-16 of the words above
+} rom_record_t;
+
+typedef struct alarm {
+    uint32_t time;          // seconds of day
+    uint32_t days;          // bit n rings on day n of the month
+    uint8_t weekdays;       // bit 0 Sunday to bit 6 Saturday, rings once if both masks are 0
+    uint8_t used;
+    uint8_t snoozes;        // snoozed since it last rang on schedule
+    uint8_t heap;           // position in alarm_heap, ALARM_COUNT if not queued
+    uint32_t due;           // RTC second of the next ring, snoozed or scheduled
+} alarm_t;
+
+typedef struct i2c_stats {
+    uint32_t transactions;
+    uint32_t nak_errors;
+    uint32_t arb_errors;
+    uint32_t timeout_errors;
+    uint32_t overflows; // enqueue rejected because queue is full
+    uint8_t max_depth;
+    uint32_t latency_last; // us from enqueue to completion
+    uint32_t latency_max;
+    uint32_t latency_total;
+    uint32_t shadow_issued; // expander writes sent to the bus
+    uint32_t shadow_elided; // expander writes dropped by the shadow registers
+    uint8_t display_frame_transactions; // transactions issued by the display scan in the last frame
+} i2c_stats_t;
+
 void Setup(void);
 void ProcDisplay(void);
 void ProcSetDate(void);
 void ProcSetTime(void);
 void DisplayDatetime(uint8_t offset);
+void DisplayFlowRender(void);
+void DisplayFlowPair(uint8_t index, uint8_t value, uint8_t dot);
+void DisplayFlowInvalidate(void);
 void DisplayDate(uint16_t year, uint8_t day, uint8_t month);
 void DisplayTime(uint32_t time);
-void DetectKey(void);
+uint8_t *DisplayBackBuffer(void);
+void DisplaySwap(void);
+void DisplayShow(const uint8_t *segments);
+void DisplayBrightnessUpdate(void);
+void DetectKey(uint32_t now);
+void KeyInit(void);
 void ClearKeyFlags(void);
 void ProcessCommand(void);
-error_t ParseCommand(const char *pattern, const char *command, datetime_t *args);
-error_t ParseIntegerUntil(const char *str, char delim, uint8_t *index, int *result);
+void ProcessBatch(void);
+uint8_t BatchParse(const char *text, command_line_t *line, const command_t **cmd, command_arg_t *args);
+error_t LexCommand(const char *raw, command_line_t *line);
+const command_t *FindCommand(const command_line_t *line, uint8_t *first_arg);
+int16_t FindVerb(const command_line_t *line);
+error_t ParseArguments(const command_t *cmd, const command_line_t *line, uint8_t first_arg, command_arg_t *args);
+error_t ParseDateArgument(const command_line_t *line, uint8_t token, command_arg_t *arg);
+error_t ParseTimeArgument(const command_line_t *line, uint8_t token, command_arg_t *arg);
+uint8_t TokenEquals(const command_line_t *line, uint8_t token, const char *str);
+void CommandUsagePut(const command_line_t *line, uint8_t token, const char *verb);
+uint8_t CommandSameGroup(const command_t *a, const command_t *b);
+const char *CommandArgumentName(char type);
+void CommandTableInit(void);
+uint8_t CommandIndexBuild(uint8_t *index, uint16_t size, uint8_t verbs, uint32_t seed);
+uint32_t CommandHash(const char *verb, uint8_t verb_length, const char *sub, uint8_t sub_length, uint32_t seed);
+COMMAND_LIST(COMMAND_PROTOTYPE)
+error_t CmdSetZoneCheck(const command_arg_t *args);
+error_t CmdSetDisplayCheck(const command_arg_t *args);
+error_t CmdSetBrightnessCheck(const command_arg_t *args);
+error_t CmdSetDimCheck(const command_arg_t *args);
+error_t CmdSubscribeCheck(const command_arg_t *args);
+error_t CmdUnsubscribeCheck(const command_arg_t *args);
+void ProcessFrame(void);
+void FrameStatusPut(uint8_t opcode, uint8_t status);
+FRAME_LIST(FRAME_PROTOTYPE)
+void FramePut16(uint8_t *buffer, uint16_t value);
+void FramePut32(uint8_t *buffer, uint32_t value);
+uint16_t FrameGet16(const uint8_t *buffer);
+uint32_t FrameGet32(const uint8_t *buffer);
+uint8_t CobsEncode(const uint8_t *src, uint8_t length, uint8_t *dst);
+uint8_t CobsDecode(const uint8_t *src, uint8_t length, uint8_t *dst);
+uint16_t Crc16(const uint8_t *data, uint16_t length);
+error_t ParseIntegerUntil(const char *str, char delim, uint8_t *index, uint32_t *result);
 void StringifyDate(uint16_t year, uint8_t month, uint8_t day, char *buffer);
 void StringifyTime(uint32_t time, char *buffer);
+void StringifyNumber(int64_t data, char *buffer);
 char ToUpperCase(char x);
+uint8_t IsLeapYear(uint16_t year);
 uint8_t GetDayOfMonth(uint16_t year, uint8_t month);
-void Delay(uint32_t loop);
+uint16_t GetDayOfYear(uint16_t year, uint8_t month, uint8_t day);
+uint8_t GetDayOfWeek(int32_t days);
+int32_t DaysFromCivil(uint16_t year, uint8_t month, uint8_t day);
+void CivilFromDays(int32_t days, datetime_t *date);
+uint8_t DateValid(uint16_t year, uint8_t month, uint8_t day);
+int32_t EpochDay(int64_t seconds);
+void EpochCivil(int64_t seconds, datetime_t *date);
+void StringifyOffset(int32_t seconds, char *buffer);
 void ClearSystickCounter(void);
+uint32_t GetMicros(void);
+uint32_t GetMillis(void);
+uint32_t SystickElapsedMicros(void);
+uint64_t GetUptimeMillis(void);
+uint16_t SystickNextStep(uint16_t running);
+uint8_t MainLoopPending(void);
+void PowerInit(void);
+void PowerIdle(void);
+void PowerStatsPut(void);
+void PerfInit(void);
+uint32_t PerfStart(void);
+void PerfRecord(uint8_t stage, uint32_t start);
+void PerfReset(void);
+void PerfStatsPut(void);
+void EventPost(uint8_t type, uint8_t data);
+uint8_t EventGet(event_t *event);
+void EventFlush(void);
+void EventWait(uint8_t type);
+void EventStatsPut(void);
+uint16_t GetSubsecondTicks(void);
 
 void GPIOInit(void);
 void UART0Init(void);
 void UART0StringPutNonBlocking(const char *message);
 void UART0NumberPutNonBlocking(int64_t data);
+uint16_t UART0TxFree(void);
+void UART0TxPush(const char *data, uint16_t length);
+void UART0TxFill(void);
+void UART0FramePut(const uint8_t *data, uint8_t length);
+void UART0StatsPut(void);
+uint8_t UART0BaudValid(uint32_t rate);
+void UART0BaudSet(uint32_t rate);
+void UART0BaudPoll(void);
+void UART0BaudConfirm(void);
+void UART0BaudLoad(void);
+uint8_t UART0LineGet(char *line);
+void UART0RxStore(char *line, uint8_t *cursor, char c);
+void SubscribePost(uint8_t topic);
+void SubscribeAlarmPost(uint8_t index, uint8_t action);
+void SubscribePoll(void);
+uint8_t SubscribeLine(char *line);
+uint8_t SubscribeParseTopics(const char *word, uint8_t length, uint8_t *topics);
+void SubscribeStatsPut(void);
 void I2C0Init(void);
+void DisplayInit(void);
 uint8_t I2C0WriteByte(uint8_t device, uint8_t reg, uint8_t data);
 uint8_t I2C0ReadByte(uint8_t device, uint8_t reg);
+uint8_t I2C0WriteAsync(uint8_t device, uint8_t reg, const uint8_t *data, uint8_t length,
+    i2c_callback_t callback, volatile uint8_t *done);
+uint8_t I2C0ReadAsync(uint8_t device, uint8_t reg, uint8_t length,
+    i2c_callback_t callback, volatile uint8_t *done);
+uint8_t I2C0Enqueue(uint8_t op, uint8_t device, uint8_t reg, const uint8_t *data, uint8_t length,
+    i2c_callback_t callback, volatile uint8_t *done);
+uint8_t I2C0QueueDepth(void);
+void I2C0Wait(volatile uint8_t *done);
+void I2C0Start(void);
+void I2C0Complete(void);
+void I2C0BlockingComplete(const i2c_transaction_t *transaction);
+void I2C0StatsPut(void);
+void KeyReadComplete(const i2c_transaction_t *transaction);
+uint8_t ExpanderWrite(uint8_t device, uint8_t reg, uint8_t data);
+uint8_t ExpanderWriteAsync(uint8_t device, uint8_t reg, uint8_t data);
+uint8_t ExpanderWriteBurstAsync(uint8_t device, uint8_t reg, const uint8_t *data, uint8_t length);
+uint8_t ExpanderNextRegister(uint8_t device, uint8_t reg);
+shadow_register_t *ShadowFind(uint8_t device, uint8_t reg);
+void ShadowInvalidate(uint8_t device);
+void ShadowWriteComplete(const i2c_transaction_t *transaction);
 void BuzzerInit(void);
 void BuzzerStart(uint32_t freq);
 void BuzzerStop(void);
 void RTCInit(void);
 void RTCStoreData(void);
 void RTCLoadData(void);
+void RTCRefresh(void);
+void RTCUpdate(uint32_t seconds);
+void RTCDecode(uint32_t seconds);
+void RTCPhaseSystick(void);
+uint64_t RTCTicks(void);
+void RTCRebase(int64_t utc, uint64_t at);
+void SyncApply(int64_t offset, int32_t delay);
+void SyncPoll(void);
+void SyncStep(void);
+void SyncStampPut(uint64_t ticks, char *buffer);
+uint8_t SyncParseMicros(const char *word, uint8_t length, int64_t *value);
+void SyncStatsPut(void);
+void TzSet(const tz_rule_t *rule);
+void TzSetView(uint8_t utc);
+void TzExpand(int64_t now);
+int32_t TzTransitions(int64_t at, tz_transition_t *upcoming);
+int64_t TzInstant(uint16_t year, uint32_t rule, int32_t offset);
+int64_t TzLocalToUtc(int64_t local);
+uint8_t TzRuleValid(uint32_t rule);
+uint8_t TzParse(const char *word, uint8_t length, tz_rule_t *rule);
+uint8_t TzParseName(const char *word, uint8_t length, uint8_t *index, char *name);
+uint8_t TzParseOffset(const char *word, uint8_t length, uint8_t *index, int32_t *seconds);
+uint8_t TzParseDigits(const char *word, uint8_t length, uint8_t *index, int32_t *value);
+uint8_t TzParseDate(const char *word, uint8_t length, uint8_t *index, uint32_t *rule);
+void TzRulePut(void);
+void TzNamePut(const char *name, int32_t offset);
+void TzStatsPut(void);
+void AlarmSet(uint8_t index, uint32_t time, uint8_t weekdays, uint32_t days);
+void AlarmDelete(uint8_t index);
+uint8_t AlarmSnooze(void);
+void AlarmStop(void);
+void AlarmPoll(void);
+void AlarmRing(uint8_t index);
+void AlarmReschedule(void);
+uint32_t AlarmNextDue(const alarm_t *alarm, uint32_t after);
+void AlarmQueue(uint8_t index);
+void AlarmDequeue(uint8_t index);
+void AlarmHeapFix(uint8_t position);
+void AlarmHeapSwap(uint8_t a, uint8_t b);
+void AlarmProgram(void);
+uint8_t AlarmParseRepeat(const char *word, uint8_t length, uint8_t *weekdays, uint32_t *days);
+void AlarmRepeatPut(const alarm_t *alarm);
+void AlarmListPut(void);
 void ROMInit(void);
 void ROMStoreData(void);
 void ROMLoadData(void);
+void ROMPoll(void);
+void ROMCommit(void);
+void ROMFind(void);
+uint8_t ROMSlotRead(uint8_t slot, rom_record_t *record);
+void ROMStatsPut(void);
 
 void SysTick_Handler(void);
 void UART0_Handler(void);
+void TIMER0A_Handler(void);
+void I2C0_Handler(void);
+void HIBERNATE_Handler(void);
+void GPIOM_Handler(void);
+
+const command_t command_table[] = {
+    COMMAND_LIST(COMMAND_ENTRY)
+};
+#define COMMAND_COUNT           (sizeof(command_table) / sizeof(command_table[0]))
+
+const frame_command_t frame_table[] = {
+    FRAME_LIST(FRAME_ENTRY)
+};
+#define FRAME_COUNT             (sizeof(frame_table) / sizeof(frame_table[0]))
 
 const uint8_t seg7[] = {
     0x3f, 0x06, 0x5b, 0x4f, 0x66, 0x6d, 0x7d, 0x07,
@@ -139,6 +730,33 @@ const uint8_t seg7[] = {
 const uint8_t student_id[] = {3, 1, 9, 1, 0, 7, 8, 1};
 const uint8_t student_name[] = {0x39, 0x3e, 0x06, 0x00, 0xdb, 0xf6, 0x00, 0x00};
 const uint8_t version[] = {0x3e, 0x00, 0x86, 0xbf, 0x3f, 0x00, 0x00, 0x00};
+const char *weekday_names[] = {"SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT"};
+const char *perf_stage_names[PERF_STAGE_COUNT] = {"Keys", "Mode", "Scan", "Command", "Tick", "Loop"};
+// gesture settings indexed by BUTTON_*
+const key_config_t key_config[8] = {
+    {KEY_PRESS, 0, 0, 0, 0}, // BUTTON_1
+    {KEY_PRESS, 0, 0, 0, 0}, // BUTTON_2
+    {KEY_PRESS, 0, 0, 0, 0}, // BUTTON_3
+    {KEY_PRESS | KEY_REPEAT | KEY_LONG, 1000, 400, 200, 50}, // BUTTON_DOWN, held to restart in display mode
+    {KEY_PRESS | KEY_REPEAT, 0, 400, 200, 50}, // BUTTON_UP
+    {KEY_PRESS | KEY_CHORD, 0, 0, 0, 0}, // BUTTON_RIGHT
+    {KEY_PRESS | KEY_CHORD, 0, 0, 0, 0}, // BUTTON_LEFT
+    {KEY_PRESS | KEY_DOUBLE, 0, 0, 0, 0} // BUTTON_BACK, double tap switches the display to UTC and back
+};
+const char *event_names[EVENT_TYPES] = {"20ms", "250ms", "500ms", "1s", "Keys", "Alarm"};
+const char *subscribe_topic_names[SUBSCRIBE_TOPICS] = {"TICK", "ALARM", "TIME", "MODE"};
+const char *subscribe_alarm_names[] = {" RING ", " MUTE ", " SNOOZE ", " SET ", " DEL"};
+const char *mode_names[] = {"DISPLAY", "SETDATE", "SETTIME", "SETALARM"}; // by bit of mode
+const uint8_t event_merge[EVENT_TYPES] = {
+    EVENT_MERGE_COUNT, EVENT_MERGE_COUNT, EVENT_MERGE_COUNT, EVENT_MERGE_COUNT, // ticks are never lost, only late
+    EVENT_MERGE_LATEST, // a newer key sample supersedes the old one
+    EVENT_MERGE_COUNT // AlarmPoll rings everything due at once
+};
+// days before each month, from March so the leap day is the last day of the year
+const uint16_t calendar_march_days[12] = {0, 31, 61, 92, 122, 153, 184, 214, 245, 275, 306, 337};
+// days before each month of a common year, and days in it
+const uint16_t calendar_year_days[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+const uint8_t calendar_month_days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
 const char *help_message = "EST2506 γ̴ҵ V1.0.0 ָ\r\n"
     "UARTڲ115200֡8+0+1\r\n"
     "    CLOCK INIT          - ʼʱӵĬ״̬ʱ䡢ڡ\r\n"
@@ -147,28 +765,163 @@ const char *help_message = "EST2506 
     "    GET DATE            - ȡǰ\r\n"
     "    GET TIME            - ȡǰʱ\r\n"
     "    GET ALARM           - ȡʱ\r\n"
+    "    GET I2C             - ȡI2C߶ȡӳͳ\r\n"
+    "    GET UART            - ȡڷͻʹ\r\n"
+    "    GET POWER           - ȡ/ʱռ뻽Ѵ\r\n"
+    "    GET ROM             - ȡEEPROM־дƵʣ\r\n"
+    "    GET WEEKDAY         - ȡڼ\r\n"
+    "    GET YEARDAY         - ȡһеĵڼ\r\n"
+    "    GET EPOCH           - ȡ1970/01/01\r\n"
+    "    GET ZONE            - ȡʱ򡢵ǰUTCƫʱлʱ\r\n"
+    "    GET SYNC            - ȡϴζʱƫӳ١ʱƵƵƯ\r\n"
     "    SET DATE <DATE>     - õǰڣ<DATE>ΪYYYY/MM/DDʽ\r\n"
     "    SET TIME <TIME>     - õǰʱ䣬<TIME>ΪHH:MM:SSʽ\r\n"
-    "    SET ALARM <TIME>    - ʱ䣬<TIME>ΪHH:MM:SSʽ\r\n"
+    "    SET ALARM <TIME>    - 0ʱ䣬<TIME>ΪHH:MM:SSʽ\r\n"
+    "    SET BAUD <RATE>     - лڲʣĩβSAVE򱣴棬10δյЧָָ115200\r\n"
+    "    SET ZONE <RULE>     - POSIXʽʱCST-8EST5EDT,M3.2.0,M11.1.0\r\n"
+    "    SET DISPLAY <VIEW>  - GET/SETʱʹLOCALʱUTCʱ䣬OFF/ONϨ/\r\n"
+    "    SET BRIGHTNESS <N>  - ΪN%5-100\r\n"
+    "    SET DIM <N> <TIME> <TIME> - ʱ֮ΪN%NΪ0ʱϨʱͬʱȡ\r\n"
     "    MUTE                - ر\r\n"
+    "    ALARM ADD <TIME> [<REPEAT>] - 岢رţ<REPEAT>ΪONCEDAILYWEEKDAYSWEEKENDSMON,WED,15/б\r\n"
+    "    ALARM LIST          - г弰´ʱ\r\n"
+    "    ALARM DEL <N>       - ɾN\r\n"
+    "    ALARM SNOOZE        - 5Ӻ\r\n"
+    "    DATE DIFF <DATE> [<DATE>] - ӵһڵڶڣĬϽ죩\r\n"
+    "    SYNC                - յָ뷢ظUTCʱ̣.΢룩ڼƫӳ\r\n"
+    "    SYNC ADJUST <OFFSET> <DELAY> - ƫӳ٣΢룩ʱ\r\n"
+    "    SUBSCRIBE <TOPICS> [<N>] - TICKALARMTIMEMODE¼ŷָALLTICKÿNһ\r\n"
+    "    UNSUBSCRIBE [<TOPICS>] - ȡģĬȫ\r\n"
+    "    STATS [RESET]       - ȡѭ׶κʱ¼ͳƣRESET\r\n"
+    "    MODE BINARY         - лCOBS+CRC16֡Э飬0x7F֡ıģʽ\r\n"
+    "    <CMD>;<CMD>;...     - ִ8ָһָЧȫִ\r\n"
     "    ?                   - ı\r\n"
     "ʾ\r\n"
     "    SET DATE 2024/06/18\r\n"
-    "    SET ALARM 13:00:50";
+    "    SET ALARM 13:00:50\r\n";
 
 uint32_t sys_clock_freq;
 
 volatile uint16_t systick_20ms_counter = 0, systick_250ms_counter = 0, systick_500ms_counter = 0;
 volatile uint16_t systick_1s_counter = 0;
-volatile uint8_t systick_20ms_flag = 0, systick_250ms_flag = 0, systick_500ms_flag = 0;
-volatile uint8_t systick_1s_flag = 0;
+volatile uint32_t systick_ms = 0; // free running millisecond counter, advanced at each SysTick interrupt
+volatile uint32_t systick_ms_wraps = 0; // high word of the uptime, systick_ms wraps every 49.7 days
+volatile uint16_t systick_step = 1; // ms of the running SysTick period
+volatile uint16_t systick_next_step = 1; // ms of the period after it, already in the reload register
+volatile uint32_t systick_interrupts = 0;
+
+uint64_t power_sleep_us = 0; // time in WFI, including the handler that woke the core
+uint32_t power_wakeups = 0;
+
+perf_stage_t perf_stages[PERF_STAGE_COUNT];
+uint32_t perf_bin_cycles = 0; // upper edge of the first histogram bin
+uint32_t perf_reset_ms = 0; // systick_ms when the statistics were cleared
 
-volatile uint8_t command[128];
-volatile uint8_t command_ready = 0;
+// single producer (interrupt handlers, which share one priority and never nest) single consumer (main loop)
+event_t event_queue[EVENT_QUEUE_SIZE];
+volatile uint8_t event_head = 0; // next free slot, only written by handlers
+volatile uint8_t event_tail = 0; // oldest pending event, only written by main loop
+uint8_t event_last[EVENT_TYPES]; // slot of the newest event of each type, only used by handlers
+uint8_t event_high_water = 0;
+event_stats_t event_stats[EVENT_TYPES];
+
+i2c_transaction_t i2c0_queue[I2C0_QUEUE_SIZE];
+volatile uint8_t i2c0_queue_head = 0; // next free slot
+volatile uint8_t i2c0_queue_tail = 0; // transaction on the bus
+volatile uint8_t i2c0_state = I2C0_STATE_IDLE;
+volatile uint8_t i2c0_index = 0; // payload byte being transferred
+i2c_stats_t i2c0_stats;
+// write-through cache of expander output registers, untracked registers are always written
+shadow_register_t expander_shadow[] = {
+    {TCA6424_I2CADDR, TCA6424_OUTPUT_PORT0, 0, 0},
+    {TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0, 0},
+    {TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0, 0},
+    {TCA6424_I2CADDR, TCA6424_CONFIG_PORT0, 0, 0},
+    {TCA6424_I2CADDR, TCA6424_CONFIG_PORT1, 0, 0},
+    {TCA6424_I2CADDR, TCA6424_CONFIG_PORT2, 0, 0},
+    {PCA9557_I2CADDR, PCA9557_OUTPUT, 0, 0},
+    {PCA9557_I2CADDR, PCA9557_CONFIG, 0, 0}
+};
+uint8_t i2c0_blocking_data = 0; // result of the last blocking transaction
+uint8_t i2c0_blocking_error = 0;
+
+uint8_t key_input = 0xff; // last sample of TCA6424 port0
+uint8_t key_chord = 0; // keys of a chord not yet handled, bit per BUTTON_*
+volatile uint8_t key_active = 0; // a key is held or settling, DetectKey needs the 20ms tick
+
+uint8_t display_buffer[2][DISPLAY_DIGITS]; // double-buffered segment framebuffer
+volatile uint8_t display_front = 0; // index of buffer being scanned
+volatile uint8_t display_swap_pending = 0; // swap buffers at next frame boundary
+volatile uint8_t display_digit = 0; // digit being lit
+uint8_t display_transactions = 0; // transactions issued in the current frame
+uint32_t display_slot_cycles = 0; // TIMER0A cycles each digit is scanned for
+volatile uint32_t display_on_cycles = 0; // of them with the digit lit, 0 while blank
+volatile uint8_t display_dark = 0; // TIMER0A is timing the unlit rest of the slot
+uint8_t display_duty = 100; // percent of each slot lit, applied by DisplayBrightnessUpdate
+uint8_t display_brightness = 100; // SET BRIGHTNESS
+uint8_t display_dim_level = 0; // brightness between display_dim_start and display_dim_end, 0 blanks
+uint32_t display_dim_start = 0; // seconds of day in the display view
+uint32_t display_dim_end = 0; // equal to display_dim_start if never dimmed
+uint8_t display_off = 0; // SET DISPLAY OFF, the scan stops and no I2C traffic goes to the digits
+uint8_t seg7_pairs[100][2]; // segments of 00 to 99, filled by DisplayInit
+uint8_t display_flow[DISPLAY_FLOW_LENGTH * 2]; // rendered datetime twice, so any scroll window is contiguous
+uint32_t display_flow_time = DISPLAY_FLOW_STALE; // datetime.time rendered in display_flow
+uint8_t display_flow_hms[3]; // hour, minute and second rendered in display_flow
+uint8_t display_flow_window = DISPLAY_FLOW_NONE; // offset of display_flow last copied to the back buffer
+
+uint8_t uart0_tx_buffer[UART0_TX_BUFFER_SIZE]; // drained by UART0_Handler
+volatile uint16_t uart0_tx_head = 0; // next free byte
+volatile uint16_t uart0_tx_tail = 0; // next byte to send
+uint16_t uart0_tx_high_water = 0;
+uint32_t uart0_tx_dropped = 0; // messages dropped or truncated on overflow
+uint8_t uart0_tx_discarding = 0; // a line lost its end, drop messages until its CRLF
+
+// single producer (UART0_Handler) single consumer (main loop) queue of received lines
+char uart0_rx_lines[UART0_RX_LINES][UART0_RX_LINE_SIZE];
+uint8_t uart0_rx_too_long[UART0_RX_LINES]; // line did not fit and was cut
+uint64_t uart0_rx_stamps[UART0_RX_LINES]; // RTCTicks when the line ended
+volatile uint8_t uart0_rx_head = 0; // line being received, only written by UART0_Handler
+volatile uint8_t uart0_rx_tail = 0; // oldest completed line, only written by main loop
+uint32_t uart0_rx_dropped = 0; // lines lost because the queue is full
+uint32_t uart0_rx_overlong = 0; // lines longer than UART0_RX_LINE_SIZE - 1
+volatile uint32_t uart0_rx_bytes = 0;
+volatile uint32_t uart0_tx_bytes = 0; // moved into the FIFO
+volatile uint8_t uart0_binary = 0; // receive COBS frames ended by 0x00 instead of text lines
+uint32_t uart0_baud = UART0_BAUD_DEFAULT;
+uint32_t uart0_baud_saved = UART0_BAUD_DEFAULT; // rate used after restart, kept in the EEPROM journal
+uint32_t uart0_baud_pending = 0; // applied once the TX ring drains, 0 if none
+uint8_t uart0_baud_save = 0; // store the pending rate once it is confirmed
+
+// SUBSCRIBE, an event posted again before it is sent replaces the pending one
+uint8_t subscribe_topics = 0;
+uint8_t subscribe_pending = 0; // topics with an event to send, alarms in subscribe_alarm_pending
+uint16_t subscribe_alarm_pending = 0; // bit n: alarm n has an event in subscribe_alarm_action[n]
+uint8_t subscribe_alarm_action[ALARM_COUNT];
+uint32_t subscribe_rate = 1; // seconds between ticks
+int64_t subscribe_tick_slot = 0; // epoch_seconds / subscribe_rate of the last tick
+int8_t subscribe_mode = MODE_DISPLAY; // mode last reported
+uint32_t subscribe_sent = 0;
+uint32_t subscribe_coalesced = 0; // events replaced before they were sent
+uint8_t uart0_baud_confirming = 0; // new rate not yet confirmed by a valid command
+uint32_t uart0_baud_deadline = 0; // systick_ms to fall back to UART0_BAUD_DEFAULT
+uint32_t uart0_baud_fallbacks = 0;
+
+char command[UART0_RX_LINE_SIZE];
+
+// perfect hash indexes of command_table built at startup, slot holds index + 1
+uint8_t command_hash[COMMAND_HASH_SIZE];
+uint8_t verb_hash[VERB_HASH_SIZE];
+uint32_t command_hash_seed = 0;
+uint32_t verb_hash_seed = 0;
+uint8_t command_quiet = 0; // suppress argument error messages while parsing a batch
 
 datetime_t datetime;
-uint32_t alarm_time = 999;
-volatile keystate_t keystate[8];
+alarm_t alarms[ALARM_COUNT] = {{999, 0, ALARM_DAILY, 1, 0, ALARM_COUNT, ALARM_NEVER}};
+uint8_t alarm_heap[ALARM_COUNT]; // queued alarm indexes, min-heap on due
+uint8_t alarm_queued = 0;
+uint8_t alarm_ringing = ALARM_COUNT; // alarm the buzzer is ringing for, ALARM_COUNT if none
+uint8_t alarm_match_flag = 0; // the earliest alarm passed while it was being armed
+keystate_t keystate[8];
 
 int8_t mode = MODE_DISPLAY;
 
@@ -181,10 +934,58 @@ int8_t setting_digit[8];
 uint8_t alarming = 0;
 uint8_t load_rom = 0;
 
+int64_t rtc_epoch = 0; // UTC epoch seconds at RTC second 0, midnight of the date kept in hibernate memory
+uint32_t rtc_seconds = 0; // RTC counter datetime was decoded from
+int64_t epoch_seconds = 0; // UTC seconds since 1970/01/01, rtc_epoch + rtc_seconds
+
+// SYNC, the host measures the offset from the receive and transmit stamps, the RTC trim follows it
+uint64_t command_stamp = 0; // RTCTicks when the last byte of command arrived
+int32_t sync_freq_ppb = 0; // how fast the RTC crystal runs, corrected through the trim
+int32_t sync_freq_saved = 0; // sync_freq_ppb in the journal
+int32_t sync_estimate_ppb = 0; // drift measured by the last exchange
+int64_t sync_slew_left = 0; // sub-seconds the RTC is still ahead of the host, slewed through the trim
+int32_t sync_slew_step = 0; // trim units of slew in the current 64s period
+uint32_t sync_trim_period = 0xffffffff; // RTC second / 64 at which the trim was last written
+int64_t sync_last = 0; // epoch_seconds after the last accepted exchange
+int64_t sync_offset = 0; // microseconds, device minus host
+int32_t sync_delay = 0; // round trip microseconds
+uint8_t sync_stepped = 0; // the last exchange stepped instead of slewing
+uint64_t sync_step_at = 0; // RTCTicks of the armed step, 0 if none
+int64_t sync_step_utc = 0; // UTC the RTC restarts at when the armed step is taken
+uint32_t sync_exchanges = 0;
+uint32_t sync_steps = 0;
+uint32_t sync_rejected = 0;
+int32_t datetime_day = 0; // epoch day of datetime
+int64_t datetime_midnight = TZ_NEVER; // epoch seconds of datetime at 00:00:00, in the display view
+
+tz_rule_t tz_rule = {0, 0, 0, 0, "UTC", ""};
+tz_transition_t tz_table[TZ_TRANSITIONS]; // upcoming transitions in order, TZ_NEVER if fewer
+int64_t tz_next = TZ_NEVER; // tz_table[0].at, RTCUpdate expands the rule again once passed
+int32_t tz_offset = 0; // local time is UTC + tz_offset
+uint8_t tz_view_utc = 0; // display and GET/SET date and time in UTC instead of local time
+int32_t tz_view_offset = 0; // 0 or tz_offset, added to UTC for datetime
+
+rom_record_t rom_record; // newest record in the journal, what the next commit is compared with
+uint8_t rom_valid = 0; // rom_record was found or written
+uint8_t rom_head = ROM_SLOTS - 1; // slot of rom_record, the next commit goes to the slot after
+uint8_t rom_dirty = 0; // changes not yet committed
+uint8_t rom_clock_set = 0; // date or time was set since the last commit
+uint32_t rom_first_change = 0; // systick_ms of the oldest uncommitted change
+uint32_t rom_last_change = 0;
+uint32_t rom_requests = 0; // ROMStoreData calls, merged into rom_commits
+uint32_t rom_commits = 0; // slots written since power on
+uint32_t rom_elided = 0; // commits skipped because nothing changed
+uint32_t rom_errors = 0; // EEPROMProgram failures
+uint8_t rom_scanned = 0; // boot lookup needed a full scan
+
 int main(void) {
+    uint32_t start, loop_start, tick_start = 0;
+    uint8_t tick;
+    event_t event;
+    
     sys_clock_freq = SysCtlClockFreqSet(SYSCTL_OSC_INT | SYSCTL_USE_PLL |SYSCTL_CFG_VCO_480, 20000000);
 
-    SysTickPeriodSet(sys_clock_freq / SYSTICK_FREQUENCY);
+    SysTickPeriodSet(sys_clock_freq / SYSTICK_FREQUENCY); // 1ms until the first interrupt picks a step
     SysTickEnable();
     SysTickIntEnable();
     
@@ -195,9 +996,12 @@ int main(void) {
     GPIOInit();
     UART0Init();
     I2C0Init();
+    DisplayInit();
     BuzzerInit();
     RTCInit();
     ROMInit();
+    PowerInit();
+    PerfInit();
 
     // Enable interrupt
     IntMasterEnable();
@@ -207,90 +1011,101 @@ int main(void) {
     datetime.day = 1;
     datetime.time = 0;
     
-    keystate[BUTTON_UP].config = keystate[BUTTON_DOWN].config &= KEY_CONFIG_PRESS;
+    ROMLoadData(); // settings always, date and time only after a cold start
+    UART0BaudLoad();
+    
+    CommandTableInit();
     
     // Setup code
     Setup();
     
     // Main loop
     ClearSystickCounter();
+    KeyInit();
     ClearKeyFlags();
-    I2C0ReadByte(TCA6424_I2CADDR, TCA6424_INPUT_PORT0); // solve glitch at first time
+    PerfReset(); // the boot animation missed every flag
+    loop_start = PerfStart();
     while (1) {
-        // Process systick counter
-        if (systick_20ms_flag) {
-            systick_20ms_flag = 0;
-            DetectKey(); // detect key per 20ms
-        }
-        
-        if (systick_250ms_flag) {
-            systick_250ms_flag = 0;
-            
-            if (mode == MODE_DISPLAY) {
-                // faster flow
-                if (flow_speed == 2) {
-                    flow_offset = (flow_offset + 1) % 16; // 16 is length of display datetime
-                } else if (flow_speed == -2) {
-                    flow_offset = (flow_offset - 1) % 16;
-                }
-            } else {
-                // flash
-                focus_flash = !focus_flash;
-            }
-            
-            // stages of alarming
-            if (alarming == 1) {
-                BuzzerStart(880);
-                alarming = 2;
-            } else if (alarming == 2) {
-                BuzzerStop();
-                alarming = 1;
-            } else {
-                BuzzerStop();
-            }
-        }
-        
-        if (systick_500ms_flag) {
-            systick_500ms_flag = 0;
-            
-            if (mode == MODE_DISPLAY) {
-                // flow
-                if (flow_speed == 1) {
-                    flow_offset = (flow_offset + 1) % 16; // 16 is length of display datetime
-                } else if (flow_speed == -1) {
-                    flow_offset = (flow_offset - 1 + 16) % 16;
-                }
-            }
-        }
-        
-        if (systick_1s_flag) {
-            systick_1s_flag = 0;
-            
-            // next second
-            ++datetime.time;
-            if (datetime.time >= 86400) {
-                uint8_t day_of_month = GetDayOfMonth(datetime.year, datetime.month);
-                
-                datetime.time -= 86400;
-                ++datetime.day;
-                
-                if (datetime.day > day_of_month) {
-                    datetime.day -= day_of_month;
-                    ++datetime.month;
+        // Handle what interrupt handlers posted, in the order it happened
+        tick = 0;
+        while (EventGet(&event)) {
+            switch (event.type) {
+                case EVENT_TICK_20MS:
+#if KEY_INTERRUPT
+                    if (!GPIOPinRead(KEY_INT_BASE, KEY_INT_PIN)) {
+                        // INT still low, the read it asked for failed or has not completed yet
+                        I2C0ReadAsync(TCA6424_I2CADDR, TCA6424_INPUT_PORT0, 1, KeyReadComplete, NULL);
+                    }
+                    if (key_active) { // gesture timers
+                        start = PerfStart();
+                        DetectKey(event.time);
+                        PerfRecord(PERF_STAGE_KEYS, start);
+                    }
+#else
+                    // sample keys per 20ms, handled when the transfer completes
+                    I2C0ReadAsync(TCA6424_I2CADDR, TCA6424_INPUT_PORT0, 1, KeyReadComplete, NULL);
+#endif
+                    break;
+                case EVENT_KEYS:
+                    key_input = event.data;
+                    start = PerfStart();
+                    DetectKey(event.time);
+                    PerfRecord(PERF_STAGE_KEYS, start);
+                    break;
+                case EVENT_TICK_250MS:
+                    if (mode == MODE_DISPLAY) {
+                        // faster flow, catch up on merged ticks
+                        if (flow_speed == 2) {
+                            flow_offset = (flow_offset + event.count) % DISPLAY_FLOW_LENGTH;
+                        } else if (flow_speed == -2) {
+                            flow_offset = (flow_offset + DISPLAY_FLOW_LENGTH - event.count % DISPLAY_FLOW_LENGTH) % DISPLAY_FLOW_LENGTH;
+                        }
+                    } else {
+                        // flash
+                        focus_flash ^= event.count & 1;
+                    }
                     
-                    if (datetime.month > 12) {
-                        datetime.year = (datetime.year + 1) % 10000; // year should be 0-9999
+                    // stages of alarming, an even count leaves the buzzer as it is
+                    if (alarming == 1 && (event.count & 1)) {
+                        BuzzerStart(880);
+                        alarming = 2;
+                    } else if (alarming == 2 && (event.count & 1)) {
+                        BuzzerStop();
+                        alarming = 1;
+                    } else if (!alarming) {
+                        BuzzerStop();
                     }
-                }
-            }
-            
-            RTCStoreData();
-            
-            if (datetime.time == alarm_time) {
-                alarming = 1;
+                    break;
+                case EVENT_TICK_500MS:
+                    if (mode == MODE_DISPLAY) {
+                        // flow
+                        if (flow_speed == 1) {
+                            flow_offset = (flow_offset + event.count) % DISPLAY_FLOW_LENGTH;
+                        } else if (flow_speed == -1) {
+                            flow_offset = (flow_offset + DISPLAY_FLOW_LENGTH - event.count % DISPLAY_FLOW_LENGTH) % DISPLAY_FLOW_LENGTH;
+                        }
+                    }
+                    break;
+                case EVENT_TICK_1S:
+                    tick = 1;
+                    tick_start = PerfStart();
+                    RTCPhaseSystick(); // wake up again right after the next RTC second
+                    break;
+                case EVENT_ALARM:
+                    break; // AlarmPoll below rings it
             }
         }
         
+        // Wall time is read from the RTC, no second is lost however long the loop stalls
+        RTCRefresh();
+        AlarmPoll(); // compares with the earliest alarm only
+        SyncPoll(); // RTC trim, once every 64s
+        DisplayBrightnessUpdate(); // follows the dim schedule, applied from the next digit on
+        if (tick) {
+            PerfRecord(PERF_STAGE_TICK, tick_start);
+        }
+        
+        start = PerfStart();
         switch (mode) {
             case MODE_DISPLAY:
                 ProcDisplay();
@@ -303,71 +1118,91 @@ int main(void) {
                 ProcSetTime();
                 break;
         }
+        PerfRecord(PERF_STAGE_MODE, start);
         
-        I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, ~mode);
+        ExpanderWriteAsync(PCA9557_I2CADDR, PCA9557_OUTPUT, ~mode); // elided unless mode changed
+        
+        UART0BaudPoll();
+        
+        ROMPoll();
+        
+        SubscribePoll(); // after everything that posts events this pass
+        
+        PerfRecord(PERF_STAGE_LOOP, loop_start);
+        PowerIdle(); // until an interrupt posts work
+        loop_start = PerfStart();
         
         // Process UART command
-        if (command_ready) {
-            ProcessCommand();
-            command_ready = 0;
+        switch (UART0LineGet(command)) {
+            case UART0_LINE_OK:
+                start = PerfStart();
+                if (uart0_binary) {
+                    ProcessFrame();
+                } else {
+                    ProcessCommand();
+                }
+                PerfRecord(PERF_STAGE_COMMAND, start);
+                break;
+            case UART0_LINE_TOO_LONG:
+                if (uart0_binary) {
+                    FrameStatusPut(0, FRAME_TOO_LONG);
+                    break;
+                }
+                UART0StringPutNonBlocking("Command Too Long: ");
+                UART0StringPutNonBlocking(command);
+                UART0StringPutNonBlocking("...\r\nShould be at most ");
+                UART0NumberPutNonBlocking(UART0_RX_LINE_SIZE - 1);
+                UART0StringPutNonBlocking(" characters\r\n");
+                break;
         }
     }
 }
 
 void Setup(void) {
-    uint8_t i = 0, b = 0;
+    static const uint8_t blank[DISPLAY_DIGITS] = {0};
+    uint8_t i = 0;
+    uint8_t *buffer;
     
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
-    systick_500ms_counter = systick_500ms_flag = 0;
-    while (!systick_500ms_flag); // delay for 500ms
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
+    systick_500ms_counter = 0;
+    EventWait(EVENT_TICK_500MS); // delay for 500ms
     
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x00); // turn on all leds
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x00); // turn on all leds
     // Show student code
-    systick_500ms_counter = systick_500ms_flag = 0; // reset systick counter
-    while (!systick_500ms_flag) { // show for 500ms
-        for (i = 0; i < 8; ++i) {
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x01 << i);
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, seg7[student_id[i]]);
-            Delay(TCA6424_DELAY);
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // prevent ghost digit
-        }
+    buffer = DisplayBackBuffer();
+    for (i = 0; i < 8; ++i) {
+        buffer[i] = seg7[student_id[i]];
     }
+    DisplaySwap();
+    systick_500ms_counter = 0; // reset systick counter
+    EventWait(EVENT_TICK_500MS); // show for 500ms
     
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
-    systick_500ms_counter = systick_500ms_flag = 0;
-    while (!systick_500ms_flag); // delay for 500ms
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
+    DisplayShow(blank);
+    systick_500ms_counter = 0;
+    EventWait(EVENT_TICK_500MS); // delay for 500ms
     
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x00); // turn on all leds
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x00); // turn on all leds
     // Show student name
-    systick_500ms_counter = systick_500ms_flag = 0; // reset systick counter
-    while (!systick_500ms_flag) { // show for 500ms
-        for (i = 0; i < 8; ++i) {
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x01 << i);
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, student_name[i]);
-            Delay(TCA6424_DELAY);
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // prevent ghost digit
-        }
-    }
+    DisplayShow(student_name);
+    systick_500ms_counter = 0; // reset systick counter
+    EventWait(EVENT_TICK_500MS); // show for 500ms
     
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
-    systick_500ms_counter = systick_500ms_flag = 0;
-    while (!systick_500ms_flag); // delay for 500ms
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
+    DisplayShow(blank);
+    systick_500ms_counter = 0;
+    EventWait(EVENT_TICK_500MS); // delay for 500ms
     
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x00); // turn on all leds
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0x00); // turn on all leds
     // Show version
-    systick_500ms_counter = systick_500ms_flag = 0; // reset systick counter
-    while (!systick_500ms_flag) { // show for 500ms
-        for (i = 0; i < 8; ++i) {
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x01 << i);
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, version[i]);
-            Delay(TCA6424_DELAY);
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // prevent ghost digit
-        }
-    }
+    DisplayShow(version);
+    systick_500ms_counter = 0; // reset systick counter
+    EventWait(EVENT_TICK_500MS); // show for 500ms
     
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
-    systick_500ms_counter = systick_500ms_flag = 0;
-    while (!systick_500ms_flag); // delay for 500ms
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off all leds
+    DisplayShow(blank);
+    systick_500ms_counter = 0;
+    EventWait(EVENT_TICK_500MS); // delay for 500ms
     
     // load data from rtc
     RTCLoadData();
@@ -379,6 +1214,7 @@ void ProcDisplay(void) {
         keystate[BUTTON_LEFT].flag = 0;
         if (flow_speed < 2) {
             ++flow_speed; // turn left or change speed
+            ROMStoreData();
         }
     }
     
@@ -386,15 +1222,30 @@ void ProcDisplay(void) {
         keystate[BUTTON_RIGHT].flag = 0;
         if (flow_speed > -2) {
             --flow_speed; // turn right or change speed
+            ROMStoreData();
         }
     }
     
+    if (key_chord == ((1 << BUTTON_LEFT) | (1 << BUTTON_RIGHT))) {
+        key_chord = 0;
+        flow_speed = 1; // back to the default flow
+        flow_offset = 0;
+        ROMStoreData();
+    }
+    
     if (keystate[BUTTON_BACK].flag) {
         keystate[BUTTON_BACK].flag = 0;
-        if (alarming) {
-            alarming = 0;
-            BuzzerStop();
-        }
+        AlarmStop();
+    }
+    
+    if (keystate[BUTTON_BACK].gesture & KEY_DOUBLE) {
+        keystate[BUTTON_BACK].gesture = 0;
+        TzSetView(!tz_view_utc);
+    }
+    
+    if (keystate[BUTTON_UP].flag) {
+        keystate[BUTTON_UP].flag = 0;
+        AlarmSnooze(); // ignored unless an alarm is ringing
     }
     
     if (keystate[BUTTON_1].flag) {
@@ -415,7 +1266,7 @@ void ProcDisplay(void) {
     }
     
     if (keystate[BUTTON_2].flag || keystate[BUTTON_3].flag) {
-        uint32_t time = keystate[BUTTON_2].flag ? datetime.time : alarm_time;
+        uint32_t time = keystate[BUTTON_2].flag ? datetime.time : alarms[0].time;
         uint8_t hour = time / 3600;
         uint8_t min = time / 60 % 60;
         uint8_t sec = time % 60;
@@ -434,8 +1285,9 @@ void ProcDisplay(void) {
         return;
     }
     
-    if (keystate[BUTTON_DOWN].flag) {
-        keystate[BUTTON_DOWN].flag = 0;
+    keystate[BUTTON_DOWN].flag = 0; // a short press does nothing here
+    if (keystate[BUTTON_DOWN].gesture & KEY_LONG) {
+        keystate[BUTTON_DOWN].gesture = 0;
         //HibernateWakeSet(HIBERNATE_WAKE_PIN);
         //HibernateRequest();
         SysCtlReset();
@@ -447,6 +1299,7 @@ void ProcDisplay(void) {
 
 void ProcSetDate(void) {
     uint8_t i = 0;
+    uint8_t *buffer;
     uint16_t year;
     uint8_t day, month, day_of_month;
     
@@ -535,6 +1388,7 @@ void ProcSetDate(void) {
         datetime.year = setting_digit[0] * 1000 + setting_digit[1] * 100 + setting_digit[2] * 10 + setting_digit[3];
         datetime.month = setting_digit[4] * 10 + setting_digit[5];
         datetime.day = setting_digit[6] * 10 + setting_digit[7];
+        RTCStoreData();
         mode = MODE_DISPLAY;
         ClearKeyFlags();
     }
@@ -544,23 +1398,23 @@ void ProcSetDate(void) {
         ClearKeyFlags();
     }
     
+    buffer = DisplayBackBuffer();
     for (i = 0; i < 8; ++i) {
-        I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x01 << i);
         if (i == focus_digit && focus_flash) {
             // hide focus digit if focus_flash is set, controlled by timer per 250ms
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00);
+            buffer[i] = 0x00;
         } else if (i == 3 || i == 5) { // show dot
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, seg7[setting_digit[i]] | 0x80);
+            buffer[i] = seg7[setting_digit[i]] | 0x80;
         } else {
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, seg7[setting_digit[i]]);
+            buffer[i] = seg7[setting_digit[i]];
         }
-        Delay(TCA6424_DELAY);
-        I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // prevent ghost digit
     }
+    DisplaySwap();
 }
 
 void ProcSetTime(void) {
     uint8_t i = 0;
+    uint8_t *buffer;
     
     if (keystate[BUTTON_LEFT].flag) {
         keystate[BUTTON_LEFT].flag = 0;
@@ -609,8 +1463,11 @@ void ProcSetTime(void) {
         uint8_t sec = setting_digit[4] * 10 + setting_digit[5];
         if (mode == MODE_SETTIME) {
             datetime.time = hour * 3600 + min * 60 + sec;
-        } else { // MODE_ALARM
-            alarm_time = hour * 3600 + min * 60 + sec;
+            RTCStoreData();
+        } else if (alarms[0].used) { // MODE_ALARM
+            AlarmSet(0, hour * 3600 + min * 60 + sec, alarms[0].weekdays, alarms[0].days);
+        } else {
+            AlarmSet(0, hour * 3600 + min * 60 + sec, ALARM_DAILY, 0);
         }
         mode = MODE_DISPLAY;
         ClearKeyFlags();
@@ -621,83 +1478,217 @@ void ProcSetTime(void) {
         ClearKeyFlags();
     }
     
+    buffer = DisplayBackBuffer();
     for (i = 0; i < 8; ++i) {
-        I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x01 << i);
         if ((i - 1 == focus_digit && focus_flash) || i == 0 || i == 7) {
             // hide focus digit if focus_flash is set, controlled by timer per 250ms
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00);
+            buffer[i] = 0x00;
         } else if (i == 2 || i == 4) { // show dot
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, seg7[setting_digit[i - 1]] | 0x80);
+            buffer[i] = seg7[setting_digit[i - 1]] | 0x80;
         } else {
-            I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, seg7[setting_digit[i - 1]]);
+            buffer[i] = seg7[setting_digit[i - 1]];
         }
-        Delay(TCA6424_DELAY);
-        I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // prevent ghost digit
     }
+    DisplaySwap();
 }
 
 void DisplayDatetime(uint8_t offset) {
-    uint8_t data[16];
+    // Render display_flow only when the time ticked, then copy the scroll window out of it.
+    // Nothing is written while neither the time nor the window moved.
+    if (datetime.time != display_flow_time) {
+        DisplayFlowRender();
+    } else if (offset == display_flow_window) {
+        return;
+    }
+    
+    memcpy(DisplayBackBuffer(), display_flow + offset, DISPLAY_DIGITS);
+    display_flow_window = offset;
+    DisplaySwap();
+}
+
+void DisplayFlowRender(void) {
+    // A seconds tick rewrites only the digit pairs it carried into,
+    // anything else renders the whole datetime again
+    static const uint8_t hms_limit[3] = {24, 60, 60};
+    uint32_t time = datetime.time;
     uint8_t i;
     
-    uint8_t hour = datetime.time / 3600;
-    uint8_t min = datetime.time / 60 % 60;
-    uint8_t sec = datetime.time % 60;
-    
-    data[0] = seg7[datetime.year / 1000 % 10];
-    data[1] = seg7[datetime.year / 100 % 10];
-    data[2] = seg7[datetime.year / 10 % 10];
-    data[3] = seg7[datetime.year % 10] | 0x80; // show dot
-    data[4] = seg7[datetime.month / 10 % 10];
-    data[5] = seg7[datetime.month % 10] | 0x80;
-    data[6] = seg7[datetime.day / 10];
-    data[7] = seg7[datetime.day % 10];
-    data[8] = 0x00;
-    data[9] = seg7[hour / 10 % 10];
-    data[10] = seg7[hour % 10] | 0x80;
-    data[11] = seg7[min / 10 % 10];
-    data[12] = seg7[min % 10] | 0x80;
-    data[13] = seg7[sec / 10 % 10];
-    data[14] = seg7[sec % 10];
-    data[15] = 0x00;
+    if (display_flow_time != DISPLAY_FLOW_STALE && time == display_flow_time + 1) {
+        for (i = 3; i-- > 0;) {
+            if (++display_flow_hms[i] < hms_limit[i]) {
+                break;
+            }
+            display_flow_hms[i] = 0; // time + 1 is within the day, the hour never carries
+            DisplayFlowPair(9 + i * 2, 0, i < 2);
+        }
+        DisplayFlowPair(9 + i * 2, display_flow_hms[i], i < 2);
+    } else {
+        if (display_flow_time == DISPLAY_FLOW_STALE) {
+            DisplayFlowPair(0, datetime.year / 100, 0);
+            DisplayFlowPair(2, datetime.year % 100, 1); // show dot
+            DisplayFlowPair(4, datetime.month, 1);
+            DisplayFlowPair(6, datetime.day, 0);
+            display_flow[8] = display_flow[8 + DISPLAY_FLOW_LENGTH] = 0x00;
+            display_flow[15] = display_flow[15 + DISPLAY_FLOW_LENGTH] = 0x00;
+        }
+        display_flow_hms[0] = time / 3600;
+        display_flow_hms[1] = time / 60 % 60;
+        display_flow_hms[2] = time % 60;
+        for (i = 0; i < 3; ++i) {
+            DisplayFlowPair(9 + i * 2, display_flow_hms[i], i < 2);
+        }
+    }
+    
+    display_flow_time = time;
+}
+
+void DisplayFlowPair(uint8_t index, uint8_t value, uint8_t dot) {
+    // two digits into both copies of display_flow, dot after the second one
+    uint8_t high = seg7_pairs[value][0], low = seg7_pairs[value][1] | (dot ? 0x80 : 0x00);
     
-    for (i = 0; i < 8; ++i) {
-        I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x01 << i);
-        I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, data[(i + offset) % 16]);
-        Delay(TCA6424_DELAY);
-        I2C0WriteByte(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // prevent ghost digit
+    display_flow[index] = display_flow[index + DISPLAY_FLOW_LENGTH] = high;
+    display_flow[index + 1] = display_flow[index + 1 + DISPLAY_FLOW_LENGTH] = low;
+}
+
+void DisplayFlowInvalidate(void) {
+    // the date changed or was set, render everything at the next DisplayDatetime
+    display_flow_time = DISPLAY_FLOW_STALE;
+}
+
+uint8_t *DisplayBackBuffer(void) {
+    // cancel a pending swap so the scan never picks up a half written buffer,
+    // the frame will be swapped again by DisplaySwap
+    display_swap_pending = 0;
+    display_flow_window = DISPLAY_FLOW_NONE; // DisplayDatetime copies its window again
+    return display_buffer[!display_front];
+}
+
+void DisplaySwap(void) {
+    display_swap_pending = 1; // applied by TIMER0A_Handler at the next frame boundary
+}
+
+void DisplayShow(const uint8_t *segments) {
+    memcpy(DisplayBackBuffer(), segments, DISPLAY_DIGITS);
+    DisplaySwap();
+}
+
+void DisplayBrightnessUpdate(void) {
+    // Brightness is the lit share of each digit slot, 0 stops the scan altogether
+    uint8_t duty = display_brightness;
+    uint32_t now = datetime.time;
+    
+    if (display_dim_start != display_dim_end && (display_dim_start < display_dim_end
+        ? now >= display_dim_start && now < display_dim_end
+        : now >= display_dim_start || now < display_dim_end)) { // the window may span midnight
+        duty = display_dim_level;
+    }
+    if (display_off) {
+        duty = 0;
+    }
+    if (!duty && mode != MODE_DISPLAY) {
+        duty = display_brightness; // keys woke the display for setting
+    }
+    if (duty == display_duty) {
+        return;
+    }
+    
+    if (!duty) {
+        display_on_cycles = 0; // a timeout already pending does not reload the timer
+        TimerDisable(TIMER0_BASE, TIMER_A);
+        ExpanderWriteAsync(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // queued after the last scan write
+    } else {
+        display_on_cycles = display_slot_cycles / 100 * duty;
+        if (!display_duty) { // restart the scan with a fresh slot
+            display_dark = 0;
+            TimerLoadSet(TIMER0_BASE, TIMER_A, display_slot_cycles);
+            TimerEnable(TIMER0_BASE, TIMER_A);
+        }
     }
+    display_duty = duty;
 }
 
-void DetectKey(void) {
-    uint8_t i = 0;
-    static uint8_t key_press = 0; // bitmask for key press state
+void DetectKey(uint32_t now) {
+    // Debounce key_input and turn it into gestures, runs for each sample and every 20ms while key_active
+    const key_config_t *config;
+    keystate_t *key;
+    uint8_t i, j, press, active = 0;
     
-    key_press = ~I2C0ReadByte(TCA6424_I2CADDR, TCA6424_INPUT_PORT0);
-    // I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, ~key_press); // show key state
     for (i = 0; i < 8; ++i) {
-        uint8_t is_press = key_press & (0x01 << i);
-        keystate[i].state = (keystate[i].state << 1) | (is_press ? 0x01 : 0x00);
+        key = &keystate[i];
+        config = &key_config[i];
+        press = !(key_input & (0x01 << i)); // low while pressed
         
-        if (is_press) {
-            if (keystate[i].config & KEY_CONFIG_PRESS) {
-                // long press key
-                    if ((keystate[i].state & 0x02) == 0) { // check previous state
-                        keystate[i].flag = 1;
-                        keystate[i].timer = KEY_DELAY * 2; // 2 * interval at first time
-                    } else {
-                        if (--keystate[i].timer == 0) {
-                            keystate[i].flag = 1;
-                            keystate[i].timer = KEY_DELAY;
+        // an edge is taken at once, then the key ignores its bounces for KEY_DEBOUNCE_MS
+        if (press != key->pressed && now - key->edge >= KEY_DEBOUNCE_MS) {
+            key->pressed = press;
+            if (press) {
+                key->taps = (now - key->edge < KEY_DOUBLE_MS) ? key->taps + 1 : 1; // edge is the release
+                if (key->taps == 2 && (config->gestures & KEY_DOUBLE)) {
+                    key->gesture |= KEY_DOUBLE;
+                    key->taps = 0; // a third tap starts over
+                }
+                if (config->gestures & KEY_PRESS) {
+                    key->flag = 1;
+                }
+                if (config->gestures & KEY_CHORD) {
+                    for (j = 0; j < 8; ++j) {
+                        if (j != i && keystate[j].pressed && (key_config[j].gestures & KEY_CHORD)
+                            && now - keystate[j].edge < KEY_CHORD_MS) {
+                            key_chord |= (1 << i) | (1 << j);
                         }
                     }
-            } else {
-                // oneshot key
-                if ((keystate[i].state & 0x02) == 0) { // check previous state
-                    keystate[i].flag = 1;
                 }
+                key->pending = config->gestures & (KEY_LONG | KEY_REPEAT);
+                key->repeats = 0;
+                key->deadline = now + config->delay_ms;
+            } else if (config->gestures & KEY_RELEASE) {
+                key->gesture |= KEY_RELEASE;
             }
+            key->edge = now;
         }
+        
+        if (key->pressed) {
+            if ((key->pending & KEY_LONG) && now - key->edge >= config->long_ms) {
+                key->pending &= ~KEY_LONG;
+                key->gesture |= KEY_LONG;
+            }
+            if ((key->pending & KEY_REPEAT) && (int32_t)(now - key->deadline) >= 0) {
+                key->flag = 1;
+                if (key->repeats < KEY_REPEAT_ACCEL * 4) {
+                    ++key->repeats;
+                }
+                key->deadline = now + MAX(config->repeat_ms >> (key->repeats / KEY_REPEAT_ACCEL), config->repeat_min_ms);
+            }
+        }
+        active |= key->pressed || press != key->pressed;
+    }
+    key_active = active;
+}
+
+void KeyInit(void) {
+    // Keys held through the boot animation count as pressed, they report nothing until released
+    uint8_t i;
+    
+#if KEY_INTERRUPT
+    // armed before the read, a change after it is an edge
+    GPIOIntClear(KEY_INT_BASE, KEY_INT_PIN);
+    GPIOIntEnable(KEY_INT_BASE, KEY_INT_PIN);
+    IntEnable(KEY_INT_VECTOR);
+#endif
+    key_input = I2C0ReadByte(TCA6424_I2CADDR, TCA6424_INPUT_PORT0); // releases the INT line
+    for (i = 0; i < 8; ++i) {
+        keystate[i].pressed = !(key_input & (0x01 << i));
+        keystate[i].pending = 0;
+        keystate[i].edge = GetMillis();
+    }
+    key_active = key_input != 0xff;
+}
+
+void KeyReadComplete(const i2c_transaction_t *transaction) {
+    if (transaction->error == I2C_MASTER_ERR_NONE) {
+        EventPost(EVENT_KEYS, transaction->data[0]);
+    } else {
+        key_active = 1; // retried on the 20ms tick while INT stays low
     }
 }
 
@@ -706,742 +1697,4069 @@ void ClearKeyFlags(void) {
     
     for (i = 0; i < 8; ++i) {
         keystate[i].flag = 0;
+        keystate[i].gesture = 0;
     }
+    key_chord = 0;
 }
 
 void ProcessCommand(void) {
-    datetime_t args[1];
-    char buffer[128];
+    command_line_t line;
+    command_arg_t args[COMMAND_MAX_ARGS];
+    char response[COMMAND_RESPONSE_SIZE];
+    const command_t *cmd = NULL;
+    uint8_t first_arg = 0;
     error_t error;
-    uint8_t partical_error = 0;
+    int16_t verb;
     
-    // HELP
-    error = ParseCommand("?", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        UART0StringPutNonBlocking(help_message);
+    if (strchr(command, ';')) {
+        ProcessBatch();
         return;
     }
     
-    // MUTE
-    error = ParseCommand("MUTE", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        alarming = 0;
-        return;
+    if (LexCommand(command, &line) != ERROR_SUCCESS) {
+        line.count = 0; // bad spacing, treat as unknown command
+    }
+    if (line.count > 0) {
+        cmd = FindCommand(&line, &first_arg);
     }
     
-    // INIT
-    error = ParseCommand("CLOCK INIT", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        datetime.year = 2000;
-        datetime.month = 1;
-        datetime.day = 1;
-        datetime.time = 0;
-        alarm_time = 999;
-        RTCStoreData(); // store default data
-        SysCtlReset(); // restart
+    if (!cmd) {
+        verb = (line.count > 0) ? FindVerb(&line) : -1;
+        if (verb >= 0) { // known verb with unknown sub-verb
+            CommandUsagePut(&line, 1, command_table[verb].verb);
+            return;
+        }
+        
+        // no match
+        UART0StringPutNonBlocking("Invalid Command: ");
+        UART0StringPutNonBlocking(command);
+        UART0StringPutNonBlocking("\r\n");
+        UART0StringPutNonBlocking(help_message);
         return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
     }
     
-    error = ParseCommand("CLOCK RESTART", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        ROMStoreData(); // store data before restart
-        SysCtlReset();
+    error = ParseArguments(cmd, &line, first_arg, args);
+    if (error & ERROR_PARTIAL) {
+        CommandUsagePut(&line, error & 0x00ff, cmd->verb);
         return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
+    } else if (error != ERROR_SUCCESS) {
+        return; // reported by the argument parser
     }
     
-    error = ParseCommand("CLOCK HIB", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        HibernateWakeSet(HIBERNATE_WAKE_PIN);
-        HibernateRequest();
-        return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
+    UART0BaudConfirm(); // a valid command arrived at the current rate
+    
+    response[0] = '\0';
+    cmd->handler(args, response);
+    if (response[0]) {
+        UART0StringPutNonBlocking(response);
+        UART0StringPutNonBlocking("\r\n");
     }
+}
+
+void ProcessBatch(void) {
+    // static, too large for the stack
+    static char text[UART0_RX_LINE_SIZE];
+    static command_line_t lines[BATCH_MAX_COMMANDS];
+    static command_arg_t args[BATCH_MAX_COMMANDS][COMMAND_MAX_ARGS];
+    const command_t *cmds[BATCH_MAX_COMMANDS];
+    uint8_t status[BATCH_MAX_COMMANDS];
+    char response[COMMAND_RESPONSE_SIZE];
+    char *element = text, *end;
+    uint8_t i, length, count = 0, failed = 0;
     
-    if (partical_error) {
-        uint8_t i, j, last_space = 18 + 3;
+    // parse every command before running any, one bad command rejects the whole batch
+    strcpy(text, command);
+    command_quiet = 1;
+    do {
+        if (count == BATCH_MAX_COMMANDS) {
+            command_quiet = 0;
+            UART0StringPutNonBlocking("Invalid Batch: at most ");
+            UART0NumberPutNonBlocking(BATCH_MAX_COMMANDS);
+            UART0StringPutNonBlocking(" commands\r\n");
+            return;
+        }
         
-        strcpy(buffer, "Invalid Argument: ");
-        strcat(buffer, (const char *)command);
-        strcat(buffer, "\r\n");
-        for (j = strlen(buffer), i = 0; i < partical_error + 18; ++i) {
-            if (i > 17 && command[i - 18] == ' ') {
-                last_space = i + 1; // record last space
-            }
-            buffer[i + j] = ' ';
+        end = strchr(element, ';');
+        if (end) {
+            *end = '\0';
+        }
+        
+        // spaces around ';' are allowed
+        while (*element == ' ') {
+            ++element;
+        }
+        for (length = strlen(element); length > 0 && element[length - 1] == ' '; --length) {
+            element[length - 1] = '\0';
         }
-        buffer[i + j] = '^';
-        for (i = last_space; i < j - 2 || i <= last_space; ++i) {
-            if (buffer[i + j] != '^') {
-                buffer[i + j] = '~';
+        
+        status[count] = BatchParse(element, &lines[count], &cmds[count], args[count]);
+        failed |= status[count];
+        ++count;
+        
+        element = end + 1;
+    } while (end);
+    command_quiet = 0;
+    
+    if (!failed) {
+        UART0BaudConfirm();
+    }
+    
+    // run in one go, the 1s tick is handled by the main loop only after the whole batch
+    UART0StringPutNonBlocking(failed ? "ERR " : "OK ");
+    for (i = 0; i < count; ++i) {
+        response[0] = '0' + status[i];
+        response[1] = '\0';
+        UART0StringPutNonBlocking(i ? ";" : "");
+        UART0StringPutNonBlocking(response);
+        
+        if (!failed) {
+            response[0] = '\0';
+            cmds[i]->handler(args[i], response);
+            if (response[0]) {
+                UART0StringPutNonBlocking("=");
+                UART0StringPutNonBlocking(response);
             }
         }
-        buffer[i + j] = '\0';
-        strcat(buffer, "\r\nUsage: CLOCK INIT|RESTART|HIB\r\n");
-        UART0StringPutNonBlocking(buffer);
-        return;
     }
+    UART0StringPutNonBlocking("\r\n");
+}
+
+uint8_t BatchParse(const char *text, command_line_t *line, const command_t **cmd, command_arg_t *args) {
+    uint8_t first_arg;
+    error_t error;
     
-    // GET
-    error = ParseCommand("GET DATE", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        StringifyDate(datetime.year, datetime.month, datetime.day, buffer);
-        UART0StringPutNonBlocking(buffer);
-        return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
+    if (LexCommand(text, line) != ERROR_SUCCESS || line->count == 0) {
+        return BATCH_UNKNOWN;
     }
     
-    error = ParseCommand("GET TIME", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        StringifyTime(datetime.time, buffer);
-        UART0StringPutNonBlocking(buffer);
-        return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
+    *cmd = FindCommand(line, &first_arg);
+    if (!*cmd) {
+        return FindVerb(line) >= 0 ? BATCH_ARGUMENT : BATCH_UNKNOWN;
+    }
+    if ((*cmd)->flags & (COMMAND_FLAG_NO_BATCH | COMMAND_FLAG_STREAM)) {
+        return BATCH_NOT_ALLOWED;
     }
     
-    error = ParseCommand("GET ALARM", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        StringifyTime(alarm_time, buffer);
-        UART0StringPutNonBlocking(buffer);
-        return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
+    error = ParseArguments(*cmd, line, first_arg, args);
+    if (error & ERROR_PARTIAL) {
+        return BATCH_ARGUMENT;
+    } else if (error != ERROR_SUCCESS) {
+        return BATCH_FORMAT;
     }
     
-    if (partical_error) {
-        uint8_t i, j, last_space = 18 + 3;
-        
-        strcpy(buffer, "Invalid Argument: ");
-        strcat(buffer, (const char *)command);
-        strcat(buffer, "\r\n");
-        for (j = strlen(buffer), i = 0; i < partical_error + 18; ++i) {
-            if (i > 17 && command[i - 18] == ' ') {
-                last_space = i + 1; // record last space
+    return BATCH_OK;
+}
+
+error_t LexCommand(const char *raw, command_line_t *line) {
+    uint8_t i, j = 0;
+    
+    // one pass: fold case, merge spaces and record token positions
+    line->count = 0;
+    for (i = 0; raw[i]; ++i) {
+        if (raw[i] == ' ') {
+            if (i == 0) {
+                return ERROR_FORMAT; // no leading space
+            }
+            if (raw[i - 1] != ' ') {
+                line->text[j++] = ' ';
             }
-            buffer[i + j] = ' ';
+            continue;
         }
-        buffer[i + j] = '^';
-        for (i = last_space; i < j - 2 || i <= last_space; ++i) {
-            if (buffer[i + j] != '^') {
-                buffer[i + j] = '~';
+        
+        if (i == 0 || raw[i - 1] == ' ') { // start of a token
+            if (line->count >= COMMAND_MAX_TOKENS) {
+                return ERROR_FORMAT;
             }
+            line->start[line->count] = j;
+            line->length[line->count] = 0;
+            line->source[line->count] = i;
+            ++line->count;
         }
-        buffer[i + j] = '\0';
-        strcat(buffer, "\r\nUsage: GET DATE|TIME|ALARM\r\n");
-        UART0StringPutNonBlocking(buffer);
-        return;
+        
+        line->text[j++] = ToUpperCase(raw[i]);
+        ++line->length[line->count - 1];
     }
+    line->text[j] = '\0';
     
-    // SET
-    error = ParseCommand("SET DATE $D", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        datetime.year = args[0].year;
-        datetime.month = args[0].month;
-        datetime.day = args[0].day;
-        return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
-    } else if (error & ERROR_FORMAT) {
-        return; // This is solved in ParseCommand
+    if (j > 0 && line->text[j - 1] == ' ') {
+        return ERROR_FORMAT; // no trailing space
     }
     
-    error = ParseCommand("SET TIME $T", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        datetime.time = args[0].time;
-        return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
-    } else if (error & ERROR_FORMAT) {
-        return; // This is solved in ParseCommand
-    }
+    return ERROR_SUCCESS;
+}
+
+const command_t *FindCommand(const command_line_t *line, uint8_t *first_arg) {
+    const command_t *cmd;
+    uint32_t hash;
+    uint8_t slot;
     
-    error = ParseCommand("SET ALARM $T", (char *)command, args);
-    if (error == ERROR_SUCCESS) {
-        alarm_time = args[0].time;
-        return;
-    } else if (error & ERROR_PARTIAL) {
-        partical_error = MAX(partical_error, error & 0x00ff);
-    } else if (error & ERROR_FORMAT) {
-        return; // This is solved in ParseCommand
+    // try "VERB SUB" first, then a verb without sub-verb, one probe each unless the seed search failed
+    if (line->count >= 2) {
+        hash = CommandHash(line->text, line->length[0], line->text + line->start[1], line->length[1],
+            command_hash_seed);
+        for (; (slot = command_hash[hash & (COMMAND_HASH_SIZE - 1)]) != 0; ++hash) {
+            cmd = &command_table[slot - 1];
+            if (TokenEquals(line, 0, cmd->verb) && TokenEquals(line, 1, cmd->sub)) {
+                *first_arg = 2;
+                return cmd;
+            }
+        }
     }
     
-    if (partical_error) {
-        uint8_t i, j, last_space = 18 + 3;
-        
-        strcpy(buffer, "Invalid Argument: ");
-        strcat(buffer, (const char *)command);
-        strcat(buffer, "\r\n");
-        for (j = strlen(buffer), i = 0; i < partical_error + 18; ++i) {
-            if (i > 17 && command[i - 18] == ' ') {
-                last_space = i + 1; // record last space
-            }
-            buffer[i + j] = ' ';
+    hash = CommandHash(line->text, line->length[0], "", 0, command_hash_seed);
+    for (; (slot = command_hash[hash & (COMMAND_HASH_SIZE - 1)]) != 0; ++hash) {
+        cmd = &command_table[slot - 1];
+        if (cmd->sub[0] == '\0' && TokenEquals(line, 0, cmd->verb)) {
+            *first_arg = 1;
+            return cmd;
         }
-        buffer[i + j] = '^';
-        for (i = last_space; i < j - 2 || i <= last_space; ++i) {
-            if (buffer[i + j] != '^') {
-                buffer[i + j] = '~';
-            }
+    }
+    
+    return NULL;
+}
+
+int16_t FindVerb(const command_line_t *line) {
+    uint32_t hash = CommandHash(line->text, line->length[0], "", 0, verb_hash_seed);
+    uint8_t slot;
+    
+    for (; (slot = verb_hash[hash & (VERB_HASH_SIZE - 1)]) != 0; ++hash) {
+        if (TokenEquals(line, 0, command_table[slot - 1].verb)) {
+            return slot - 1;
         }
-        buffer[i + j] = '\0';
-        strcat(buffer, "\r\nUsage: SET DATE <YYYY/MM/DD> Or SET ALARM|TIME <HH:MM:SS>\r\n");
-        UART0StringPutNonBlocking(buffer);
-        return;
     }
     
-    // no match
-    UART0StringPutNonBlocking("Invalid Command: ");
-    UART0StringPutNonBlocking((const char *)command);
-    UART0StringPutNonBlocking("\r\n");
-    UART0StringPutNonBlocking(help_message);
+    return -1;
+}
+
+uint8_t TokenEquals(const command_line_t *line, uint8_t token, const char *str) {
+    return strlen(str) == line->length[token] && memcmp(line->text + line->start[token], str, line->length[token]) == 0;
 }
 
-error_t ParseCommand(const char *pattern, const char *command, datetime_t *args) {
-    uint8_t i = 0, j = 0;
-    uint8_t skip_space = 0, has_space = 0;
-    uint8_t current_arg = 0;
+error_t ParseArguments(const command_t *cmd, const command_line_t *line, uint8_t first_arg, command_arg_t *args) {
+    const char *schema = cmd->schema;
+    uint8_t i, token = first_arg;
+    error_t error = ERROR_SUCCESS;
     
-    for (i = 0, j = 0; command[i] && pattern[j]; ++i) {
-        char comp_1 = ToUpperCase(pattern[j]);
-        char comp_2 = ToUpperCase(command[i]);
+    for (i = 0; schema[i]; ++i, ++token) {
+        char type = ToUpperCase(schema[i]);
         
-        if (comp_2 == ' ') { // skip multiple spaces as one
-            if (skip_space) continue;
-            else skip_space = has_space = 1;
-        } else {
-            skip_space = 0;
+        args[i].length = 0;
+        if (token >= line->count) {
+            if (type != schema[i]) {
+                continue; // optional argument omitted
+            }
+            return ERROR_PARTIAL | token; // missing argument, point at end of line
         }
         
-        if (comp_1 == '$') { // pattern
-            char pattern_type = ToUpperCase(pattern[j + 1]);
-            ++j;
-            
-            args[current_arg].year = args[current_arg].month = args[current_arg].day = 0;
-            args[current_arg].time = 0;
+        args[i].word = line->text + line->start[token];
+        args[i].length = line->length[token];
+        
+        if (type == 'D') {
+            error = ParseDateArgument(line, token, &args[i]);
+        } else if (type == 'T') {
+            error = ParseTimeArgument(line, token, &args[i]);
+        } else if (type == 'N') {
+            uint8_t index = line->start[token];
+            uint32_t temp;
             
-            if (pattern_type == 'T') {
-                int temp;
-                error_t error;
-                
-                // Parse a time value like HH:MM:SS
-                error = ParseIntegerUntil(command, ':', &i, &temp);
-                if (error == ERROR_SUCCESS) {
-                    if (temp >= 0 && temp <= 23) {
-                        args[current_arg].time += temp * 60 * 60;
-                    } else {
-                        UART0StringPutNonBlocking("Invalid Hour: ");
-                        UART0NumberPutNonBlocking(temp);
-                        UART0StringPutNonBlocking("\r\nShould between 00 and 23\r\n");
-                        return ERROR_FORMAT;
-                    }
-                } else {
-                    UART0StringPutNonBlocking("Invalid Format: ");
-                    UART0StringPutNonBlocking(command);
-                    UART0StringPutNonBlocking("\r\nTime should be HH:MM:SS\r\n");
-                    return ERROR_FORMAT;
-                }
-                
-                error = ParseIntegerUntil(command, ':', &i, &temp);
-                if (error == ERROR_SUCCESS) {
-                    if (temp >= 0 && temp <= 59) {
-                        args[current_arg].time += temp * 60;
-                    } else {
-                        UART0StringPutNonBlocking("Invalid Minute: ");
-                        UART0NumberPutNonBlocking(temp);
-                        UART0StringPutNonBlocking("\r\nShould between 00 and 59\r\n");
-                        return ERROR_FORMAT;
-                    }
-                } else {
-                    UART0StringPutNonBlocking("Invalid Format: ");
-                    UART0StringPutNonBlocking(command);
-                    UART0StringPutNonBlocking("\r\nTime should be HH:MM:SS\r\n");
-                    return ERROR_FORMAT;
-                }
-                
-                error = ParseIntegerUntil(command, pattern[j + 1], &i, &temp);
-                if (error == ERROR_SUCCESS) {
-                    if (temp >= 0 && temp <= 59) {
-                        args[current_arg].time += temp;
-                    } else {
-                        UART0StringPutNonBlocking("Invalid Second: ");
-                        UART0NumberPutNonBlocking(temp);
-                        UART0StringPutNonBlocking("\r\nShould between 00 and 59\r\n");
-                        return ERROR_FORMAT;
-                    }
-                } else {
-                    UART0StringPutNonBlocking("Invalid Format: ");
-                    UART0StringPutNonBlocking(command);
-                    UART0StringPutNonBlocking("\r\nTime should be HH:MM:SS\r\n");
-                    return ERROR_FORMAT;
-                }
-            } else if (pattern_type == 'D') {
-                // Parse a date value like YYYY/MM/DD
-                int temp;
-                error_t error;
-                
-                error = ParseIntegerUntil(command, '/', &i, &temp);
-                if (error == ERROR_SUCCESS) {
-                    if (temp >= 0 && temp <= 9999) {
-                        args[current_arg].year = temp;
-                    } else {
-                        UART0StringPutNonBlocking("Invalid Year: ");
-                        UART0NumberPutNonBlocking(temp);
-                        UART0StringPutNonBlocking("\r\nShould between 0000 and 9999\r\n");
-                        return ERROR_FORMAT;
-                    }
-                } else {
-                    UART0StringPutNonBlocking("Invalid Format: ");
-                    UART0StringPutNonBlocking(command);
-                    UART0StringPutNonBlocking("\r\nDate should be YYYY/MM/DD\r\n");
-                    return ERROR_FORMAT;
-                }
-                
-                error = ParseIntegerUntil(command, '/', &i, &temp);
-                if (error == ERROR_SUCCESS) {
-                    if (temp >= 0 && temp <= 12) {
-                        args[current_arg].month = temp;
-                    } else {
-                        UART0StringPutNonBlocking("Invalid Month: ");
-                        UART0NumberPutNonBlocking(temp);
-                        UART0StringPutNonBlocking("\r\nShould between 01 and 12\r\n");
-                        return ERROR_FORMAT;
-                    }
-                } else {
-                    UART0StringPutNonBlocking("Invalid Format: ");
-                    UART0StringPutNonBlocking(command);
-                    UART0StringPutNonBlocking("\r\nDate should be YYYY/MM/DD\r\n");
-                    return ERROR_FORMAT;
-                }
-                
-                error = ParseIntegerUntil(command, pattern[j + 1], &i, &temp);
-                if (error == ERROR_SUCCESS) {
-                    uint8_t day_of_month = GetDayOfMonth(args[current_arg].year, args[current_arg].month);
-                    if (temp >= 0 && temp <= day_of_month) {
-                        args[current_arg].day = temp;
-                    } else {
-                        UART0StringPutNonBlocking("Invalid Day: ");
-                        UART0NumberPutNonBlocking(temp);
-                        UART0StringPutNonBlocking("\r\nShould between 00 and ");
-                        UART0NumberPutNonBlocking(day_of_month);
-                        UART0StringPutNonBlocking("\r\n");
-                        return ERROR_FORMAT;
-                    }
-                } else {
-                    UART0StringPutNonBlocking("Invalid Format: ");
+            if (ParseIntegerUntil(line->text, line->text[index + line->length[token]], &index, &temp) != ERROR_SUCCESS) {
+                if (!command_quiet) {
+                    UART0StringPutNonBlocking("Invalid Number: ");
                     UART0StringPutNonBlocking(command);
-                    UART0StringPutNonBlocking("\r\nDate should be YYYY/MM/DD\r\n");
-                    return ERROR_FORMAT;
+                    UART0StringPutNonBlocking("\r\n");
                 }
+                return ERROR_FORMAT;
             }
-            
-            ++current_arg; // move to next argument
-        } else { // directly compare
-            if (comp_1 != comp_2) {
-                return (has_space ? ERROR_PARTIAL : ERROR_NOT_MATCH) | (i & 0x00ff); // save index to error
-            }
+            args[i].number = temp;
         }
         
-        ++j;
+        if (error != ERROR_SUCCESS) {
+            return error;
+        }
+    }
+    
+    if (token < line->count) {
+        return ERROR_PARTIAL | token; // too many arguments
     }
     
-    if (command[i] || pattern[j]) { // pattern or command doesn't end
-        return ((has_space || pattern[j] == ' ') ? ERROR_PARTIAL : ERROR_NOT_MATCH) | (i & 0x00ff);
+    return cmd->check ? cmd->check(args) : ERROR_SUCCESS;
+}
+
+error_t ParseDateArgument(const command_line_t *line, uint8_t token, command_arg_t *arg) {
+    // Parse a date value like YYYY/MM/DD
+    static const char *const field_name[] = {"Year", "Month", "Day"};
+    static const char *const field_min[] = {"0000", "01", "01"};
+    uint16_t field[3];
+    uint8_t i, index = line->start[token];
+    char end = line->text[index + line->length[token]];
+    uint32_t temp, max;
+    
+    for (i = 0; i < 3; ++i) {
+        if (ParseIntegerUntil(line->text, i < 2 ? '/' : end, &index, &temp) != ERROR_SUCCESS) {
+            if (!command_quiet) {
+                UART0StringPutNonBlocking("Invalid Format: ");
+                UART0StringPutNonBlocking(command);
+                UART0StringPutNonBlocking("\r\nDate should be YYYY/MM/DD\r\n");
+            }
+            return ERROR_FORMAT;
+        }
+        max = (i == 0) ? 9999 : (i == 1) ? 12 : GetDayOfMonth(field[0], field[1]);
+        if (temp < (i ? 1 : 0) || temp > max) {
+            if (!command_quiet) {
+                UART0StringPutNonBlocking("Invalid ");
+                UART0StringPutNonBlocking(field_name[i]);
+                UART0StringPutNonBlocking(": ");
+                UART0NumberPutNonBlocking(temp);
+                UART0StringPutNonBlocking("\r\nShould between ");
+                UART0StringPutNonBlocking(field_min[i]);
+                UART0StringPutNonBlocking(" and ");
+                UART0NumberPutNonBlocking(max);
+                UART0StringPutNonBlocking("\r\n");
+            }
+            return ERROR_FORMAT;
+        }
+        field[i] = temp;
     }
     
+    arg->datetime.year = field[0];
+    arg->datetime.month = field[1];
+    arg->datetime.day = field[2];
+    arg->datetime.time = 0;
+    
     return ERROR_SUCCESS;
 }
 
-error_t ParseIntegerUntil(const char *str, char delim, uint8_t *index, int *result) {
-    *result = 0;
+error_t ParseTimeArgument(const command_line_t *line, uint8_t token, command_arg_t *arg) {
+    // Parse a time value like HH:MM:SS
+    static const char *const field_name[] = {"Hour", "Minute", "Second"};
+    static const uint8_t field_max[] = {23, 59, 59};
+    uint8_t i, index = line->start[token];
+    char end = line->text[index + line->length[token]];
+    uint32_t temp;
     
-    while (str[*index] && str[*index] != delim) {
-        if (str[*index] >= '0' && str[*index] <= '9') {
-            *result = *result * 10 + str[*index] - '0';
-            ++*index;
+    arg->datetime.year = arg->datetime.month = arg->datetime.day = 0;
+    arg->datetime.time = 0;
+    
+    for (i = 0; i < 3; ++i) {
+        if (ParseIntegerUntil(line->text, i < 2 ? ':' : end, &index, &temp) != ERROR_SUCCESS) {
+            if (!command_quiet) {
+                UART0StringPutNonBlocking("Invalid Format: ");
+                UART0StringPutNonBlocking(command);
+                UART0StringPutNonBlocking("\r\nTime should be HH:MM:SS\r\n");
+            }
+            return ERROR_FORMAT;
+        }
+        if (temp > field_max[i]) {
+            if (!command_quiet) {
+                UART0StringPutNonBlocking("Invalid ");
+                UART0StringPutNonBlocking(field_name[i]);
+                UART0StringPutNonBlocking(": ");
+                UART0NumberPutNonBlocking(temp);
+                UART0StringPutNonBlocking("\r\nShould between 00 and ");
+                UART0NumberPutNonBlocking(field_max[i]);
+                UART0StringPutNonBlocking("\r\n");
+            }
+            return ERROR_FORMAT;
+        }
+        arg->datetime.time = arg->datetime.time * 60 + temp;
+    }
+    
+    return ERROR_SUCCESS;
+}
+
+void CommandUsagePut(const command_line_t *line, uint8_t token, const char *verb) {
+    char buffer[UART0_RX_LINE_SIZE + 24];
+    uint8_t i, j, column, length, groups = 0;
+    const char *schema;
+    
+    UART0StringPutNonBlocking("Invalid Argument: ");
+    UART0StringPutNonBlocking(command);
+    UART0StringPutNonBlocking("\r\n");
+    
+    // underline the offending token, or point after the end if an argument is missing
+    if (token < line->count) {
+        column = line->source[token];
+        length = line->length[token];
+    } else {
+        column = strlen(command);
+        length = 1;
+    }
+    column += 18; // length of "Invalid Argument: "
+    for (i = 0; i < column; ++i) {
+        buffer[i] = ' ';
+    }
+    buffer[i++] = '^';
+    while (--length) {
+        buffer[i++] = '~';
+    }
+    buffer[i] = '\0';
+    UART0StringPutNonBlocking(buffer);
+    
+    // generated from command_table, sub-verbs with the same arguments are merged like GET DATE|TIME
+    UART0StringPutNonBlocking("\r\nUsage: ");
+    for (i = 0; i < COMMAND_COUNT; ++i) {
+        if (strcmp(command_table[i].verb, verb) != 0) {
+            continue;
+        }
+        for (j = 0; j < i && !CommandSameGroup(&command_table[j], &command_table[i]); ++j);
+        if (j < i) {
+            continue; // already listed
+        }
+        
+        if (groups++) {
+            UART0StringPutNonBlocking(" Or ");
+        }
+        UART0StringPutNonBlocking(verb);
+        if (command_table[i].sub[0]) {
+            UART0StringPutNonBlocking(" ");
+            UART0StringPutNonBlocking(command_table[i].sub);
+            for (j = i + 1; j < COMMAND_COUNT; ++j) {
+                if (CommandSameGroup(&command_table[j], &command_table[i])) {
+                    UART0StringPutNonBlocking("|");
+                    UART0StringPutNonBlocking(command_table[j].sub);
+                }
+            }
+        }
+        for (schema = command_table[i].schema; *schema; ++schema) {
+            UART0StringPutNonBlocking(*schema == ToUpperCase(*schema) ? " " : " [");
+            UART0StringPutNonBlocking(CommandArgumentName(*schema));
+            if (*schema != ToUpperCase(*schema)) {
+                UART0StringPutNonBlocking("]");
+            }
+        }
+    }
+    UART0StringPutNonBlocking("\r\n");
+}
+
+uint8_t CommandSameGroup(const command_t *a, const command_t *b) {
+    return a->sub[0] && b->sub[0] && strcmp(a->verb, b->verb) == 0 && strcmp(a->schema, b->schema) == 0;
+}
+
+const char *CommandArgumentName(char type) {
+    switch (ToUpperCase(type)) {
+        case 'D':
+            return "<YYYY/MM/DD>";
+        case 'T':
+            return "<HH:MM:SS>";
+        case 'N':
+            return "<NUMBER>";
+        default:
+            return "<WORD>";
+    }
+}
+
+void CommandTableInit(void) {
+    // Search a seed that gives every command its own slot, so lookups probe exactly once.
+    // The search is bounded: if no seed is collision-free, the last one is kept and
+    // colliding entries sit in the next free slots, which lookups probe in turn.
+    for (command_hash_seed = 0; CommandIndexBuild(command_hash, COMMAND_HASH_SIZE, 0, command_hash_seed)
+        && command_hash_seed < COMMAND_SEED_TRIES - 1; ++command_hash_seed);
+    
+    // same for verbs, pointing at the first command of each verb
+    for (verb_hash_seed = 0; CommandIndexBuild(verb_hash, VERB_HASH_SIZE, 1, verb_hash_seed)
+        && verb_hash_seed < COMMAND_SEED_TRIES - 1; ++verb_hash_seed);
+}
+
+uint8_t CommandIndexBuild(uint8_t *index, uint16_t size, uint8_t verbs, uint32_t seed) {
+    // Index every command, or the first command of every verb, returns the number of collisions
+    uint8_t i, j, collisions = 0;
+    uint32_t slot;
+    
+    memset(index, 0, size);
+    for (i = 0; i < COMMAND_COUNT; ++i) {
+        if (verbs) {
+            for (j = 0; j < i && strcmp(command_table[j].verb, command_table[i].verb) != 0; ++j);
+            if (j < i) {
+                continue; // verb already indexed
+            }
+            slot = CommandHash(command_table[i].verb, strlen(command_table[i].verb), "", 0, seed);
         } else {
-            return ERROR_NOT_DIGIT;
+            slot = CommandHash(command_table[i].verb, strlen(command_table[i].verb),
+                command_table[i].sub, strlen(command_table[i].sub), seed);
+        }
+        for (; index[slot & (size - 1)]; ++slot) { // the index is larger than the table, a slot is free
+            ++collisions;
         }
+        index[slot & (size - 1)] = i + 1;
     }
     
-    // string ends with delim
-    if (str[*index] == delim) {
-        ++*index; // skip delim
+    return collisions;
+}
+
+uint32_t CommandHash(const char *verb, uint8_t verb_length, const char *sub, uint8_t sub_length, uint32_t seed) {
+    // FNV-1a of "VERB SUB" or "VERB"
+    uint32_t hash = 2166136261u ^ seed;
+    uint8_t i;
+    
+    for (i = 0; i < verb_length; ++i) {
+        hash = (hash ^ (uint8_t)verb[i]) * 16777619u;
+    }
+    if (sub_length) {
+        hash = (hash ^ ' ') * 16777619u;
+        for (i = 0; i < sub_length; ++i) {
+            hash = (hash ^ (uint8_t)sub[i]) * 16777619u;
+        }
+    }
+    
+    return hash ^ (hash >> 16);
+}
+
+void CmdHelp(const command_arg_t *args, char *response) {
+    UART0StringPutNonBlocking(help_message);
+}
+
+void CmdMute(const command_arg_t *args, char *response) {
+    AlarmStop();
+}
+
+void CmdClockInit(const command_arg_t *args, char *response) {
+    datetime.year = 2000;
+    datetime.month = 1;
+    datetime.day = 1;
+    datetime.time = 0;
+    memset(alarms, 0, sizeof(alarms));
+    alarms[0].time = 999;
+    alarms[0].weekdays = ALARM_DAILY;
+    alarms[0].used = 1;
+    RTCStoreData(); // store default data
+    ROMCommit();
+    SysCtlReset(); // restart
+}
+
+void CmdClockRestart(const command_arg_t *args, char *response) {
+    ROMCommit(); // store data before restart
+    SysCtlReset();
+}
+
+void CmdClockHib(const command_arg_t *args, char *response) {
+    if (rom_dirty) {
+        ROMCommit(); // RAM is lost in hibernation
+    }
+    HibernateWakeSet(HIBERNATE_WAKE_PIN);
+    HibernateRequest();
+}
+
+void CmdGetDate(const command_arg_t *args, char *response) {
+    StringifyDate(datetime.year, datetime.month, datetime.day, response);
+}
+
+void CmdGetTime(const command_arg_t *args, char *response) {
+    StringifyTime(datetime.time, response);
+}
+
+void CmdGetAlarm(const command_arg_t *args, char *response) {
+    if (alarms[0].used) {
+        StringifyTime(alarms[0].time, response);
+    } else {
+        strcpy(response, "OFF");
+    }
+}
+
+void CmdGetI2C(const command_arg_t *args, char *response) {
+    I2C0StatsPut();
+}
+
+void CmdGetUart(const command_arg_t *args, char *response) {
+    UART0StatsPut();
+}
+
+void CmdGetPower(const command_arg_t *args, char *response) {
+    PowerStatsPut();
+}
+
+void CmdGetRom(const command_arg_t *args, char *response) {
+    ROMStatsPut();
+}
+
+void CmdGetWeekday(const command_arg_t *args, char *response) {
+    strcpy(response, weekday_names[GetDayOfWeek(datetime_day)]);
+}
+
+void CmdGetYearday(const command_arg_t *args, char *response) {
+    StringifyNumber(GetDayOfYear(datetime.year, datetime.month, datetime.day), response);
+}
+
+void CmdGetEpoch(const command_arg_t *args, char *response) {
+    StringifyNumber(epoch_seconds, response);
+}
+
+void CmdGetZone(const command_arg_t *args, char *response) {
+    TzStatsPut();
+}
+
+void CmdGetSync(const command_arg_t *args, char *response) {
+    SyncStatsPut();
+}
+
+void CmdSetDate(const command_arg_t *args, char *response) {
+    datetime.year = args[0].datetime.year;
+    datetime.month = args[0].datetime.month;
+    datetime.day = args[0].datetime.day;
+    RTCStoreData();
+}
+
+void CmdSetTime(const command_arg_t *args, char *response) {
+    datetime.time = args[0].datetime.time;
+    RTCStoreData();
+}
+
+void CmdSetAlarm(const command_arg_t *args, char *response) {
+    if (alarms[0].used) { // keep the recurrence
+        AlarmSet(0, args[0].datetime.time, alarms[0].weekdays, alarms[0].days);
+    } else {
+        AlarmSet(0, args[0].datetime.time, ALARM_DAILY, 0);
+    }
+}
+
+void CmdSetBaud(const command_arg_t *args, char *response) {
+    if (args[1].length && !(args[1].length == 4 && strncmp(args[1].word, "SAVE", 4) == 0)) {
+        UART0StringPutNonBlocking("Invalid Option: ");
+        UART0StringPutNonBlocking(command);
+        UART0StringPutNonBlocking("\r\nShould be SAVE\r\n");
+        return;
+    }
+    if (!UART0BaudValid(args[0].number)) {
+        UART0StringPutNonBlocking("Invalid Baud Rate: ");
+        UART0NumberPutNonBlocking(args[0].number);
+        UART0StringPutNonBlocking("\r\nShould between ");
+        UART0NumberPutNonBlocking(UART0_BAUD_MIN);
+        UART0StringPutNonBlocking(" and ");
+        UART0NumberPutNonBlocking(sys_clock_freq / 8);
+        UART0StringPutNonBlocking("\r\n");
+        return;
+    }
+    
+    uart0_baud_pending = args[0].number;
+    uart0_baud_save = (args[1].length != 0);
+    strcpy(response, "OK"); // sent at the old rate
+}
+
+void CmdAlarmAdd(const command_arg_t *args, char *response) {
+    uint8_t i, weekdays = 0;
+    uint32_t days = 0;
+    
+    if (args[1].length && !AlarmParseRepeat(args[1].word, args[1].length, &weekdays, &days)) {
+        UART0StringPutNonBlocking("Invalid Repeat: ");
+        UART0StringPutNonBlocking(command);
+        UART0StringPutNonBlocking("\r\nShould be ONCE, DAILY, WEEKDAYS, WEEKENDS or a list like MON,WED,15\r\n");
+        return;
+    }
+    for (i = 0; i < ALARM_COUNT && alarms[i].used; ++i);
+    if (i == ALARM_COUNT) {
+        UART0StringPutNonBlocking("Alarms Full: delete one with ALARM DEL\r\n");
+        return;
+    }
+    
+    AlarmSet(i, args[0].datetime.time, weekdays, days);
+    response[0] = (i >= 10) ? '0' + i / 10 : '0' + i;
+    response[1] = (i >= 10) ? '0' + i % 10 : '\0';
+    response[2] = '\0';
+}
+
+void CmdAlarmList(const command_arg_t *args, char *response) {
+    AlarmListPut();
+}
+
+void CmdAlarmDelete(const command_arg_t *args, char *response) {
+    if (args[0].number >= ALARM_COUNT || !alarms[args[0].number].used) {
+        UART0StringPutNonBlocking("Invalid Alarm: ");
+        UART0StringPutNonBlocking(command);
+        UART0StringPutNonBlocking("\r\nSee ALARM LIST\r\n");
+        return;
+    }
+    AlarmDelete(args[0].number);
+}
+
+void CmdAlarmSnooze(const command_arg_t *args, char *response) {
+    if (!AlarmSnooze()) {
+        strcpy(response, "Not Ringing");
+    }
+}
+
+void CmdDateDiff(const command_arg_t *args, char *response) {
+    // days from the first date to the second, today if omitted
+    int32_t to = args[1].length ? DaysFromCivil(args[1].datetime.year, args[1].datetime.month, args[1].datetime.day)
+        : datetime_day;
+    
+    StringifyNumber(to - DaysFromCivil(args[0].datetime.year, args[0].datetime.month, args[0].datetime.day), response);
+}
+
+void CmdSetZone(const command_arg_t *args, char *response) {
+    tz_rule_t rule;
+    
+    TzParse(args[0].word, args[0].length, &rule); // accepted by CmdSetZoneCheck
+    TzSet(&rule);
+}
+
+error_t CmdSetZoneCheck(const command_arg_t *args) {
+    tz_rule_t rule;
+    
+    if (!TzParse(args[0].word, args[0].length, &rule)) {
+        if (!command_quiet) {
+            UART0StringPutNonBlocking("Invalid Zone: ");
+            UART0StringPutNonBlocking(command);
+            UART0StringPutNonBlocking("\r\nShould be a POSIX TZ rule like CST-8 or EST5EDT,M3.2.0,M11.1.0/2\r\n");
+        }
+        return ERROR_FORMAT;
+    }
+    return ERROR_SUCCESS;
+}
+
+void CmdSetDisplay(const command_arg_t *args, char *response) {
+    if (args[0].length == 3 && strncmp(args[0].word, "UTC", 3) == 0) {
+        TzSetView(1);
+    } else if (args[0].length == 5 && strncmp(args[0].word, "LOCAL", 5) == 0) {
+        TzSetView(0);
+    } else {
+        display_off = (args[0].length == 3); // OFF or ON, accepted by CmdSetDisplayCheck
+        ROMStoreData();
+    }
+}
+
+error_t CmdSetDisplayCheck(const command_arg_t *args) {
+    if ((args[0].length == 3 && strncmp(args[0].word, "UTC", 3) == 0)
+        || (args[0].length == 5 && strncmp(args[0].word, "LOCAL", 5) == 0)
+        || (args[0].length == 3 && strncmp(args[0].word, "OFF", 3) == 0)
+        || (args[0].length == 2 && strncmp(args[0].word, "ON", 2) == 0)) {
         return ERROR_SUCCESS;
     }
+    if (!command_quiet) {
+        UART0StringPutNonBlocking("Invalid View: ");
+        UART0StringPutNonBlocking(command);
+        UART0StringPutNonBlocking("\r\nShould be UTC, LOCAL, ON or OFF\r\n");
+    }
+    return ERROR_FORMAT;
+}
+
+void CmdSetBrightness(const command_arg_t *args, char *response) {
+    display_brightness = args[0].number;
+    ROMStoreData();
+}
+
+error_t CmdSetBrightnessCheck(const command_arg_t *args) {
+    if (args[0].number < DISPLAY_BRIGHTNESS_MIN || args[0].number > 100) {
+        if (!command_quiet) {
+            UART0StringPutNonBlocking("Invalid Brightness: ");
+            UART0NumberPutNonBlocking(args[0].number);
+            UART0StringPutNonBlocking("\r\nShould between ");
+            UART0NumberPutNonBlocking(DISPLAY_BRIGHTNESS_MIN);
+            UART0StringPutNonBlocking(" and 100\r\n");
+        }
+        return ERROR_FORMAT;
+    }
+    return ERROR_SUCCESS;
+}
+
+void CmdSetDim(const command_arg_t *args, char *response) {
+    display_dim_level = args[0].number;
+    display_dim_start = args[1].datetime.time;
+    display_dim_end = args[2].datetime.time;
+    ROMStoreData();
+}
+
+error_t CmdSetDimCheck(const command_arg_t *args) {
+    if ((args[0].number && args[0].number < DISPLAY_BRIGHTNESS_MIN) || args[0].number > 100) {
+        if (!command_quiet) {
+            UART0StringPutNonBlocking("Invalid Brightness: ");
+            UART0NumberPutNonBlocking(args[0].number);
+            UART0StringPutNonBlocking("\r\nShould be 0 or between ");
+            UART0NumberPutNonBlocking(DISPLAY_BRIGHTNESS_MIN);
+            UART0StringPutNonBlocking(" and 100\r\n");
+        }
+        return ERROR_FORMAT;
+    }
+    return ERROR_SUCCESS;
+}
+
+void CmdSync(const command_arg_t *args, char *response) {
+    // Receive and transmit stamps, both for the last byte so the line lengths cancel out
+    uint16_t length;
     
-    return ERROR_NO_DELIM;
+    SyncStampPut(command_stamp, response);
+    length = strlen(response);
+    response[length++] = ' ';
+    response[length] = '\0';
+    length = length * 2 + 1; // the transmit stamp is as long as the receive stamp, then CRLF
+    length += (uart0_tx_head - uart0_tx_tail) & (UART0_TX_BUFFER_SIZE - 1); // sent before it
+    SyncStampPut(RTCTicks() + (uint64_t)length * 10 * RTC_SUBSECONDS / uart0_baud, response + strlen(response));
 }
 
-void StringifyDate(uint16_t year, uint8_t month, uint8_t day, char *buffer) {
-    buffer[0] = year / 1000 % 10 + '0';
-    buffer[1] = year / 100 % 10 + '0';
-    buffer[2] = year / 10 % 10 + '0';
-    buffer[3] = year % 10 + '0';
-    buffer[4] = '/';
-    buffer[5] = month / 10 % 10 + '0';
-    buffer[6] = month % 10 + '0';
-    buffer[7] = '/';
-    buffer[8] = month / 10 % 10 + '0';
-    buffer[9] = month % 10 + '0';
-    buffer[10] = '\r';
-    buffer[11] = '\n';
-    buffer[12] = '\0';
+void CmdSyncAdjust(const command_arg_t *args, char *response) {
+    int64_t offset, delay;
+    
+    if (!SyncParseMicros(args[0].word, args[0].length, &offset)
+        || !SyncParseMicros(args[1].word, args[1].length, &delay) || delay < 0) {
+        UART0StringPutNonBlocking("Invalid Offset: ");
+        UART0StringPutNonBlocking(command);
+        UART0StringPutNonBlocking("\r\nShould be the offset and the round trip delay in microseconds\r\n");
+        return;
+    }
+    if (delay > SYNC_DELAY_MAX_US) {
+        ++sync_rejected;
+        strcpy(response, "REJECTED"); // the path was too slow for the offset to mean much
+        return;
+    }
+    
+    SyncApply(offset, delay);
+    strcpy(response, sync_stepped ? "STEP" : "SLEW");
 }
 
-void StringifyTime(uint32_t time, char *buffer) {
-    uint8_t hour = time / 3600, min = time / 60 % 60, sec = time % 60;
+void CmdSubscribe(const command_arg_t *args, char *response) {
+    uint8_t topics;
     
-    buffer[0] = hour / 10 % 10 + '0';
-    buffer[1] = hour % 10 + '0';
-    buffer[2] = ':';
-    buffer[3] = min / 10 % 10 + '0';
-    buffer[4] = min % 10 + '0';
-    buffer[5] = ':';
-    buffer[6] = sec / 10 % 10 + '0';
-    buffer[7] = sec % 10 + '0';
-    buffer[8] = '\r';
-    buffer[9] = '\n';
-    buffer[10] = '\0';
+    SubscribeParseTopics(args[0].word, args[0].length, &topics); // accepted by CmdSubscribeCheck
+    if (args[1].length) {
+        subscribe_rate = args[1].number;
+    }
+    RTCRefresh();
+    subscribe_tick_slot = epoch_seconds / subscribe_rate; // first tick at the next boundary
+    subscribe_mode = mode;
+    subscribe_topics |= topics;
+    strcpy(response, "OK"); // events follow
 }
 
-char ToUpperCase(char x) {
-    if (x >= 'a' && x <= 'z') {
-        return x - 'a' + 'A';
+void CmdUnsubscribe(const command_arg_t *args, char *response) {
+    uint8_t topics = SUBSCRIBE_ALL;
+    
+    if (args[0].length) {
+        SubscribeParseTopics(args[0].word, args[0].length, &topics); // accepted by CmdUnsubscribeCheck
+    }
+    subscribe_topics &= ~topics;
+    subscribe_pending &= ~topics;
+    if (topics & SUBSCRIBE_ALARM) {
+        subscribe_alarm_pending = 0;
+    }
+    strcpy(response, "OK"); // no event follows
+}
+
+error_t CmdSubscribeCheck(const command_arg_t *args) {
+    if (CmdUnsubscribeCheck(args) != ERROR_SUCCESS) {
+        return ERROR_FORMAT;
+    }
+    if (args[1].length && (args[1].number < 1 || args[1].number > SUBSCRIBE_RATE_MAX)) {
+        if (!command_quiet) {
+            UART0StringPutNonBlocking("Invalid Rate: ");
+            UART0NumberPutNonBlocking(args[1].number);
+            UART0StringPutNonBlocking("\r\nShould between 1 and ");
+            UART0NumberPutNonBlocking(SUBSCRIBE_RATE_MAX);
+            UART0StringPutNonBlocking("\r\n");
+        }
+        return ERROR_FORMAT;
+    }
+    return ERROR_SUCCESS;
+}
+
+error_t CmdUnsubscribeCheck(const command_arg_t *args) {
+    uint8_t topics;
+    
+    if (args[0].length && !SubscribeParseTopics(args[0].word, args[0].length, &topics)) {
+        if (!command_quiet) {
+            UART0StringPutNonBlocking("Invalid Topic: ");
+            UART0StringPutNonBlocking(command);
+            UART0StringPutNonBlocking("\r\nShould be ALL or a list like TICK,ALARM,TIME,MODE\r\n");
+        }
+        return ERROR_FORMAT;
+    }
+    return ERROR_SUCCESS;
+}
+
+void CmdStats(const command_arg_t *args, char *response) {
+    PerfStatsPut();
+}
+
+void CmdStatsReset(const command_arg_t *args, char *response) {
+    PerfReset();
+    strcpy(response, "OK");
+}
+
+void CmdModeBinary(const command_arg_t *args, char *response) {
+    strcpy(response, "OK"); // last text sent before the first frame
+    uart0_binary = 1;
+}
+
+void ProcessFrame(void) {
+    // A frame is opcode, payload and CRC-16 little endian, COBS encoded so 0x00 only ends it.
+    // The response repeats the opcode with FRAME_RESPONSE set, then status and payload.
+    uint8_t frame[UART0_RX_LINE_SIZE];
+    uint8_t response[2 + FRAME_MAX_PAYLOAD];
+    uint8_t i, length, payload = 0, status;
+    
+    length = strlen(command);
+    if (length == 0) {
+        return; // empty frame, sent by the host to resynchronize
+    }
+    
+    length = CobsDecode((const uint8_t *)command, length, frame);
+    if (length < 3 || Crc16(frame, length - 2) != FrameGet16(frame + length - 2)) {
+        FrameStatusPut(0, FRAME_BAD_CRC);
+        return;
+    }
+    length -= 3; // request payload
+    UART0BaudConfirm();
+    
+    status = FRAME_UNKNOWN;
+    for (i = 0; i < FRAME_COUNT; ++i) {
+        if (frame_table[i].opcode == frame[0]) {
+            if (frame_table[i].length != length) {
+                status = FRAME_BAD_LENGTH;
+            } else {
+                status = frame_table[i].handler(frame + 1, response + 2, &payload);
+            }
+            break;
+        }
+    }
+    
+    response[0] = frame[0] | FRAME_RESPONSE;
+    response[1] = status;
+    UART0FramePut(response, 2 + (status == FRAME_OK ? payload : 0));
+}
+
+void FrameStatusPut(uint8_t opcode, uint8_t status) {
+    uint8_t response[2];
+    
+    response[0] = opcode | FRAME_RESPONSE;
+    response[1] = status;
+    UART0FramePut(response, 2);
+}
+
+uint8_t FrameGetDate(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    FramePut16(response, datetime.year);
+    response[2] = datetime.month;
+    response[3] = datetime.day;
+    *length = 4;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetTime(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    FramePut32(response, datetime.time);
+    FramePut16(response + 4, GetSubsecondTicks());
+    *length = 6;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetDatetime(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    FrameGetDate(request, response, length);
+    FrameGetTime(request, response + 4, length);
+    *length = 10;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetAlarm(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    FramePut32(response, alarms[0].used ? alarms[0].time : ALARM_NEVER);
+    *length = 4;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetI2C(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    // same counters as GET I2C, in the same order
+    response[0] = I2C0QueueDepth();
+    response[1] = i2c0_stats.max_depth;
+    FramePut32(response + 2, i2c0_stats.overflows);
+    FramePut32(response + 6, i2c0_stats.transactions);
+    FramePut32(response + 10, i2c0_stats.latency_last);
+    FramePut32(response + 14, i2c0_stats.transactions ? i2c0_stats.latency_total / i2c0_stats.transactions : 0);
+    FramePut32(response + 18, i2c0_stats.latency_max);
+    FramePut32(response + 22, i2c0_stats.nak_errors);
+    FramePut32(response + 26, i2c0_stats.arb_errors);
+    FramePut32(response + 30, i2c0_stats.timeout_errors);
+    FramePut32(response + 34, i2c0_stats.shadow_issued);
+    FramePut32(response + 38, i2c0_stats.shadow_elided);
+    response[42] = i2c0_stats.display_frame_transactions;
+    *length = 43;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetUart(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    // same counters as GET UART, in the same order
+    FramePut16(response, (uart0_tx_head - uart0_tx_tail) & (UART0_TX_BUFFER_SIZE - 1));
+    FramePut16(response + 2, uart0_tx_high_water);
+    FramePut32(response + 4, uart0_tx_dropped);
+    response[8] = (uart0_rx_head - uart0_rx_tail) & (UART0_RX_LINES - 1);
+    FramePut32(response + 9, uart0_rx_dropped);
+    FramePut32(response + 13, uart0_rx_overlong);
+    FramePut32(response + 17, uart0_baud);
+    FramePut32(response + 21, uart0_baud_fallbacks);
+    *length = 25;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetPower(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    // same counters as GET POWER, in ms, the times as 64-bit so they survive the 49.7 day wrap
+    uint64_t uptime = GetUptimeMillis(), sleep = power_sleep_us / 1000;
+    
+    FramePut32(response, (uint32_t)uptime);
+    FramePut32(response + 4, (uint32_t)(uptime >> 32));
+    FramePut32(response + 8, (uint32_t)sleep);
+    FramePut32(response + 12, (uint32_t)(sleep >> 32));
+    FramePut32(response + 16, power_wakeups);
+    FramePut32(response + 20, systick_interrupts);
+    *length = 24;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetRom(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    // same counters as GET ROM
+    response[0] = ROM_SLOTS;
+    response[1] = rom_head;
+    FramePut32(response + 2, rom_valid ? rom_record.sequence : 0);
+    FramePut32(response + 6, rom_requests);
+    FramePut32(response + 10, rom_commits);
+    FramePut32(response + 14, rom_elided);
+    FramePut32(response + 18, rom_errors);
+    response[22] = rom_dirty;
+    *length = 23;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetEpoch(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    uint16_t ms = GetSubsecondTicks();
+    
+    FramePut32(response, (uint32_t)epoch_seconds);
+    FramePut32(response + 4, (uint32_t)((uint64_t)epoch_seconds >> 32));
+    FramePut16(response + 8, ms);
+    *length = 10;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetCalendar(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    response[0] = GetDayOfWeek(datetime_day);
+    FramePut16(response + 1, GetDayOfYear(datetime.year, datetime.month, datetime.day));
+    FramePut32(response + 3, (uint32_t)datetime_day);
+    *length = 7;
+    return FRAME_OK;
+}
+
+uint8_t FrameGetZone(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    RTCRefresh();
+    FramePut32(response, (uint32_t)tz_rule.std_offset);
+    FramePut32(response + 4, (uint32_t)tz_rule.dst_offset);
+    FramePut32(response + 8, tz_rule.start);
+    FramePut32(response + 12, tz_rule.end);
+    FramePut32(response + 16, (uint32_t)tz_offset);
+    response[20] = tz_view_utc;
+    FramePut32(response + 21, (uint32_t)tz_next);
+    FramePut32(response + 25, (uint32_t)((uint64_t)tz_next >> 32));
+    *length = 29;
+    return FRAME_OK;
+}
+
+uint8_t FrameSetDate(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    command_arg_t arg;
+    
+    arg.datetime.year = FrameGet16(request);
+    arg.datetime.month = request[2];
+    arg.datetime.day = request[3];
+    if (!DateValid(arg.datetime.year, arg.datetime.month, arg.datetime.day)) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    CmdSetDate(&arg, (char *)response);
+    return FRAME_OK;
+}
+
+uint8_t FrameSetTime(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    command_arg_t arg;
+    
+    arg.datetime.time = FrameGet32(request);
+    if (arg.datetime.time >= 86400) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    CmdSetTime(&arg, (char *)response);
+    return FRAME_OK;
+}
+
+uint8_t FrameSetAlarm(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    command_arg_t arg;
+    
+    arg.datetime.time = FrameGet32(request);
+    if (arg.datetime.time >= 86400) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    CmdSetAlarm(&arg, (char *)response);
+    return FRAME_OK;
+}
+
+uint8_t FrameSetBaud(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    uint32_t rate = FrameGet32(request);
+    
+    if (!UART0BaudValid(rate) || request[4] > 1) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    uart0_baud_pending = rate;
+    uart0_baud_save = request[4];
+    return FRAME_OK;
+}
+
+uint8_t FrameSetZone(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    // numeric offsets and packed rules of tz_rule_t, the zone names print as offsets
+    tz_rule_t rule;
+    
+    memset(&rule, 0, sizeof(rule));
+    rule.std_offset = (int32_t)FrameGet32(request);
+    rule.dst_offset = (int32_t)FrameGet32(request + 4);
+    rule.start = FrameGet32(request + 8);
+    rule.end = FrameGet32(request + 12);
+    if (rule.std_offset < -TZ_MAX_OFFSET || rule.std_offset > TZ_MAX_OFFSET) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    if (!rule.start) {
+        rule.dst_offset = rule.std_offset;
+        rule.end = 0;
+    } else if (rule.dst_offset < -TZ_MAX_OFFSET || rule.dst_offset > TZ_MAX_OFFSET
+        || !TzRuleValid(rule.start) || !TzRuleValid(rule.end)) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    TzSet(&rule);
+    return FRAME_OK;
+}
+
+uint8_t FrameSetDisplay(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    // 0 LOCAL, 1 UTC, 2 OFF, 3 ON
+    if (request[0] > 3) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    if (request[0] <= 1) {
+        TzSetView(request[0]);
+    } else {
+        display_off = (request[0] == 2);
+        ROMStoreData();
+    }
+    return FRAME_OK;
+}
+
+uint8_t FrameSetBrightness(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    if (request[0] < DISPLAY_BRIGHTNESS_MIN || request[0] > 100) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    display_brightness = request[0];
+    ROMStoreData();
+    return FRAME_OK;
+}
+
+uint8_t FrameSetDim(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    uint32_t start = FrameGet32(request + 1);
+    uint32_t end = FrameGet32(request + 5);
+    
+    if ((request[0] && request[0] < DISPLAY_BRIGHTNESS_MIN) || request[0] > 100 || start >= 86400 || end >= 86400) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    display_dim_level = request[0];
+    display_dim_start = start;
+    display_dim_end = end;
+    ROMStoreData();
+    return FRAME_OK;
+}
+
+uint8_t FrameMute(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    CmdMute(NULL, (char *)response);
+    return FRAME_OK;
+}
+
+uint8_t FrameClockInit(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    CmdClockInit(NULL, (char *)response);
+    return FRAME_OK;
+}
+
+uint8_t FrameClockRestart(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    CmdClockRestart(NULL, (char *)response);
+    return FRAME_OK;
+}
+
+uint8_t FrameClockHib(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    CmdClockHib(NULL, (char *)response);
+    return FRAME_OK;
+}
+
+uint8_t FrameAlarmGet(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    const alarm_t *alarm;
+    
+    if (request[0] >= ALARM_COUNT) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    alarm = &alarms[request[0]];
+    
+    RTCRefresh();
+    response[0] = alarm->used | ((alarm_ringing == request[0]) << 1);
+    FramePut32(response + 1, alarm->time);
+    response[5] = alarm->weekdays;
+    FramePut32(response + 6, alarm->days);
+    FramePut32(response + 10, (alarm->used && alarm->due != ALARM_NEVER) ? alarm->due - rtc_seconds : ALARM_NEVER);
+    response[14] = alarm->snoozes;
+    *length = 15;
+    return FRAME_OK;
+}
+
+uint8_t FrameAlarmAdd(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    uint32_t time = FrameGet32(request);
+    uint32_t days = FrameGet32(request + 5);
+    uint8_t i;
+    
+    if (time >= 86400 || request[4] > ALARM_DAILY || (days & 0x01)) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    for (i = 0; i < ALARM_COUNT && alarms[i].used; ++i);
+    if (i == ALARM_COUNT) {
+        return FRAME_BAD_ARGUMENT; // no free slot
+    }
+    
+    AlarmSet(i, time, request[4], days);
+    response[0] = i;
+    *length = 1;
+    return FRAME_OK;
+}
+
+uint8_t FrameAlarmDelete(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    if (request[0] >= ALARM_COUNT || !alarms[request[0]].used) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    AlarmDelete(request[0]);
+    return FRAME_OK;
+}
+
+uint8_t FrameAlarmSnooze(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    return AlarmSnooze() ? FRAME_OK : FRAME_BAD_ARGUMENT;
+}
+
+uint8_t FrameDateDiff(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    uint16_t from_year = FrameGet16(request), to_year = FrameGet16(request + 4);
+    
+    if (!DateValid(from_year, request[2], request[3]) || !DateValid(to_year, request[6], request[7])) {
+        return FRAME_BAD_ARGUMENT;
+    }
+    
+    FramePut32(response, (uint32_t)(DaysFromCivil(to_year, request[6], request[7])
+        - DaysFromCivil(from_year, request[2], request[3])));
+    *length = 4;
+    return FRAME_OK;
+}
+
+uint8_t FrameText(const uint8_t *request, uint8_t *response, uint8_t *length) {
+    uart0_binary = 0; // the response is still a frame, text lines after it
+    return FRAME_OK;
+}
+
+void FramePut16(uint8_t *buffer, uint16_t value) {
+    buffer[0] = value & 0xff;
+    buffer[1] = value >> 8;
+}
+
+void FramePut32(uint8_t *buffer, uint32_t value) {
+    FramePut16(buffer, value & 0xffff);
+    FramePut16(buffer + 2, value >> 16);
+}
+
+uint16_t FrameGet16(const uint8_t *buffer) {
+    return buffer[0] | ((uint16_t)buffer[1] << 8);
+}
+
+uint32_t FrameGet32(const uint8_t *buffer) {
+    return FrameGet16(buffer) | ((uint32_t)FrameGet16(buffer + 2) << 16);
+}
+
+uint8_t CobsEncode(const uint8_t *src, uint8_t length, uint8_t *dst) {
+    // Each code byte tells the distance to the next zero, dst needs length + length / 254 + 1 bytes
+    uint8_t i, code = 1, code_index = 0, out = 1;
+    
+    for (i = 0; i < length; ++i) {
+        if (src[i] != 0) {
+            dst[out++] = src[i];
+            ++code;
+        }
+        if (src[i] == 0 || code == 0xff) {
+            dst[code_index] = code;
+            code_index = out++;
+            code = 1;
+        }
+    }
+    dst[code_index] = code;
+    
+    return out;
+}
+
+uint8_t CobsDecode(const uint8_t *src, uint8_t length, uint8_t *dst) {
+    // Returns decoded length, 0 if a code byte points past the end
+    uint8_t i = 0, j, code, out = 0;
+    
+    while (i < length) {
+        code = src[i++];
+        for (j = 1; j < code; ++j) {
+            if (i >= length) {
+                return 0;
+            }
+            dst[out++] = src[i++];
+        }
+        if (code != 0xff && i < length) {
+            dst[out++] = 0;
+        }
+    }
+    
+    return out;
+}
+
+uint16_t Crc16(const uint8_t *data, uint16_t length) {
+    // CRC-16/CCITT-FALSE, polynomial 0x1021, initial 0xffff
+    uint16_t crc = 0xffff;
+    uint8_t i;
+    
+    while (length--) {
+        crc ^= (uint16_t)(*(data++)) << 8;
+        for (i = 0; i < 8; ++i) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    
+    return crc;
+}
+
+error_t ParseIntegerUntil(const char *str, char delim, uint8_t *index, uint32_t *result) {
+    uint8_t digits = 0;
+    
+    *result = 0;
+    while (str[*index] && str[*index] != delim) {
+        if (str[*index] >= '0' && str[*index] <= '9') {
+            // a value that does not fit must not wrap around into a valid one
+            if (++digits > 10 || *result > (UINT32_MAX - (uint32_t)(str[*index] - '0')) / 10) {
+                return ERROR_FORMAT;
+            }
+            *result = *result * 10 + str[*index] - '0';
+            ++*index;
+        } else {
+            return ERROR_NOT_DIGIT;
+        }
+    }
+    
+    // string ends with delim
+    if (str[*index] == delim) {
+        ++*index; // skip delim
+        return ERROR_SUCCESS;
+    }
+    
+    return ERROR_NO_DELIM;
+}
+
+void StringifyDate(uint16_t year, uint8_t month, uint8_t day, char *buffer) {
+    buffer[0] = year / 1000 % 10 + '0';
+    buffer[1] = year / 100 % 10 + '0';
+    buffer[2] = year / 10 % 10 + '0';
+    buffer[3] = year % 10 + '0';
+    buffer[4] = '/';
+    buffer[5] = month / 10 % 10 + '0';
+    buffer[6] = month % 10 + '0';
+    buffer[7] = '/';
+    buffer[8] = day / 10 % 10 + '0';
+    buffer[9] = day % 10 + '0';
+    buffer[10] = '\0';
+}
+
+void StringifyTime(uint32_t time, char *buffer) {
+    uint8_t hour = time / 3600, min = time / 60 % 60, sec = time % 60;
+    
+    buffer[0] = hour / 10 % 10 + '0';
+    buffer[1] = hour % 10 + '0';
+    buffer[2] = ':';
+    buffer[3] = min / 10 % 10 + '0';
+    buffer[4] = min % 10 + '0';
+    buffer[5] = ':';
+    buffer[6] = sec / 10 % 10 + '0';
+    buffer[7] = sec % 10 + '0';
+    buffer[8] = '\0';
+}
+
+void StringifyNumber(int64_t data, char *buffer) {
+    // buffer holds at least 21 chars
+    char digits[20];
+    uint64_t value = (data < 0) ? -(uint64_t)data : (uint64_t)data;
+    uint8_t count = 0;
+    
+    do {
+        digits[count++] = value % 10 + '0';
+        value /= 10;
+    } while (value);
+    
+    if (data < 0) {
+        *buffer++ = '-';
+    }
+    while (count) {
+        *buffer++ = digits[--count];
+    }
+    *buffer = '\0';
+}
+
+void StringifyOffset(int32_t seconds, char *buffer) {
+    // +hh:mm, or +hh:mm:ss if not whole minutes
+    uint32_t value = (seconds < 0) ? -seconds : seconds;
+    
+    buffer[0] = (seconds < 0) ? '-' : '+';
+    StringifyTime(value, buffer + 1);
+    if (value % 60 == 0) {
+        buffer[6] = '\0';
+    }
+}
+
+char ToUpperCase(char x) {
+    if (x >= 'a' && x <= 'z') {
+        return x - 'a' + 'A';
+    }
+    return x;
+}
+
+
+uint8_t IsLeapYear(uint16_t year) {
+    return (year % 4 == 0) & ((year % 100 != 0) | (year % 400 == 0));
+}
+
+uint8_t GetDayOfMonth(uint16_t year, uint8_t month) {
+    return calendar_month_days[month - 1] + (month == 2 && IsLeapYear(year)); // month is 1-base
+}
+
+uint16_t GetDayOfYear(uint16_t year, uint8_t month, uint8_t day) {
+    // 1 for January 1st
+    return calendar_year_days[month - 1] + day + (month > 2 && IsLeapYear(year));
+}
+
+uint8_t GetDayOfWeek(int32_t days) {
+    // 0 is Sunday, shifted by whole eras so the dividend is never negative
+    return (uint32_t)(days + CALENDAR_ERA_DAYS * 5 + CALENDAR_EPOCH_WEEKDAY) % 7;
+}
+
+int32_t DaysFromCivil(uint16_t year, uint8_t month, uint8_t day) {
+    // Days since 1970/01/01, Hinnant's algorithm on years starting in March so the leap day comes last
+    int32_t y = (int32_t)year - (month <= 2);
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t year_of_era = y - era * 400;
+    uint32_t day_of_year = calendar_march_days[(month + 9) % 12] + day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    
+    return era * CALENDAR_ERA_DAYS + (int32_t)day_of_era - CALENDAR_EPOCH_SHIFT;
+}
+
+void CivilFromDays(int32_t days, datetime_t *date) {
+    // Inverse of DaysFromCivil, date->time is left as is
+    int32_t z = days + CALENDAR_EPOCH_SHIFT;
+    int32_t era = (z >= 0 ? z : z - (CALENDAR_ERA_DAYS - 1)) / CALENDAR_ERA_DAYS;
+    uint32_t day_of_era = z - era * CALENDAR_ERA_DAYS;
+    uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint32_t march_month = (5 * day_of_year + 2) / 153; // 0 is March
+    
+    date->day = day_of_year - calendar_march_days[march_month] + 1;
+    date->month = march_month < 10 ? march_month + 3 : march_month - 9;
+    date->year = year_of_era + era * 400 + (date->month <= 2);
+}
+
+uint8_t DateValid(uint16_t year, uint8_t month, uint8_t day) {
+    return year <= 9999 && month >= 1 && month <= 12 && day >= 1 && day <= GetDayOfMonth(year, month);
+}
+
+int32_t EpochDay(int64_t seconds) {
+    // floor division, shifted by whole eras so seconds before 1970 round down too
+    return (int32_t)((seconds + (int64_t)CALENDAR_ERA_DAYS * 5 * 86400) / 86400) - CALENDAR_ERA_DAYS * 5;
+}
+
+void EpochCivil(int64_t seconds, datetime_t *date) {
+    int32_t day = EpochDay(seconds);
+    
+    CivilFromDays(day, date);
+    date->time = (uint32_t)(seconds - (int64_t)day * 86400);
+}
+
+void ClearSystickCounter(void) {
+    systick_20ms_counter = 0;
+    systick_250ms_counter = 0;
+    systick_500ms_counter = 0;
+    EventFlush(); // ticks of the old phase
+    
+    // do not clear 1s counter, treat it as ms counter
+    // systick_1s_counter = 0;
+}
+
+uint32_t GetMicros(void) {
+    uint32_t ms, elapsed;
+    
+    do { // retry if systick fires while sampling
+        ms = systick_ms;
+        elapsed = SystickElapsedMicros();
+    } while (ms != systick_ms);
+    
+    return ms * 1000 + elapsed;
+}
+
+uint32_t GetMillis(void) {
+    // systick_ms with the running period, which is longer than 1ms while the keypad is idle
+    uint32_t ms, elapsed;
+    
+    do { // retry if systick fires while sampling
+        ms = systick_ms;
+        elapsed = SystickElapsedMicros();
+    } while (ms != systick_ms);
+    
+    return ms + elapsed / 1000;
+}
+
+uint64_t GetUptimeMillis(void) {
+    // 64-bit systick_ms for statistics that outlive its wrap
+    uint32_t ms, wraps;
+    
+    do { // retry if systick fires while sampling
+        wraps = systick_ms_wraps;
+        ms = systick_ms;
+    } while (wraps != systick_ms_wraps);
+    
+    return ((uint64_t)wraps << 32) | ms;
+}
+
+uint32_t SystickElapsedMicros(void) {
+    // Time since systick_ms was last advanced, the running period is systick_step ms long.
+    // Called from a handler or with interrupts masked, the counter may already have wrapped
+    // into the next period with the interrupt still pending and systick_ms not advanced yet.
+    uint32_t pending, value;
+    
+    do { // a wrap between the two reads changes the period the value belongs to
+        pending = HWREG(NVIC_INT_CTRL) & NVIC_INT_CTRL_PEND_SYST;
+        value = SysTickValueGet();
+    } while (pending != (HWREG(NVIC_INT_CTRL) & NVIC_INT_CTRL_PEND_SYST));
+    
+    if (pending) { // the ended period, then the one reloaded at the wrap
+        return systick_step * (1000000 / SYSTICK_FREQUENCY)
+            + (systick_next_step * (sys_clock_freq / SYSTICK_FREQUENCY) - 1 - value) / (sys_clock_freq / 1000000);
+    }
+    return (systick_step * (sys_clock_freq / SYSTICK_FREQUENCY) - 1 - value) / (sys_clock_freq / 1000000); // counts down
+}
+
+uint16_t SystickNextStep(uint16_t running) {
+    // ms from the end of the running period to the earliest counter deadline
+    uint16_t step = SYSTICK_MAX_RELOAD / (sys_clock_freq / SYSTICK_FREQUENCY);
+    
+    if (!KEY_INTERRUPT || key_active) { // the keypad needs its 20ms tick only while a key is active
+        step = MIN(step, SYSTICK_FREQUENCY / 50 - (systick_20ms_counter + running) % (SYSTICK_FREQUENCY / 50));
+    }
+    step = MIN(step, SYSTICK_FREQUENCY / 4 - (systick_250ms_counter + running) % (SYSTICK_FREQUENCY / 4));
+    step = MIN(step, SYSTICK_FREQUENCY / 2 - (systick_500ms_counter + running) % (SYSTICK_FREQUENCY / 2));
+    step = MIN(step, SYSTICK_FREQUENCY - (systick_1s_counter + running) % SYSTICK_FREQUENCY);
+    
+    return step;
+}
+
+uint8_t MainLoopPending(void) {
+    // everything the main loop reacts to, posted by an interrupt handler or left by AlarmProgram
+    return event_tail != event_head || alarm_match_flag || uart0_rx_tail != uart0_rx_head;
+}
+
+void PowerInit(void) {
+    // Keep clocks in sleep only for peripherals that work or wake the core while it sleeps:
+    // UART0 and its pins, I2C0 and its pins for the display scan, Timer0 and the hibernate RTC.
+    // The LEDs and buttons on GPIOF/J/N are only touched by the main loop and hold their state
+    // gated, the buzzer (PWM0 and PF3) keeps its clocks only while it sounds.
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_GPIOA);
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_GPIOB);
+#if KEY_INTERRUPT
+    SysCtlPeripheralSleepEnable(KEY_INT_PERIPH); // its edge wakes the core
+#endif
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_UART0);
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_I2C0);
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_TIMER0);
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_HIBERNATE);
+    SysCtlPeripheralClockGating(true);
+}
+
+void PowerIdle(void) {
+#if POWER_SLEEP
+    uint32_t start = 0;
+    uint8_t slept = 0;
+    
+    // Check and sleep with interrupts masked, WFI still wakes on a pending interrupt,
+    // so work posted after the check cannot be missed. Display scan wakeups post no work.
+    IntMasterDisable();
+    while (!MainLoopPending()) {
+        if (!slept) {
+            start = GetMicros();
+            slept = 1;
+        }
+        SysCtlSleep();
+        ++power_wakeups;
+        IntMasterEnable(); // run the handler that woke us
+        IntMasterDisable();
+    }
+    IntMasterEnable();
+    
+    if (slept) {
+        power_sleep_us += GetMicros() - start;
+    }
+#endif
+}
+
+void PowerStatsPut(void) {
+    uint64_t uptime = GetUptimeMillis();
+    uint64_t sleep = power_sleep_us / 1000;
+    uint32_t permille = uptime ? (uint32_t)MIN(sleep * 1000 / uptime, 1000) : 0;
+    char buffer[9];
+    
+    UART0StringPutNonBlocking("Uptime(ms): ");
+    UART0NumberPutNonBlocking(uptime);
+    UART0StringPutNonBlocking(" Sleep(ms): ");
+    UART0NumberPutNonBlocking(sleep);
+    UART0StringPutNonBlocking("\r\nDuty: Sleep ");
+    UART0NumberPutNonBlocking(permille / 10);
+    UART0StringPutNonBlocking(".");
+    UART0NumberPutNonBlocking(permille % 10);
+    UART0StringPutNonBlocking("% Active ");
+    UART0NumberPutNonBlocking((1000 - permille) / 10);
+    UART0StringPutNonBlocking(".");
+    UART0NumberPutNonBlocking((1000 - permille) % 10);
+    UART0StringPutNonBlocking("%\r\nWakeups: ");
+    UART0NumberPutNonBlocking(power_wakeups);
+    UART0StringPutNonBlocking(" SysTick Interrupts: ");
+    UART0NumberPutNonBlocking(systick_interrupts);
+    UART0StringPutNonBlocking(SYSTICK_DYNAMIC ? " (dynamic tick)\r\n" : " (1ms tick)\r\n");
+    UART0StringPutNonBlocking("Display: Duty ");
+    UART0NumberPutNonBlocking(display_duty);
+    UART0StringPutNonBlocking(display_off ? "% (off) Brightness " : "% Brightness ");
+    UART0NumberPutNonBlocking(display_brightness);
+    if (display_dim_start == display_dim_end) {
+        UART0StringPutNonBlocking("% Dim Off\r\n");
+        return;
+    }
+    UART0StringPutNonBlocking("% Dim ");
+    UART0NumberPutNonBlocking(display_dim_level);
+    UART0StringPutNonBlocking("% ");
+    StringifyTime(display_dim_start, buffer);
+    UART0StringPutNonBlocking(buffer);
+    UART0StringPutNonBlocking("-");
+    StringifyTime(display_dim_end, buffer);
+    UART0StringPutNonBlocking(buffer);
+    UART0StringPutNonBlocking("\r\n");
+}
+
+void PerfInit(void) {
+    // the cycle counter runs once trace is enabled, it wraps every 214s at 20MHz
+    HWREG(CORE_DEMCR) |= CORE_DEMCR_TRCENA;
+    HWREG(DWT_CYCCNT) = 0;
+    HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+    perf_bin_cycles = sys_clock_freq / 1000000 * PERF_BIN_FIRST_US;
+    PerfReset();
+}
+
+uint32_t PerfStart(void) {
+#if PERF_ENABLE
+    return HWREG(DWT_CYCCNT);
+#else
+    return 0;
+#endif
+}
+
+void PerfRecord(uint8_t stage, uint32_t start) {
+#if PERF_ENABLE
+    perf_stage_t *perf = &perf_stages[stage];
+    uint32_t cycles = HWREG(DWT_CYCCNT) - start; // modulo 2^32, stages are far shorter than a wrap
+    uint32_t limit = perf_bin_cycles;
+    uint8_t bin = 0;
+    
+    while (bin < PERF_BINS - 1 && cycles >= limit) {
+        ++bin;
+        limit <<= 2;
+    }
+    
+    ++perf->count;
+    perf->total += cycles;
+    perf->min = MIN(perf->min, cycles);
+    perf->max = MAX(perf->max, cycles);
+    ++perf->histogram[bin];
+#endif
+}
+
+void PerfReset(void) {
+    // the scan stage is recorded by TIMER0A_Handler, the event statistics by EventPost
+    bool masked = IntMasterDisable();
+    uint8_t i;
+    
+    memset(perf_stages, 0, sizeof(perf_stages));
+    for (i = 0; i < PERF_STAGE_COUNT; ++i) {
+        perf_stages[i].min = 0xffffffff;
+    }
+    memset(event_stats, 0, sizeof(event_stats));
+    event_high_water = (event_head - event_tail) & (EVENT_QUEUE_SIZE - 1);
+    uart0_rx_bytes = uart0_tx_bytes = 0;
+    perf_reset_ms = systick_ms;
+    
+    if (!masked) IntMasterEnable();
+}
+
+void PerfStatsPut(void) {
+    // times in us, one line per stage, then the histogram as counts per bin
+    uint32_t cycles_per_us = sys_clock_freq / 1000000;
+    uint32_t elapsed = systick_ms - perf_reset_ms;
+    uint32_t load = elapsed ? (uint32_t)(perf_stages[PERF_STAGE_LOOP].total / cycles_per_us / elapsed) : 0; // permille
+    const perf_stage_t *perf;
+    uint8_t i, bin;
+    
+    UART0StringPutNonBlocking("Stage(us): Count Min Avg Max | <16 <64 <256 <1m <4m <16m <64m More\r\n");
+    for (i = 0; i < PERF_STAGE_COUNT; ++i) {
+        perf = &perf_stages[i];
+        UART0StringPutNonBlocking(perf_stage_names[i]);
+        UART0StringPutNonBlocking(": ");
+        UART0NumberPutNonBlocking(perf->count);
+        UART0StringPutNonBlocking(" ");
+        UART0NumberPutNonBlocking(perf->count ? perf->min / cycles_per_us : 0);
+        UART0StringPutNonBlocking(" ");
+        UART0NumberPutNonBlocking(perf->count ? (uint32_t)(perf->total / perf->count / cycles_per_us) : 0);
+        UART0StringPutNonBlocking(" ");
+        UART0NumberPutNonBlocking(perf->max / cycles_per_us);
+        UART0StringPutNonBlocking(" |");
+        for (bin = 0; bin < PERF_BINS; ++bin) {
+            UART0StringPutNonBlocking(" ");
+            UART0NumberPutNonBlocking(perf->histogram[bin]);
+        }
+        UART0StringPutNonBlocking("\r\n");
+    }
+    
+    EventStatsPut();
+    UART0StringPutNonBlocking("UART Bytes: In ");
+    UART0NumberPutNonBlocking(uart0_rx_bytes);
+    UART0StringPutNonBlocking(" Out ");
+    UART0NumberPutNonBlocking(uart0_tx_bytes);
+    UART0StringPutNonBlocking("\r\nLoad: ");
+    UART0NumberPutNonBlocking(load / 10);
+    UART0StringPutNonBlocking(".");
+    UART0NumberPutNonBlocking(load % 10);
+    UART0StringPutNonBlocking("% of ");
+    UART0NumberPutNonBlocking(elapsed);
+    UART0StringPutNonBlocking("ms since reset\r\n");
+}
+
+void EventPost(uint8_t type, uint8_t data) {
+    // Called by interrupt handlers only. A pending event of the same type absorbs the new one,
+    // except the oldest, which the main loop may be copying out right now.
+    event_stats_t *stats = &event_stats[type];
+    uint8_t tail = event_tail;
+    uint8_t pending = (event_head - tail) & (EVENT_QUEUE_SIZE - 1);
+    uint8_t slot = event_last[type];
+    uint8_t offset = (slot - tail) & (EVENT_QUEUE_SIZE - 1);
+    event_t *event;
+    
+    ++stats->posted;
+    if (event_merge[type] != EVENT_MERGE_NONE && offset && offset < pending && event_queue[slot].type == type) {
+        event = &event_queue[slot];
+        if (event->count < 0xffff) {
+            ++event->count;
+        }
+        if (event_merge[type] == EVENT_MERGE_LATEST) {
+            event->data = data;
+        }
+        ++stats->merged;
+        return;
+    }
+    
+    if (pending == EVENT_QUEUE_SIZE - 1) {
+        ++stats->dropped; // only events that never merge can fill the queue
+        return;
+    }
+    
+    slot = event_head;
+    event = &event_queue[slot];
+    event->type = type;
+    event->data = data;
+    event->count = 1;
+    event->time = GetMillis();
+    event_last[type] = slot;
+    event_high_water = MAX(event_high_water, pending + 1);
+    event_head = (slot + 1) & (EVENT_QUEUE_SIZE - 1); // publish the event
+}
+
+uint8_t EventGet(event_t *event) {
+    // Take the oldest pending event, 0 if there is none
+    uint8_t tail = event_tail;
+    event_stats_t *stats;
+    
+    if (tail == event_head) {
+        return 0;
+    }
+    
+    *event = event_queue[tail];
+    event_tail = (tail + 1) & (EVENT_QUEUE_SIZE - 1); // release the slot to the handlers
+    
+    stats = &event_stats[event->type];
+    stats->latency_max = MAX(stats->latency_max, GetMillis() - event->time);
+    return 1;
+}
+
+void EventFlush(void) {
+    event_tail = event_head;
+}
+
+void EventWait(uint8_t type) {
+    // Busy wait for the next event of type, everything else is dropped
+    event_t event;
+    
+    EventFlush();
+    do {
+        while (!EventGet(&event));
+    } while (event.type != type);
+}
+
+void EventStatsPut(void) {
+    uint8_t i;
+    
+    UART0StringPutNonBlocking("Event: Posted Merged Dropped Latency(ms)\r\n");
+    for (i = 0; i < EVENT_TYPES; ++i) {
+        UART0StringPutNonBlocking(event_names[i]);
+        UART0StringPutNonBlocking(": ");
+        UART0NumberPutNonBlocking(event_stats[i].posted);
+        UART0StringPutNonBlocking(" ");
+        UART0NumberPutNonBlocking(event_stats[i].merged);
+        UART0StringPutNonBlocking(" ");
+        UART0NumberPutNonBlocking(event_stats[i].dropped);
+        UART0StringPutNonBlocking(" ");
+        UART0NumberPutNonBlocking(event_stats[i].latency_max);
+        UART0StringPutNonBlocking("\r\n");
+    }
+    UART0StringPutNonBlocking("Event Queue: ");
+    UART0NumberPutNonBlocking(event_high_water);
+    UART0StringPutNonBlocking("/");
+    UART0NumberPutNonBlocking(EVENT_QUEUE_SIZE - 1);
+    UART0StringPutNonBlocking(" high water\r\n");
+}
+
+uint16_t GetSubsecondTicks(void) {
+    // Milliseconds into the current RTC second, datetime is brought up to the same second
+    uint32_t seconds, subseconds;
+    
+    do { // retry if the second changes while sampling
+        seconds = HibernateRTCGet();
+        subseconds = HibernateRTCSSGet();
+    } while (seconds != HibernateRTCGet());
+    
+    RTCUpdate(seconds);
+    return subseconds * 1000 / RTC_SUBSECONDS;
+}
+
+void GPIOInit(void) {
+    // Input: PJ0, PJ1, PM3 (TCA6424 INT)
+    // Output: PF0, PN0, PN1
+    
+	SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOF);
+	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOF));
+    GPIOPinTypeGPIOOutput(GPIO_PORTF_BASE, GPIO_PIN_0);
+    
+	SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOJ);
+	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOJ));
+	GPIOPinTypeGPIOInput(GPIO_PORTJ_BASE, GPIO_PIN_0 | GPIO_PIN_1);
+	GPIOPadConfigSet(GPIO_PORTJ_BASE, GPIO_PIN_0 | GPIO_PIN_1, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+    
+	SysCtlPeripheralEnable(SYSCTL_PERIPH_GPION);
+	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPION));
+    GPIOPinTypeGPIOOutput(GPIO_PORTN_BASE, GPIO_PIN_0 | GPIO_PIN_1);
+    
+#if KEY_INTERRUPT
+    // TCA6424 INT pulls low when an input changes, until the input port is read
+    SysCtlPeripheralEnable(KEY_INT_PERIPH);
+    while (!SysCtlPeripheralReady(KEY_INT_PERIPH));
+    GPIOPinTypeGPIOInput(KEY_INT_BASE, KEY_INT_PIN);
+    GPIOPadConfigSet(KEY_INT_BASE, KEY_INT_PIN, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+    GPIOIntTypeSet(KEY_INT_BASE, KEY_INT_PIN, GPIO_FALLING_EDGE); // enabled by KeyInit
+#endif
+}
+
+void UART0Init(void) {
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_UART0);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_UART0));
+    
+    // PA0 -> UART0_RX, PA1 -> UART0_TX
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOA);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOA));
+    GPIOPinConfigure(GPIO_PA0_U0RX);
+    GPIOPinConfigure(GPIO_PA1_U0TX);
+    GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
+    
+    // 115200 baud, 8-N-1 format
+    UART0BaudSet(UART0_BAUD_DEFAULT);
+    
+    // TX interrupt when FIFO drains to 1/8, refilled from uart0_tx_buffer
+    UARTFIFOLevelSet(UART0_BASE, UART_FIFO_TX1_8, UART_FIFO_RX4_8);
+    
+    // Enable UART0 interrupter
+    IntEnable(INT_UART0);
+    UARTIntEnable(UART0_BASE, UART_INT_RX | UART_INT_RT | UART_INT_TX);
+    
+    DEBUG("UART0 Setup\r\n");
+}
+
+void UART0StringPutNonBlocking(const char *message) {
+    // Responses are built from several messages, after an overflow the rest of the line is
+    // dropped as well, so no later part of it is spliced after the truncation mark
+    uint16_t length, space = UART0TxFree();
+    const char *end;
+    
+    if (uart0_tx_discarding) {
+        end = strstr(message, "\r\n");
+        if (!end) {
+            return;
+        }
+        uart0_tx_discarding = 0;
+        message = end + 2; // the next line starts here
+    }
+    
+    length = strlen(message);
+    if (length <= space) {
+        UART0TxPush(message, length);
+        return;
+    }
+    
+#if UART0_TX_OVERFLOW == UART0_TX_BLOCK
+    while (length > 0) { // push in chunks as the FIFO drains
+        space = UART0TxFree();
+        if (space > length) {
+            space = length;
+        }
+        UART0TxPush(message, space);
+        message += space;
+        length -= space;
+        UART0TxFill(); // make progress even if interrupts are masked
+    }
+#elif UART0_TX_OVERFLOW == UART0_TX_DROP
+    ++uart0_tx_dropped;
+    uart0_tx_discarding = length < 2 || strcmp(message + length - 2, "\r\n") != 0;
+#else
+    ++uart0_tx_dropped;
+    uart0_tx_discarding = length < 2 || strcmp(message + length - 2, "\r\n") != 0;
+    if (space >= sizeof(UART0_TX_TRUNCATE_MARK) - 1) {
+        space -= sizeof(UART0_TX_TRUNCATE_MARK) - 1;
+        UART0TxPush(message, space);
+        UART0TxPush(UART0_TX_TRUNCATE_MARK, sizeof(UART0_TX_TRUNCATE_MARK) - 1);
+    }
+#endif
+}
+
+uint16_t UART0TxFree(void) {
+    // one byte is kept empty to tell full from empty
+    return UART0_TX_BUFFER_SIZE - 1 - ((uart0_tx_head - uart0_tx_tail) & (UART0_TX_BUFFER_SIZE - 1));
+}
+
+void UART0TxPush(const char *data, uint16_t length) {
+    uint16_t used;
+    bool masked = IntMasterDisable();
+    
+    while (length--) {
+        uart0_tx_buffer[uart0_tx_head] = *(data++);
+        uart0_tx_head = (uart0_tx_head + 1) & (UART0_TX_BUFFER_SIZE - 1);
+    }
+    
+    used = (uart0_tx_head - uart0_tx_tail) & (UART0_TX_BUFFER_SIZE - 1);
+    if (used > uart0_tx_high_water) {
+        uart0_tx_high_water = used;
+    }
+    
+    UART0TxFill(); // start transmitting, the TX interrupt continues
+    
+    if (!masked) IntMasterEnable();
+}
+
+void UART0TxFill(void) {
+    bool masked = IntMasterDisable(); // shared by main loop and UART0_Handler
+    
+    while (uart0_tx_tail != uart0_tx_head && UARTSpaceAvail(UART0_BASE)) {
+        UARTCharPutNonBlocking(UART0_BASE, uart0_tx_buffer[uart0_tx_tail]);
+        uart0_tx_tail = (uart0_tx_tail + 1) & (UART0_TX_BUFFER_SIZE - 1);
+        ++uart0_tx_bytes;
+    }
+    
+    if (!masked) IntMasterEnable();
+}
+
+void UART0FramePut(const uint8_t *data, uint8_t length) {
+    // Append CRC-16, COBS encode and end with 0x00, the whole frame or nothing is queued
+    uint8_t frame[2 + FRAME_MAX_PAYLOAD + 2];
+    uint8_t encoded[sizeof(frame) + 2];
+    uint16_t crc = Crc16(data, length);
+    
+    memcpy(frame, data, length);
+    FramePut16(frame + length, crc);
+    length = CobsEncode(frame, length + 2, encoded);
+    encoded[length++] = 0x00;
+    
+    if (length > UART0TxFree()) {
+        ++uart0_tx_dropped;
+        return;
+    }
+    UART0TxPush((const char *)encoded, length);
+}
+
+uint8_t UART0LineGet(char *line) {
+    uint8_t result;
+    
+    if (uart0_rx_tail == uart0_rx_head) {
+        return UART0_LINE_NONE;
+    }
+    
+    strcpy(line, uart0_rx_lines[uart0_rx_tail]);
+    command_stamp = uart0_rx_stamps[uart0_rx_tail];
+    result = uart0_rx_too_long[uart0_rx_tail] ? UART0_LINE_TOO_LONG : UART0_LINE_OK;
+    uart0_rx_tail = (uart0_rx_tail + 1) & (UART0_RX_LINES - 1); // release the slot to UART0_Handler
+    
+    return result;
+}
+
+void UART0RxStore(char *line, uint8_t *cursor, char c) {
+    if (*cursor < UART0_RX_LINE_SIZE - 1) {
+        line[(*cursor)++] = c;
+    } else if (!uart0_rx_too_long[uart0_rx_head]) {
+        uart0_rx_too_long[uart0_rx_head] = 1; // discard until end of line
+        ++uart0_rx_overlong;
+    }
+}
+
+void UART0StatsPut(void) {
+    UART0StringPutNonBlocking("TX Buffer: ");
+    UART0NumberPutNonBlocking((uart0_tx_head - uart0_tx_tail) & (UART0_TX_BUFFER_SIZE - 1));
+    UART0StringPutNonBlocking("/");
+    UART0NumberPutNonBlocking(UART0_TX_BUFFER_SIZE - 1);
+    UART0StringPutNonBlocking(" High Water: ");
+    UART0NumberPutNonBlocking(uart0_tx_high_water);
+    UART0StringPutNonBlocking(" Overflow: ");
+    UART0NumberPutNonBlocking(uart0_tx_dropped);
+    UART0StringPutNonBlocking("\r\nRX Lines: ");
+    UART0NumberPutNonBlocking((uart0_rx_head - uart0_rx_tail) & (UART0_RX_LINES - 1));
+    UART0StringPutNonBlocking("/");
+    UART0NumberPutNonBlocking(UART0_RX_LINES - 1);
+    UART0StringPutNonBlocking(" Dropped: ");
+    UART0NumberPutNonBlocking(uart0_rx_dropped);
+    UART0StringPutNonBlocking(" Too Long: ");
+    UART0NumberPutNonBlocking(uart0_rx_overlong);
+    UART0StringPutNonBlocking("\r\nBaud: ");
+    UART0NumberPutNonBlocking(uart0_baud);
+    UART0StringPutNonBlocking(uart0_baud_confirming ? " (unconfirmed)" : "");
+    UART0StringPutNonBlocking(" Fallbacks: ");
+    UART0NumberPutNonBlocking(uart0_baud_fallbacks);
+    UART0StringPutNonBlocking("\r\n");
+    SubscribeStatsPut();
+}
+
+uint8_t UART0BaudValid(uint32_t rate) {
+    // UARTConfigSetExpClk divides the clock by 16 (8 above clock / 16) in steps of 1/64
+    uint32_t oversample, divisor, actual;
+    
+    if (rate < UART0_BAUD_MIN || rate > sys_clock_freq / 8) {
+        return 0;
+    }
+    
+    oversample = (rate * 16 > sys_clock_freq) ? 8 : 16;
+    divisor = (uint32_t)(((uint64_t)sys_clock_freq * 64 / oversample + rate / 2) / rate);
+    actual = (uint32_t)((uint64_t)sys_clock_freq * 64 / oversample / divisor);
+    
+    return (actual > rate ? actual - rate : rate - actual) * 100 <= (uint64_t)rate * UART0_BAUD_TOLERANCE;
+}
+
+void UART0BaudSet(uint32_t rate) {
+    // waits for the shift register to drain and flushes the FIFO
+    UARTConfigSetExpClk(UART0_BASE, sys_clock_freq, rate,
+        UART_CONFIG_WLEN_8 | UART_CONFIG_PAR_NONE | UART_CONFIG_STOP_ONE);
+    uart0_baud = rate;
+}
+
+void UART0BaudPoll(void) {
+    // switch at a frame boundary, after the acknowledge has left at the old rate
+    if (uart0_baud_pending && uart0_tx_tail == uart0_tx_head && !UARTBusy(UART0_BASE)) {
+        UART0BaudSet(uart0_baud_pending);
+        uart0_baud_pending = 0;
+        
+        uart0_baud_confirming = 1;
+        uart0_baud_deadline = systick_ms + UART0_BAUD_TIMEOUT;
+        if (uart0_baud == UART0_BAUD_DEFAULT) {
+            UART0BaudConfirm(); // nothing to fall back to
+        }
+    }
+    
+    if (uart0_baud_confirming && (int32_t)(systick_ms - uart0_baud_deadline) >= 0) {
+        uart0_baud_confirming = 0;
+        ++uart0_baud_fallbacks;
+        UART0BaudSet(UART0_BAUD_DEFAULT);
+        uart0_binary = 0; // the host lost us, start over in text mode
+        UART0StringPutNonBlocking("Baud Fallback: ");
+        UART0NumberPutNonBlocking(UART0_BAUD_DEFAULT);
+        UART0StringPutNonBlocking("\r\n");
+    }
+}
+
+void UART0BaudConfirm(void) {
+    if (!uart0_baud_confirming) {
+        return;
+    }
+    
+    uart0_baud_confirming = 0;
+    if (uart0_baud_save) {
+        uart0_baud_saved = uart0_baud;
+        ROMStoreData();
+    }
+}
+
+void UART0BaudLoad(void) {
+    if (!UART0BaudValid(uart0_baud_saved)) {
+        uart0_baud_saved = UART0_BAUD_DEFAULT; // saved at another system clock
+    }
+    
+    if (uart0_baud_saved != uart0_baud) {
+        UART0BaudSet(uart0_baud_saved);
+    }
+}
+
+void SubscribePost(uint8_t topic) {
+    if (!(subscribe_topics & topic)) {
+        return;
+    }
+    if (subscribe_pending & topic) {
+        ++subscribe_coalesced; // the TX ring is backed up, only the latest state is sent
+    }
+    subscribe_pending |= topic;
+}
+
+void SubscribeAlarmPost(uint8_t index, uint8_t action) {
+    if (!(subscribe_topics & SUBSCRIBE_ALARM)) {
+        return;
+    }
+    if (subscribe_alarm_pending & (1 << index)) {
+        ++subscribe_coalesced;
+    }
+    subscribe_alarm_pending |= 1 << index;
+    subscribe_alarm_action[index] = action;
+}
+
+void SubscribePoll(void) {
+    // Detect ticks and mode changes, then send pending events while the TX ring has room.
+    // Whatever does not fit waits for the TX interrupt to drain the ring and wake the loop.
+    char line[SUBSCRIBE_LINE_SIZE];
+    uint8_t topic;
+    
+    if (!subscribe_topics) {
+        return;
+    }
+    if (uart0_binary) { // a text line would break the frame stream
+        subscribe_pending = 0;
+        subscribe_alarm_pending = 0;
+        return;
+    }
+    
+    if (epoch_seconds / subscribe_rate != subscribe_tick_slot) { // RTCRefresh ran this loop
+        subscribe_tick_slot = epoch_seconds / subscribe_rate;
+        SubscribePost(SUBSCRIBE_TICK);
+    }
+    if (mode != subscribe_mode) {
+        subscribe_mode = mode;
+        SubscribePost(SUBSCRIBE_MODE);
+    }
+    
+    while (subscribe_pending || subscribe_alarm_pending) {
+        if (UART0TxFree() < SUBSCRIBE_TX_RESERVE + SUBSCRIBE_LINE_SIZE) {
+            return;
+        }
+        topic = SubscribeLine(line);
+        UART0StringPutNonBlocking(line);
+        ++subscribe_sent;
+        if (topic == SUBSCRIBE_TICK) {
+            return; // stamped with the sub-second time of this pass, at most one per loop
+        }
+    }
+}
+
+uint8_t SubscribeLine(char *line) {
+    // Render the most urgent pending event and clear it, returns its topic
+    uint16_t ms;
+    uint8_t i;
+    
+    if (subscribe_alarm_pending) {
+        for (i = 0; !(subscribe_alarm_pending & (1 << i)); ++i);
+        subscribe_alarm_pending &= ~(1 << i);
+        strcpy(line, "!ALARM ");
+        StringifyNumber(i, line + strlen(line));
+        strcat(line, subscribe_alarm_names[subscribe_alarm_action[i]]);
+        if (subscribe_alarm_action[i] != SUBSCRIBE_ALARM_DEL) {
+            StringifyTime(alarms[i].time, line + strlen(line));
+        }
+        strcat(line, "\r\n");
+        return SUBSCRIBE_ALARM;
+    }
+    
+    if (subscribe_pending & SUBSCRIBE_TIME) {
+        subscribe_pending &= ~SUBSCRIBE_TIME;
+        strcpy(line, "!TIME ");
+        StringifyDate(datetime.year, datetime.month, datetime.day, line + strlen(line));
+        strcat(line, " ");
+        StringifyTime(datetime.time, line + strlen(line));
+        strcat(line, tz_view_utc ? " UTC\r\n" : " LOCAL\r\n");
+        return SUBSCRIBE_TIME;
+    }
+    
+    if (subscribe_pending & SUBSCRIBE_MODE) {
+        subscribe_pending &= ~SUBSCRIBE_MODE;
+        for (i = 0; !(subscribe_mode & (1 << i)); ++i);
+        strcpy(line, "!MODE ");
+        strcat(line, mode_names[i]);
+        strcat(line, "\r\n");
+        return SUBSCRIBE_MODE;
+    }
+    
+    // the second it starts, then how long after the RTC boundary the line went out
+    subscribe_pending &= ~SUBSCRIBE_TICK;
+    ms = GetSubsecondTicks(); // datetime follows if the second just turned
+    strcpy(line, "!TICK ");
+    StringifyDate(datetime.year, datetime.month, datetime.day, line + strlen(line));
+    strcat(line, " ");
+    StringifyTime(datetime.time, line + strlen(line));
+    strcat(line, " +");
+    StringifyNumber(ms, line + strlen(line));
+    strcat(line, "ms\r\n");
+    return SUBSCRIBE_TICK;
+}
+
+uint8_t SubscribeParseTopics(const char *word, uint8_t length, uint8_t *topics) {
+    // ALL or a comma separated list of topic names
+    uint8_t i, start = 0, end;
+    
+    *topics = 0;
+    if (length == 3 && strncmp(word, "ALL", 3) == 0) {
+        *topics = SUBSCRIBE_ALL;
+        return 1;
+    }
+    
+    while (start < length) {
+        for (end = start; end < length && word[end] != ','; ++end);
+        for (i = 0; i < SUBSCRIBE_TOPICS; ++i) {
+            if (strlen(subscribe_topic_names[i]) == end - start
+                && strncmp(word + start, subscribe_topic_names[i], end - start) == 0) {
+                break;
+            }
+        }
+        if (i == SUBSCRIBE_TOPICS) {
+            return 0;
+        }
+        *topics |= 1 << i;
+        
+        start = end + 1;
+        if (end + 1 == length) {
+            return 0; // trailing comma
+        }
+    }
+    
+    return *topics != 0;
+}
+
+void SubscribeStatsPut(void) {
+    const char *separator = "";
+    uint8_t i;
+    
+    UART0StringPutNonBlocking("Subscribed: ");
+    if (!subscribe_topics) {
+        UART0StringPutNonBlocking("NONE");
+    }
+    for (i = 0; i < SUBSCRIBE_TOPICS; ++i) {
+        if (subscribe_topics & (1 << i)) {
+            UART0StringPutNonBlocking(separator);
+            UART0StringPutNonBlocking(subscribe_topic_names[i]);
+            separator = ",";
+        }
+    }
+    UART0StringPutNonBlocking(" Rate(s): ");
+    UART0NumberPutNonBlocking(subscribe_rate);
+    UART0StringPutNonBlocking(" Sent: ");
+    UART0NumberPutNonBlocking(subscribe_sent);
+    UART0StringPutNonBlocking(" Coalesced: ");
+    UART0NumberPutNonBlocking(subscribe_coalesced);
+    UART0StringPutNonBlocking("\r\n");
+}
+
+void UART0NumberPutNonBlocking(int64_t data) {
+    char buffer[21];
+    
+    StringifyNumber(data, buffer);
+    UART0StringPutNonBlocking(buffer);
+}
+
+void I2C0Init(void) {
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_I2C0);
+	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_I2C0));
+    
+    // PB2 -> I2C0_SCL, PB3 -> I2C0_SDA
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOB);
+	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOB));
+    GPIOPinConfigure(GPIO_PB2_I2C0SCL);
+    GPIOPinConfigure(GPIO_PB3_I2C0SDA);
+    GPIOPinTypeI2CSCL(GPIO_PORTB_BASE, GPIO_PIN_2);
+    GPIOPinTypeI2C(GPIO_PORTB_BASE, GPIO_PIN_3);
+    
+    I2CMasterInitExpClk(I2C0_BASE, sys_clock_freq, true);
+	I2CMasterEnable(I2C0_BASE);
+    
+    // Enable I2C0 interrupt, transactions are driven by I2C0_Handler
+    I2CMasterIntEnable(I2C0_BASE);
+    IntEnable(INT_I2C0);
+    
+    ShadowInvalidate(TCA6424_I2CADDR); // unknown state after reset
+    ShadowInvalidate(PCA9557_I2CADDR);
+    
+    // TCA6424 config
+    ExpanderWrite(TCA6424_I2CADDR, TCA6424_CONFIG_PORT0, 0xff); // port0: input
+    ExpanderWrite(TCA6424_I2CADDR, TCA6424_CONFIG_PORT1, 0x00); // port1: output
+    ExpanderWrite(TCA6424_I2CADDR, TCA6424_CONFIG_PORT2, 0x00); // port2: output
+    
+    // PCA9557 config
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_CONFIG, 0x00); // port: output
+    ExpanderWrite(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off led1-8
+}
+
+void DisplayInit(void) {
+    uint8_t i;
+    
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER0);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_TIMER0));
+    
+    memset(display_buffer, 0, sizeof(display_buffer));
+    for (i = 0; i < 100; ++i) {
+        seg7_pairs[i][0] = seg7[i / 10];
+        seg7_pairs[i][1] = seg7[i % 10];
+    }
+    
+    // one-shot, TIMER0A_Handler reloads it with the lit and then the dark part of each digit slot
+    display_slot_cycles = sys_clock_freq / (DISPLAY_REFRESH_RATE * DISPLAY_DIGITS);
+    display_on_cycles = display_slot_cycles;
+    TimerConfigure(TIMER0_BASE, TIMER_CFG_ONE_SHOT);
+    TimerLoadSet(TIMER0_BASE, TIMER_A, display_slot_cycles);
+    
+    IntEnable(INT_TIMER0A);
+    TimerIntEnable(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+    TimerEnable(TIMER0_BASE, TIMER_A);
+}
+
+uint8_t I2C0WriteByte(uint8_t device, uint8_t reg, uint8_t data) {
+    volatile uint8_t done = 0;
+    
+    // must not be called from an interrupt handler, use I2C0WriteAsync instead
+    do {
+        while (I2C0QueueDepth() >= I2C0_QUEUE_SIZE - 1); // wait for free slot
+    } while (!I2C0WriteAsync(device, reg, &data, 1, I2C0BlockingComplete, &done));
+    I2C0Wait(&done);
+    
+    return i2c0_blocking_error;
+}
+
+uint8_t I2C0ReadByte(uint8_t device, uint8_t reg) {
+    volatile uint8_t done = 0;
+    
+    // must not be called from an interrupt handler, use I2C0ReadAsync instead
+    do {
+        while (I2C0QueueDepth() >= I2C0_QUEUE_SIZE - 1); // wait for free slot
+    } while (!I2C0ReadAsync(device, reg, 1, I2C0BlockingComplete, &done));
+    I2C0Wait(&done);
+    
+    return i2c0_blocking_data;
+}
+
+uint8_t I2C0WriteAsync(uint8_t device, uint8_t reg, const uint8_t *data, uint8_t length,
+    i2c_callback_t callback, volatile uint8_t *done) {
+    return I2C0Enqueue(I2C0_OP_WRITE, device, reg, data, length, callback, done);
+}
+
+uint8_t I2C0ReadAsync(uint8_t device, uint8_t reg, uint8_t length,
+    i2c_callback_t callback, volatile uint8_t *done) {
+    return I2C0Enqueue(I2C0_OP_READ, device, reg, NULL, length, callback, done);
+}
+
+uint8_t I2C0Enqueue(uint8_t op, uint8_t device, uint8_t reg, const uint8_t *data, uint8_t length,
+    i2c_callback_t callback, volatile uint8_t *done) {
+    i2c_transaction_t *transaction;
+    uint8_t depth;
+    bool masked;
+    
+    if (length == 0 || length > I2C0_MAX_DATA) {
+        return 0; // does not fit a transaction, never retry
+    }
+    
+    masked = IntMasterDisable(); // queue is shared by main loop and interrupt handlers
+    if (((i2c0_queue_head + 1) & (I2C0_QUEUE_SIZE - 1)) == i2c0_queue_tail) {
+        ++i2c0_stats.overflows;
+        if (!masked) IntMasterEnable();
+        return 0; // queue is full
+    }
+    
+    transaction = &i2c0_queue[i2c0_queue_head];
+    transaction->device = device;
+    transaction->reg = reg;
+    transaction->op = op;
+    transaction->length = length;
+    if (data) {
+        memcpy(transaction->data, data, length);
+    }
+    transaction->error = I2C_MASTER_ERR_NONE;
+    transaction->callback = callback;
+    transaction->done = done;
+    transaction->timestamp = GetMicros();
+    i2c0_queue_head = (i2c0_queue_head + 1) & (I2C0_QUEUE_SIZE - 1);
+    
+    depth = I2C0QueueDepth();
+    if (depth > i2c0_stats.max_depth) {
+        i2c0_stats.max_depth = depth;
+    }
+    
+    if (i2c0_state == I2C0_STATE_IDLE) {
+        I2C0Start();
+    }
+    
+    if (!masked) IntMasterEnable();
+    return 1;
+}
+
+uint8_t I2C0QueueDepth(void) {
+    return (i2c0_queue_head - i2c0_queue_tail) & (I2C0_QUEUE_SIZE - 1);
+}
+
+void I2C0Wait(volatile uint8_t *done) {
+    while (!*done) {
+        if (IntMasterDisable()) {
+            // interrupts are masked (e.g. during initialization), drive the state machine by polling
+            if (I2CMasterIntStatus(I2C0_BASE, false)) {
+                I2C0_Handler();
+            }
+        } else {
+            IntMasterEnable();
+        }
+    }
+}
+
+void I2C0Start(void) {
+    i2c_transaction_t *transaction = &i2c0_queue[i2c0_queue_tail];
+    
+    // send register address, the bus is kept for the payload or a repeated start
+    I2CMasterSlaveAddrSet(I2C0_BASE, transaction->device, false);
+    I2CMasterDataPut(I2C0_BASE, transaction->reg);
+    I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_START);
+    
+    i2c0_index = 0;
+    i2c0_state = (transaction->op == I2C0_OP_READ) ? I2C0_STATE_READ_ADDR : I2C0_STATE_WRITE;
+}
+
+void I2C0Complete(void) {
+    i2c_transaction_t *transaction = &i2c0_queue[i2c0_queue_tail];
+    uint32_t latency = GetMicros() - transaction->timestamp;
+    
+    ++i2c0_stats.transactions;
+    i2c0_stats.latency_last = latency;
+    i2c0_stats.latency_total += latency;
+    if (latency > i2c0_stats.latency_max) {
+        i2c0_stats.latency_max = latency;
+    }
+    
+    if (transaction->callback) {
+        transaction->callback(transaction);
+    }
+    if (transaction->done) {
+        *transaction->done = 1;
+    }
+    
+    i2c0_queue_tail = (i2c0_queue_tail + 1) & (I2C0_QUEUE_SIZE - 1);
+    i2c0_state = I2C0_STATE_IDLE;
+    if (i2c0_queue_tail != i2c0_queue_head) {
+        I2C0Start(); // next transaction
+    }
+}
+
+uint8_t ExpanderWrite(uint8_t device, uint8_t reg, uint8_t data) {
+    shadow_register_t *shadow = ShadowFind(device, reg);
+    uint8_t error;
+    
+    if (shadow && shadow->valid && shadow->value == data) {
+        ++i2c0_stats.shadow_elided;
+        return I2C_MASTER_ERR_NONE;
+    }
+    
+    ++i2c0_stats.shadow_issued;
+    error = I2C0WriteByte(device, reg, data);
+    if (error != I2C_MASTER_ERR_NONE) {
+        ShadowInvalidate(device);
+    } else if (shadow) {
+        shadow->value = data;
+        shadow->valid = 1;
+    }
+    
+    return error;
+}
+
+uint8_t ExpanderWriteAsync(uint8_t device, uint8_t reg, uint8_t data) {
+    shadow_register_t *shadow = ShadowFind(device, reg);
+    bool masked = IntMasterDisable(); // shadow is shared by main loop and interrupt handlers
+    
+    if (shadow && shadow->valid && shadow->value == data) {
+        ++i2c0_stats.shadow_elided;
+        if (!masked) IntMasterEnable();
+        return 1;
+    }
+    
+    if (!I2C0WriteAsync(device, reg, &data, 1, ShadowWriteComplete, NULL)) {
+        if (shadow) {
+            shadow->valid = 0; // the write is lost, value on the device is unknown
+        }
+        if (!masked) IntMasterEnable();
+        return 0;
+    }
+    
+    // write-through, later writes compare against the queued value
+    ++i2c0_stats.shadow_issued;
+    if (shadow) {
+        shadow->value = data;
+        shadow->valid = 1;
+    }
+    
+    if (!masked) IntMasterEnable();
+    return 1;
+}
+
+uint8_t ExpanderWriteBurstAsync(uint8_t device, uint8_t reg, const uint8_t *data, uint8_t length) {
+    shadow_register_t *shadow;
+    uint8_t i, current, changed = 0;
+    uint8_t command = reg;
+    bool masked = IntMasterDisable();
+    
+    if (device == TCA6424_I2CADDR) {
+        command |= TCA6424_AUTO_INCREMENT;
+    }
+    
+    // elide only if every register already holds its final value
+    for (i = 0, current = reg; i < length; ++i, current = ExpanderNextRegister(device, current)) {
+        uint8_t j, final = data[i], next = ExpanderNextRegister(device, current);
+        
+        for (j = i + 1; j < length; ++j, next = ExpanderNextRegister(device, next)) {
+            if (next == current) {
+                final = data[j]; // written again later in the burst
+            }
+        }
+        
+        shadow = ShadowFind(device, current);
+        if (!shadow || !shadow->valid || shadow->value != final) {
+            changed = 1;
+            break;
+        }
+    }
+    
+    if (!changed) {
+        ++i2c0_stats.shadow_elided;
+        if (!masked) IntMasterEnable();
+        return 1;
+    }
+    
+    if (!I2C0WriteAsync(device, command, data, length, ShadowWriteComplete, NULL)) {
+        for (i = 0, current = reg; i < length; ++i, current = ExpanderNextRegister(device, current)) {
+            shadow = ShadowFind(device, current);
+            if (shadow) {
+                shadow->valid = 0;
+            }
+        }
+        if (!masked) IntMasterEnable();
+        return 0;
+    }
+    
+    ++i2c0_stats.shadow_issued;
+    for (i = 0, current = reg; i < length; ++i, current = ExpanderNextRegister(device, current)) {
+        shadow = ShadowFind(device, current);
+        if (shadow) {
+            shadow->value = data[i];
+            shadow->valid = 1;
+        }
+    }
+    
+    if (!masked) IntMasterEnable();
+    return 1;
+}
+
+uint8_t ExpanderNextRegister(uint8_t device, uint8_t reg) {
+    if (device == TCA6424_I2CADDR) {
+        // groups of 3 ports aligned to 4, e.g. OUTPUT_PORT2 rolls over to OUTPUT_PORT0
+        return ((reg & 0x03) == 0x02) ? (reg & ~0x03) : reg + 1;
+    }
+    
+    return reg; // PCA9557 has no auto-increment
+}
+
+shadow_register_t *ShadowFind(uint8_t device, uint8_t reg) {
+    uint8_t i;
+    
+    for (i = 0; i < sizeof(expander_shadow) / sizeof(expander_shadow[0]); ++i) {
+        if (expander_shadow[i].device == device && expander_shadow[i].reg == reg) {
+            return &expander_shadow[i];
+        }
+    }
+    
+    return NULL;
+}
+
+void ShadowInvalidate(uint8_t device) {
+    uint8_t i;
+    bool masked = IntMasterDisable();
+    
+    for (i = 0; i < sizeof(expander_shadow) / sizeof(expander_shadow[0]); ++i) {
+        if (expander_shadow[i].device == device) {
+            expander_shadow[i].valid = 0;
+        }
+    }
+    
+    if (!masked) IntMasterEnable();
+}
+
+void ShadowWriteComplete(const i2c_transaction_t *transaction) {
+    if (transaction->error != I2C_MASTER_ERR_NONE) {
+        // the device may have reset or missed the write, resend everything next time
+        ShadowInvalidate(transaction->device);
+    }
+}
+
+void I2C0BlockingComplete(const i2c_transaction_t *transaction) {
+    i2c0_blocking_data = transaction->data[0];
+    i2c0_blocking_error = transaction->error;
+}
+
+void I2C0StatsPut(void) {
+    UART0StringPutNonBlocking("Queue: ");
+    UART0NumberPutNonBlocking(I2C0QueueDepth());
+    UART0StringPutNonBlocking("/");
+    UART0NumberPutNonBlocking(I2C0_QUEUE_SIZE);
+    UART0StringPutNonBlocking(" Max: ");
+    UART0NumberPutNonBlocking(i2c0_stats.max_depth);
+    UART0StringPutNonBlocking(" Overflow: ");
+    UART0NumberPutNonBlocking(i2c0_stats.overflows);
+    UART0StringPutNonBlocking("\r\nTransactions: ");
+    UART0NumberPutNonBlocking(i2c0_stats.transactions);
+    UART0StringPutNonBlocking("\r\nLatency(us): Last ");
+    UART0NumberPutNonBlocking(i2c0_stats.latency_last);
+    UART0StringPutNonBlocking(" Avg ");
+    UART0NumberPutNonBlocking(i2c0_stats.transactions ? i2c0_stats.latency_total / i2c0_stats.transactions : 0);
+    UART0StringPutNonBlocking(" Max ");
+    UART0NumberPutNonBlocking(i2c0_stats.latency_max);
+    UART0StringPutNonBlocking("\r\nErrors: NAK ");
+    UART0NumberPutNonBlocking(i2c0_stats.nak_errors);
+    UART0StringPutNonBlocking(" Arbitration ");
+    UART0NumberPutNonBlocking(i2c0_stats.arb_errors);
+    UART0StringPutNonBlocking(" Timeout ");
+    UART0NumberPutNonBlocking(i2c0_stats.timeout_errors);
+    UART0StringPutNonBlocking("\r\nExpander Writes: Issued ");
+    UART0NumberPutNonBlocking(i2c0_stats.shadow_issued);
+    UART0StringPutNonBlocking(" Elided ");
+    UART0NumberPutNonBlocking(i2c0_stats.shadow_elided);
+    UART0StringPutNonBlocking("\r\nDisplay: ");
+    UART0NumberPutNonBlocking(i2c0_stats.display_frame_transactions);
+    UART0StringPutNonBlocking(DISPLAY_BURST_WRITE ? " transactions/frame (burst)\r\n" : " transactions/frame (single)\r\n");
+}
+
+void BuzzerInit(void) {
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_PWM0);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_PWM0));
+    PWMOutputState(PWM0_BASE, PWM_OUT_3_BIT, true);
+    
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOF);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOF));
+    GPIOPinConfigure(GPIO_PF3_M0PWM3);
+    GPIOPinTypePWM(GPIO_PORTF_BASE, GPIO_PIN_3);
+    
+    PWMGenConfigure(PWM0_BASE, PWM_GEN_1, PWM_GEN_MODE_DOWN | PWM_GEN_MODE_NO_SYNC);
+}
+
+void BuzzerStart(uint32_t freq) {
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_PWM0); // keep sounding while the core sleeps
+    SysCtlPeripheralSleepEnable(SYSCTL_PERIPH_GPIOF);
+    PWMGenPeriodSet(PWM0_BASE, PWM_GEN_1, sys_clock_freq / freq);
+    PWMPulseWidthSet(PWM0_BASE, PWM_OUT_3, PWMGenPeriodGet(PWM0_BASE, PWM_GEN_1) / 2); // 0.5
+    PWMGenEnable(PWM0_BASE, PWM_GEN_1);
+}
+
+void BuzzerStop(void) {
+    PWMGenDisable(PWM0_BASE, PWM_GEN_1);
+    SysCtlPeripheralSleepDisable(SYSCTL_PERIPH_PWM0);
+    SysCtlPeripheralSleepDisable(SYSCTL_PERIPH_GPIOF);
+}
+
+void RTCInit(void) {
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_HIBERNATE);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_HIBERNATE));
+    
+    HibernateEnableExpClk(sys_clock_freq);
+    HibernateClockConfig(HIBERNATE_OSC_LOWDRIVE);
+    HibernateRTCEnable();
+    HibernateCounterMode(HIBERNATE_COUNTER_RTC); // seconds since rtc_epoch
+    
+    HibernateIntClear(HIBERNATE_INT_RTC_MATCH_0);
+    HibernateIntEnable(HIBERNATE_INT_RTC_MATCH_0); // the earliest alarm, see AlarmProgram
+    IntEnable(INT_HIBERNATE);
+}
+
+void RTCStoreData(void) {
+    // Rebase the RTC on datetime in the display view, only when time is set since hibernate writes are slow
+    int64_t view = (int64_t)DaysFromCivil(datetime.year, datetime.month, datetime.day) * 86400 + datetime.time;
+    
+    RTCRebase(tz_view_utc ? view : TzLocalToUtc(view), 0);
+}
+
+void RTCRebase(int64_t utc, uint64_t at) {
+    // Restart the RTC at utc once RTCTicks reaches at, or at once if at is 0.
+    // The RTC counts UTC from midnight of the UTC date.
+    uint32_t data[HIB_DATA_WORDS];
+    datetime_t anchor;
+    bool masked = false;
+    
+    sync_step_at = 0; // setting the time replaces an armed step
+    EpochCivil(utc, &anchor);
+    if (at) {
+        while (RTCTicks() + 2 < at); // interrupts are served until the last sub-seconds
+        masked = IntMasterDisable();
+        while (RTCTicks() < at);
+    }
+    rtc_epoch = utc - anchor.time;
+    HibernateRTCSet(anchor.time); // also clears the sub-second counter
+    if (at && !masked) IntMasterEnable();
+    
+    HibernateDataGet(data, HIB_DATA_WORDS);
+    data[HIB_DATA_ANCHOR] = ((uint32_t)(anchor.year) << 16) | ((uint32_t)(anchor.month) << 8) | anchor.day;
+    data[HIB_DATA_ANCHOR + 1] = ~data[HIB_DATA_ANCHOR];
+    HibernateDataSet(data, HIB_DATA_WORDS);
+    
+    TzExpand(utc);
+    RTCDecode(anchor.time);
+    RTCPhaseSystick();
+    AlarmReschedule(); // from the new time on, setting time does not ring an alarm
+    rom_clock_set = 1;
+    ROMStoreData();
+    SubscribePost(SUBSCRIBE_TIME);
+}
+
+void RTCLoadData(void) {
+    uint32_t data[HIB_DATA_WORDS];
+    uint32_t seconds;
+    
+    if (load_rom) {
+        load_rom = 0;
+        RTCStoreData(); // RTC was not running, start from the date and time in the journal
+        return;
+    }
+    
+    HibernateDataGet(data, HIB_DATA_WORDS);
+    if (data[HIB_DATA_ANCHOR + 1] != ~data[HIB_DATA_ANCHOR]) {
+        RTCStoreData(); // no anchor, start the RTC from the current datetime
+        return;
+    }
+    
+    rtc_epoch = (int64_t)DaysFromCivil(data[HIB_DATA_ANCHOR] >> 16, (data[HIB_DATA_ANCHOR] >> 8) & 0xff,
+        data[HIB_DATA_ANCHOR] & 0xff) * 86400;
+    seconds = HibernateRTCGet();
+    TzExpand(rtc_epoch + seconds);
+    RTCDecode(seconds);
+    RTCPhaseSystick();
+    AlarmReschedule();
+}
+
+void RTCRefresh(void) {
+    RTCUpdate(HibernateRTCGet());
+}
+
+void RTCUpdate(uint32_t seconds) {
+    // One add for the epoch counter, one compare and add for the zone offset,
+    // the civil date is only converted when the day changes
+    int64_t view;
+    
+    if (seconds == rtc_seconds) {
+        return;
+    }
+    rtc_seconds = seconds;
+    epoch_seconds = rtc_epoch + seconds;
+    if (epoch_seconds >= tz_next) {
+        TzExpand(epoch_seconds); // a DST transition passed
+    }
+    
+    view = epoch_seconds + tz_view_offset;
+    if ((uint64_t)view - (uint64_t)datetime_midnight >= 86400) {
+        datetime_day = EpochDay(view);
+        datetime_midnight = (int64_t)datetime_day * 86400;
+        CivilFromDays(datetime_day, &datetime);
+        DisplayFlowInvalidate();
+    }
+    datetime.time = (uint32_t)(view - datetime_midnight);
+}
+
+void RTCDecode(uint32_t seconds) {
+    // Convert again after the RTC, the zone or the view changed
+    rtc_seconds = seconds - 1;
+    datetime_midnight = TZ_NEVER;
+    RTCUpdate(seconds);
+}
+
+void RTCPhaseSystick(void) {
+    // SysTick only schedules the refresh, align its 1s counter with the RTC sub-seconds
+    bool masked = IntMasterDisable();
+    
+    systick_1s_counter = HibernateRTCSSGet() * SYSTICK_FREQUENCY / RTC_SUBSECONDS;
+    
+    if (!masked) IntMasterEnable();
+}
+
+uint64_t RTCTicks(void) {
+    // RTC count in sub-seconds since rtc_epoch, also called by UART0_Handler
+    uint32_t seconds, subseconds;
+    
+    do { // retry if the second changes while sampling
+        seconds = HibernateRTCGet();
+        subseconds = HibernateRTCSSGet();
+    } while (seconds != HibernateRTCGet());
+    
+    return (uint64_t)seconds * RTC_SUBSECONDS + subseconds;
+}
+
+void SyncApply(int64_t offset, int32_t delay) {
+    // Correct an offset of the RTC, device minus host in microseconds, measured by the host with SYNC.
+    // The part the pending slew does not explain accumulated since the last exchange, that is the drift.
+    int64_t ticks = offset / 1000000 * RTC_SUBSECONDS + offset % 1000000 * RTC_SUBSECONDS / 1000000;
+    int64_t passed, residual, shift, at;
+    int32_t interval;
+    
+    RTCRefresh();
+    passed = (rtc_seconds % 64 < 32) ? sync_slew_step : 0; // the trimmed second is over, SyncPoll credits it later
+    interval = (int32_t)(epoch_seconds - sync_last);
+    if (sync_exchanges && interval >= SYNC_FREQ_MIN_INTERVAL) {
+        residual = offset - (sync_slew_left - passed) * 1000000 / RTC_SUBSECONDS;
+        sync_estimate_ppb = (int32_t)(residual * 1000 / interval);
+        sync_freq_ppb += sync_estimate_ppb / SYNC_FREQ_GAIN;
+        sync_freq_ppb = MAX(-SYNC_FREQ_MAX_PPB, MIN(SYNC_FREQ_MAX_PPB, sync_freq_ppb));
+        if (sync_freq_ppb - sync_freq_saved >= SYNC_FREQ_SAVE_PPB || sync_freq_saved - sync_freq_ppb >= SYNC_FREQ_SAVE_PPB) {
+            sync_freq_saved = sync_freq_ppb;
+            ROMStoreData();
+        }
+    }
+    
+    sync_stepped = (offset >= SYNC_STEP_US || offset <= -SYNC_STEP_US);
+    sync_step_at = 0; // the offset was measured with the old counter, it replaces an armed step
+    if (sync_stepped) {
+        // arm the restart on the sub-second where the host's time turns a second, SyncPoll takes it
+        at = RTCTicks() + 2 * SYNC_STEP_LEAD;
+        shift = ((ticks - at) % RTC_SUBSECONDS + RTC_SUBSECONDS) % RTC_SUBSECONDS;
+        at += shift;
+        sync_step_utc = rtc_epoch + (at - ticks) / RTC_SUBSECONDS;
+        sync_step_at = at;
+        ++sync_steps;
+    } else {
+        sync_slew_left = ticks + passed; // replaces what is left of the last slew, the offset includes it
+    }
+    AlarmProgram();
+    
+    RTCRefresh();
+    sync_last = epoch_seconds;
+    sync_offset = offset;
+    sync_delay = delay;
+    ++sync_exchanges;
+}
+
+void SyncPoll(void) {
+    // Take an armed step once the RTC match woke the loop, then write the trim between the trimmed seconds,
+    // the first of every 64, crediting the slew of the last one
+    uint32_t period;
+    int32_t freq, trim;
+    uint64_t now, missed;
+    
+    if (sync_step_at) {
+        now = RTCTicks();
+        if (now >= sync_step_at) {
+            // woke too late, the host's time turns a second again one RTC second later
+            missed = (now - sync_step_at) / RTC_SUBSECONDS + 1;
+            sync_step_at += missed * RTC_SUBSECONDS;
+            sync_step_utc += (int64_t)missed;
+            AlarmProgram();
+        } else if (now + SYNC_STEP_LEAD >= sync_step_at) {
+            SyncStep();
+        }
+    }
+    
+    period = (rtc_seconds + 32) / 64;
+    if (period == sync_trim_period) {
+        return;
+    }
+    if (sync_trim_period != 0xffffffff) {
+        sync_slew_left -= sync_slew_step;
+    }
+    sync_trim_period = period;
+    
+    freq = (int32_t)(((int64_t)sync_freq_ppb * 64 * RTC_SUBSECONDS + (sync_freq_ppb < 0 ? -500000000 : 500000000))
+        / 1000000000); // trim units, one sub-second per 64s
+    sync_slew_step = (int32_t)MAX(-SYNC_SLEW_MAX, MIN(SYNC_SLEW_MAX, sync_slew_left));
+    trim = MAX(-RTC_TRIM_RANGE, MIN(RTC_TRIM_RANGE, freq + sync_slew_step)); // a longer second slows the RTC
+    sync_slew_step = trim - freq;
+    HibernateRTCTrimSet(RTC_TRIM_NOMINAL + trim);
+}
+
+void SyncStep(void) {
+    // Restart the RTC at the armed step, waiting at most SYNC_STEP_LEAD sub-seconds for its boundary
+    RTCRebase(sync_step_utc, sync_step_at); // also disarms it
+    
+    // the 64s periods start over with the counter, drop the slew and trim the frequency only
+    sync_slew_left = 0;
+    sync_slew_step = 0;
+    sync_trim_period = 0xffffffff;
+    RTCRefresh();
+    sync_last = epoch_seconds;
+}
+
+void SyncStampPut(uint64_t ticks, char *buffer) {
+    // UTC epoch seconds and microseconds of an RTCTicks value, 1718715605.123456
+    uint32_t micros = (uint32_t)((ticks % RTC_SUBSECONDS) * 1000000 / RTC_SUBSECONDS);
+    uint8_t i, length;
+    
+    StringifyNumber(rtc_epoch + (int64_t)(ticks / RTC_SUBSECONDS), buffer);
+    length = strlen(buffer);
+    buffer[length] = '.';
+    for (i = 6; i > 0; --i) {
+        buffer[length + i] = micros % 10 + '0';
+        micros /= 10;
+    }
+    buffer[length + 7] = '\0';
+}
+
+uint8_t SyncParseMicros(const char *word, uint8_t length, int64_t *value) {
+    // optional sign and at most 15 digits
+    uint8_t i = (length > 0 && (word[0] == '-' || word[0] == '+'));
+    
+    if (length == i || length - i > 15) {
+        return 0;
+    }
+    *value = 0;
+    for (; i < length; ++i) {
+        if (word[i] < '0' || word[i] > '9') {
+            return 0;
+        }
+        *value = *value * 10 + word[i] - '0';
+    }
+    if (word[0] == '-') {
+        *value = -*value;
+    }
+    return 1;
+}
+
+void SyncStatsPut(void) {
+    UART0StringPutNonBlocking("Last Sync: ");
+    if (!sync_exchanges) {
+        UART0StringPutNonBlocking("Never");
+    } else {
+        RTCRefresh();
+        UART0NumberPutNonBlocking(epoch_seconds - sync_last);
+        UART0StringPutNonBlocking("s ago Offset(us): ");
+        UART0NumberPutNonBlocking(sync_offset);
+        UART0StringPutNonBlocking(" Delay(us): ");
+        UART0NumberPutNonBlocking(sync_delay);
+        UART0StringPutNonBlocking(sync_stepped ? " (step)" : " (slew)");
+    }
+    UART0StringPutNonBlocking("\r\nDrift(ppb): ");
+    UART0NumberPutNonBlocking(sync_freq_ppb);
+    UART0StringPutNonBlocking(" Last Estimate(ppb): ");
+    UART0NumberPutNonBlocking(sync_estimate_ppb);
+    UART0StringPutNonBlocking(" Trim: ");
+    UART0NumberPutNonBlocking(HibernateRTCTrimGet());
+    UART0StringPutNonBlocking(" Slew Left(us): ");
+    UART0NumberPutNonBlocking(sync_slew_left * 1000000 / RTC_SUBSECONDS);
+    UART0StringPutNonBlocking("\r\nExchanges: ");
+    UART0NumberPutNonBlocking(sync_exchanges);
+    UART0StringPutNonBlocking(" Steps: ");
+    UART0NumberPutNonBlocking(sync_steps);
+    UART0StringPutNonBlocking(" Rejected: ");
+    UART0NumberPutNonBlocking(sync_rejected);
+    UART0StringPutNonBlocking("\r\n");
+}
+
+
+void TzSet(const tz_rule_t *rule) {
+    RTCRefresh();
+    tz_rule = *rule;
+    TzExpand(epoch_seconds);
+    RTCDecode(rtc_seconds);
+    AlarmReschedule(); // alarms ring in local time
+    ROMStoreData();
+    SubscribePost(SUBSCRIBE_TIME);
+}
+
+void TzSetView(uint8_t utc) {
+    tz_view_utc = utc;
+    tz_view_offset = utc ? 0 : tz_offset;
+    RTCDecode(HibernateRTCGet());
+    ROMStoreData();
+    SubscribePost(SUBSCRIBE_TIME);
+}
+
+void TzExpand(int64_t now) {
+    // Fill tz_table from the rule, RTCUpdate then only compares with its first entry
+    tz_offset = TzTransitions(now, tz_table);
+    tz_next = tz_table[0].at;
+    tz_view_offset = tz_view_utc ? 0 : tz_offset;
+}
+
+int32_t TzTransitions(int64_t at, tz_transition_t *upcoming) {
+    // Offset in effect at UTC second at, and the TZ_TRANSITIONS transitions after it if upcoming is not NULL.
+    // The years around at are expanded and sorted, so rules with DST over new year work too.
+    tz_transition_t all[8];
+    datetime_t date;
+    int32_t offset = tz_rule.std_offset, year;
+    uint8_t i, j, count = 0;
+    
+    for (i = 0; upcoming && i < TZ_TRANSITIONS; ++i) {
+        upcoming[i].at = TZ_NEVER;
+        upcoming[i].offset = tz_rule.std_offset;
+    }
+    if (!tz_rule.start) {
+        return offset;
+    }
+    
+    EpochCivil(at, &date);
+    for (year = (int32_t)date.year - 1; year <= (int32_t)date.year + 2; ++year) {
+        if (year < 0 || year > 9999) {
+            continue;
+        }
+        all[count].at = TzInstant(year, tz_rule.start, tz_rule.std_offset);
+        all[count++].offset = tz_rule.dst_offset;
+        all[count].at = TzInstant(year, tz_rule.end, tz_rule.dst_offset);
+        all[count++].offset = tz_rule.std_offset;
+    }
+    
+    for (i = 1; i < count; ++i) { // insertion sort, at most 8 entries
+        tz_transition_t transition = all[i];
+        
+        for (j = i; j > 0 && all[j - 1].at > transition.at; --j) {
+            all[j] = all[j - 1];
+        }
+        all[j] = transition;
+    }
+    
+    for (i = 0, j = 0; i < count; ++i) {
+        if (all[i].at <= at) {
+            offset = all[i].offset;
+        } else if (upcoming && j < TZ_TRANSITIONS) {
+            upcoming[j++] = all[i];
+        }
+    }
+    return offset;
+}
+
+int64_t TzInstant(uint16_t year, uint32_t rule, int32_t offset) {
+    // UTC second of a Mm.w.d rule in year, its time is local time with offset
+    uint8_t month = rule & 0x0f, week = (rule >> 4) & 0x0f, weekday = (rule >> 8) & 0x0f;
+    int32_t first = DaysFromCivil(year, month, 1);
+    int32_t day = first + (weekday + 7 - GetDayOfWeek(first)) % 7 + (week - 1) * 7;
+    
+    if (day >= first + GetDayOfMonth(year, month)) {
+        day -= 7; // week 5 is the last one of the month
+    }
+    return (int64_t)day * 86400 + (rule >> 12) - offset;
+}
+
+int64_t TzLocalToUtc(int64_t local) {
+    // Daylight time if the result falls in DST, standard time otherwise. A local time repeated
+    // by the autumn transition is its first occurrence, one skipped in spring is after the transition.
+    int64_t utc = local - tz_rule.dst_offset;
+    
+    if (TzTransitions(utc, NULL) == tz_rule.dst_offset) {
+        return utc;
+    }
+    return local - tz_rule.std_offset;
+}
+
+uint8_t TzRuleValid(uint32_t rule) {
+    uint8_t month = rule & 0x0f, week = (rule >> 4) & 0x0f, weekday = (rule >> 8) & 0x0f;
+    
+    return month >= 1 && month <= 12 && week >= 1 && week <= 5 && weekday <= 6 && (rule >> 12) <= 86400;
+}
+
+uint8_t TzParse(const char *word, uint8_t length, tz_rule_t *rule) {
+    // POSIX TZ: std offset [dst [offset] [,start[/time],end[/time]]], offsets are hours west of UTC
+    // and start/end are Mm.w.d, the US rule if omitted
+    uint8_t i = 0;
+    int32_t offset;
+    
+    memset(rule, 0, sizeof(*rule));
+    if (!TzParseName(word, length, &i, rule->std_name) || !TzParseOffset(word, length, &i, &offset)) {
+        return 0;
+    }
+    rule->std_offset = rule->dst_offset = -offset;
+    if (i == length) {
+        return 1; // no DST
+    }
+    
+    if (!TzParseName(word, length, &i, rule->dst_name)) {
+        return 0;
+    }
+    rule->dst_offset = rule->std_offset + 3600;
+    if (i < length && word[i] != ',') {
+        if (!TzParseOffset(word, length, &i, &offset)) {
+            return 0;
+        }
+        rule->dst_offset = -offset;
+    }
+    if (i == length) {
+        rule->start = ((uint32_t)TZ_DEFAULT_TIME << 12) | (2 << 4) | 3; // second Sunday of March
+        rule->end = ((uint32_t)TZ_DEFAULT_TIME << 12) | (1 << 4) | 11; // first Sunday of November
+        return 1;
+    }
+    
+    return word[i++] == ',' && TzParseDate(word, length, &i, &rule->start)
+        && i < length && word[i++] == ',' && TzParseDate(word, length, &i, &rule->end) && i == length;
+}
+
+uint8_t TzParseName(const char *word, uint8_t length, uint8_t *index, char *name) {
+    // three or more letters, or anything quoted in <>
+    uint8_t start = *index, end = *index;
+    
+    if (end < length && word[end] == '<') {
+        while (end < length && word[end] != '>') {
+            ++end;
+        }
+        if (end == length) {
+            return 0;
+        }
+        ++end; // keep the brackets
+    } else {
+        while (end < length && word[end] >= 'A' && word[end] <= 'Z') {
+            ++end;
+        }
+    }
+    
+    if (end - start < 3 || end - start > TZ_NAME_SIZE - 1) {
+        return 0;
+    }
+    memcpy(name, word + start, end - start);
+    name[end - start] = '\0';
+    *index = end;
+    return 1;
+}
+
+uint8_t TzParseOffset(const char *word, uint8_t length, uint8_t *index, int32_t *seconds) {
+    // [+|-]hh[:mm[:ss]], hours up to 24
+    uint8_t i = *index, field = 0;
+    int32_t value = 0, part;
+    char sign = '+';
+    
+    if (i < length && (word[i] == '+' || word[i] == '-')) {
+        sign = word[i++];
+    }
+    
+    for (;;) {
+        if (!TzParseDigits(word, length, &i, &part) || part > (field ? 59 : 24)) {
+            return 0;
+        }
+        value = value * 60 + part;
+        if (++field == 3 || i >= length || word[i] != ':') {
+            break;
+        }
+        ++i;
+    }
+    for (; field < 3; ++field) {
+        value *= 60;
+    }
+    
+    *seconds = (sign == '-') ? -value : value;
+    *index = i;
+    return 1;
+}
+
+uint8_t TzParseDigits(const char *word, uint8_t length, uint8_t *index, int32_t *value) {
+    // one or two digits
+    uint8_t i = *index;
+    
+    *value = 0;
+    while (i < length && i - *index < 2 && word[i] >= '0' && word[i] <= '9') {
+        *value = *value * 10 + word[i++] - '0';
+    }
+    if (i == *index) {
+        return 0;
+    }
+    *index = i;
+    return 1;
+}
+
+uint8_t TzParseDate(const char *word, uint8_t length, uint8_t *index, uint32_t *rule) {
+    // Mm.w.d[/time], week 5 is the last, day 0 is Sunday
+    uint8_t i = *index;
+    int32_t month, week, weekday, time = TZ_DEFAULT_TIME;
+    
+    if (i >= length || word[i++] != 'M' || !TzParseDigits(word, length, &i, &month)
+        || i >= length || word[i++] != '.' || !TzParseDigits(word, length, &i, &week)
+        || i >= length || word[i++] != '.' || !TzParseDigits(word, length, &i, &weekday)) {
+        return 0;
+    }
+    if (i < length && word[i] == '/') {
+        ++i;
+        if (!TzParseOffset(word, length, &i, &time) || time < 0) {
+            return 0;
+        }
+    }
+    
+    *rule = ((uint32_t)time << 12) | ((uint32_t)weekday << 8) | ((uint32_t)week << 4) | (uint32_t)month;
+    *index = i;
+    return TzRuleValid(*rule);
+}
+
+void TzRulePut(void) {
+    // the rule back in POSIX form, numeric names for zones set by binary frames
+    const uint32_t rules[2] = {tz_rule.start, tz_rule.end};
+    char buffer[16];
+    uint8_t i;
+    
+    TzNamePut(tz_rule.std_name, tz_rule.std_offset);
+    StringifyOffset(-tz_rule.std_offset, buffer);
+    UART0StringPutNonBlocking(buffer);
+    if (!tz_rule.start) {
+        return;
+    }
+    
+    TzNamePut(tz_rule.dst_name, tz_rule.dst_offset);
+    if (tz_rule.dst_offset != tz_rule.std_offset + 3600) {
+        StringifyOffset(-tz_rule.dst_offset, buffer);
+        UART0StringPutNonBlocking(buffer);
+    }
+    for (i = 0; i < 2; ++i) {
+        UART0StringPutNonBlocking(",M");
+        UART0NumberPutNonBlocking(rules[i] & 0x0f);
+        UART0StringPutNonBlocking(".");
+        UART0NumberPutNonBlocking((rules[i] >> 4) & 0x0f);
+        UART0StringPutNonBlocking(".");
+        UART0NumberPutNonBlocking((rules[i] >> 8) & 0x0f);
+        UART0StringPutNonBlocking("/");
+        StringifyTime(rules[i] >> 12, buffer);
+        UART0StringPutNonBlocking(buffer);
+    }
+}
+
+void TzNamePut(const char *name, int32_t offset) {
+    char buffer[16];
+    
+    if (name[0]) {
+        UART0StringPutNonBlocking(name);
+        return;
+    }
+    StringifyOffset(offset, buffer);
+    UART0StringPutNonBlocking("<");
+    UART0StringPutNonBlocking(buffer);
+    UART0StringPutNonBlocking(">");
+}
+
+void TzStatsPut(void) {
+    datetime_t date;
+    char buffer[16];
+    uint8_t i;
+    
+    RTCRefresh();
+    UART0StringPutNonBlocking("Zone: ");
+    TzRulePut();
+    UART0StringPutNonBlocking("\r\nOffset: ");
+    StringifyOffset(tz_offset, buffer);
+    UART0StringPutNonBlocking(buffer);
+    UART0StringPutNonBlocking(tz_rule.start && tz_offset == tz_rule.dst_offset ? " Daylight" : " Standard");
+    UART0StringPutNonBlocking(tz_view_utc ? " Display: UTC\r\n" : " Display: LOCAL\r\n");
+    
+    for (i = 0; i < TZ_TRANSITIONS && tz_table[i].at != TZ_NEVER; ++i) {
+        EpochCivil(tz_table[i].at, &date);
+        UART0StringPutNonBlocking("Transition: ");
+        StringifyDate(date.year, date.month, date.day, buffer);
+        UART0StringPutNonBlocking(buffer);
+        UART0StringPutNonBlocking(" ");
+        StringifyTime(date.time, buffer);
+        UART0StringPutNonBlocking(buffer);
+        UART0StringPutNonBlocking(" UTC to ");
+        StringifyOffset(tz_table[i].offset, buffer);
+        UART0StringPutNonBlocking(buffer);
+        UART0StringPutNonBlocking("\r\n");
     }
-    return x;
 }
 
-
-uint8_t GetDayOfMonth(uint16_t year, uint8_t month) {
-    static const uint8_t month_day[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
-    uint8_t is_leap;
+void AlarmSet(uint8_t index, uint32_t time, uint8_t weekdays, uint32_t days) {
+    alarm_t *alarm = &alarms[index];
     
-    if (year % 100 == 0) {
-        is_leap = (year % 400 == 0);
-    } else {
-        is_leap = (year % 4 == 0);
+    if (alarm_ringing == index) {
+        AlarmStop();
     }
     
-    if (month == 2 && is_leap) {
-        return 29; // day in February, leap year
-    } else {
-        return month_day[month - 1]; // month is 1-base
-    }
+    RTCRefresh();
+    alarm->time = time;
+    alarm->weekdays = weekdays;
+    alarm->days = days;
+    alarm->used = 1;
+    alarm->snoozes = 0;
+    alarm->due = AlarmNextDue(alarm, rtc_seconds);
+    AlarmQueue(index);
+    AlarmProgram();
+    ROMStoreData();
+    SubscribeAlarmPost(index, SUBSCRIBE_ALARM_SET);
 }
 
-void Delay(uint32_t loop) {
-	uint32_t i;
-	for (i = 0; i < loop; i++);
+void AlarmDelete(uint8_t index) {
+    if (alarm_ringing == index) {
+        AlarmStop();
+    }
+    
+    AlarmDequeue(index);
+    alarms[index].used = 0;
+    AlarmProgram();
+    ROMStoreData();
+    SubscribeAlarmPost(index, SUBSCRIBE_ALARM_DEL);
 }
 
-void ClearSystickCounter(void) {
-    systick_20ms_counter = systick_20ms_flag = 0;
-    systick_250ms_counter = systick_250ms_flag = 0;
-    systick_500ms_counter = systick_500ms_flag = 0;
+uint8_t AlarmSnooze(void) {
+    // Silence the ringing alarm and ring it again later, before its next scheduled ring
+    alarm_t *alarm;
+    uint32_t due;
     
-    // do not clear 1s counter, treat it as ms counter
-    // systick_1s_counter = systick_1s_flag = 0;
+    if (alarm_ringing >= ALARM_COUNT) {
+        return 0;
+    }
+    alarm = &alarms[alarm_ringing];
+    alarm_ringing = ALARM_COUNT;
+    alarming = 0;
+    BuzzerStop();
+    SubscribeAlarmPost(alarm - alarms, SUBSCRIBE_ALARM_SNOOZE);
+    
+    RTCRefresh();
+    due = rtc_seconds + ALARM_SNOOZE_SECONDS;
+    ++alarm->snoozes;
+    if (due < alarm->due) {
+        alarm->due = due;
+        AlarmQueue(alarm - alarms);
+        AlarmProgram();
+    }
+    return 1;
 }
 
-void GPIOInit(void) {
-    // Input: PJ0, PJ1
-    // Output: PF0, PN0, PN1
+void AlarmStop(void) {
+    // Mute the buzzer, the alarm rings again on schedule or was a one-shot and is done
+    alarm_t *alarm;
     
-	SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOF);
-	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOF));
-    GPIOPinTypeGPIOOutput(GPIO_PORTF_BASE, GPIO_PIN_0);
+    alarming = 0;
+    BuzzerStop();
+    if (alarm_ringing >= ALARM_COUNT) {
+        return;
+    }
     
-	SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOJ);
-	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOJ));
-	GPIOPinTypeGPIOInput(GPIO_PORTJ_BASE, GPIO_PIN_0 | GPIO_PIN_1);
-	GPIOPadConfigSet(GPIO_PORTJ_BASE, GPIO_PIN_0 | GPIO_PIN_1, GPIO_STRENGTH_2MA, GPIO_PIN_TYPE_STD_WPU);
+    alarm = &alarms[alarm_ringing];
+    SubscribeAlarmPost(alarm_ringing, SUBSCRIBE_ALARM_MUTE);
+    alarm_ringing = ALARM_COUNT;
+    alarm->snoozes = 0;
+    if (alarm->due == ALARM_NEVER) {
+        alarm->used = 0;
+        ROMStoreData();
+    }
+}
+
+void AlarmPoll(void) {
+    // Called with rtc_seconds just refreshed, only the heap root can be due
+    alarm_match_flag = 0;
+    if (!alarm_queued || alarms[alarm_heap[0]].due > rtc_seconds) {
+        return;
+    }
     
-	SysCtlPeripheralEnable(SYSCTL_PERIPH_GPION);
-	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPION));
-    GPIOPinTypeGPIOOutput(GPIO_PORTN_BASE, GPIO_PIN_0 | GPIO_PIN_1);
+    while (alarm_queued && alarms[alarm_heap[0]].due <= rtc_seconds) {
+        AlarmRing(alarm_heap[0]);
+    }
+    AlarmProgram();
 }
 
-void UART0Init(void) {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_UART0);
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_UART0));
+void AlarmRing(uint8_t index) {
+    alarm_t *alarm = &alarms[index];
     
-    // PA0 -> UART0_RX, PA1 -> UART0_TX
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOA);
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOA));
-    GPIOPinConfigure(GPIO_PA0_U0RX);
-    GPIOPinConfigure(GPIO_PA1_U0TX);
-    GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
+    if (alarm_ringing != index) {
+        AlarmStop(); // the newest alarm takes over the buzzer
+    }
+    alarm_ringing = index;
     
-    // 115200 baud, 8-N-1 format
-    UARTConfigSetExpClk(UART0_BASE, sys_clock_freq, 115200,
-        UART_CONFIG_WLEN_8 | UART_CONFIG_PAR_NONE | UART_CONFIG_STOP_ONE);
+    // a one-shot alarm leaves the heap and is freed once muted
+    alarm->due = (alarm->weekdays || alarm->days) ? AlarmNextDue(alarm, rtc_seconds) : ALARM_NEVER;
+    AlarmQueue(index);
     
-    // Enable UART0 interrupter
-    IntEnable(INT_UART0);
-    UARTIntEnable(UART0_BASE, UART_INT_RX | UART_INT_RT);
+    // start now instead of at the next 250ms tick
+    BuzzerStart(880);
+    alarming = 2;
+    SubscribeAlarmPost(index, SUBSCRIBE_ALARM_RING);
+}
+
+void AlarmReschedule(void) {
+    // The RTC was rebased or started, schedule every alarm from the current time on.
+    // Snoozes are dropped, their due is meaningless on the new counter.
+    uint8_t i;
     
-    DEBUG("UART0 Setup\r\n");
+    AlarmStop();
+    alarm_queued = 0;
+    for (i = 0; i < ALARM_COUNT; ++i) {
+        if (alarms[i].snoozes && !alarms[i].weekdays && !alarms[i].days) {
+            alarms[i].used = 0; // a snoozed one-shot alarm already rang
+        }
+        alarms[i].heap = ALARM_COUNT;
+        alarms[i].snoozes = 0;
+        alarms[i].due = ALARM_NEVER;
+        if (alarms[i].used) {
+            alarms[i].due = AlarmNextDue(&alarms[i], rtc_seconds);
+            AlarmQueue(i);
+        }
+    }
+    AlarmProgram();
 }
 
-void UART0StringPutNonBlocking(const char *message) {
-	uint8_t fifo_free = 0;
-    while(*message != '\0') {
-        fifo_free = UARTCharPutNonBlocking(UART0_BASE, *(message));
-        if(fifo_free) {  
-            message++;
+uint32_t AlarmNextDue(const alarm_t *alarm, uint32_t after) {
+    // First scheduled ring later than RTC second after, trying local days from the day of after.
+    // Alarms follow local time whatever the display view is.
+    datetime_t date;
+    int64_t utc = rtc_epoch + after;
+    int32_t day = EpochDay(utc + TzTransitions(utc, NULL));
+    uint8_t i;
+    
+    for (i = 0; i < ALARM_SEARCH_DAYS; ++i, ++day) {
+        int64_t due = TzLocalToUtc((int64_t)day * 86400 + alarm->time) - rtc_epoch;
+        
+        if (due <= (int64_t)after) {
+            continue;
+        } else if (due >= ALARM_NEVER) {
+            break;
+        }
+        if ((!alarm->weekdays && !alarm->days) || (alarm->weekdays & (1 << GetDayOfWeek(day)))) {
+            return (uint32_t)due;
+        }
+        if (alarm->days) {
+            CivilFromDays(day, &date);
+            if (alarm->days & (1ul << date.day)) {
+                return (uint32_t)due;
+            }
         }
-        fifo_free = 0;
     }
+    
+    return ALARM_NEVER;
 }
 
-void UART0NumberPutNonBlocking(int64_t data) {
-    static uint8_t buffer[20];
-    uint8_t flag = 0;
-    uint8_t cur = 19;
+void AlarmQueue(uint8_t index) {
+    // Insert the alarm or move it after its due changed, ALARM_NEVER leaves the heap
+    alarm_t *alarm = &alarms[index];
     
-    if (data == 0) {
-        UART0StringPutNonBlocking("0");
+    if (alarm->due == ALARM_NEVER) {
+        AlarmDequeue(index);
         return;
     }
     
-    if (data < 0) {
-        flag = 1;
-        data = -data;
+    if (alarm->heap == ALARM_COUNT) {
+        alarm->heap = alarm_queued;
+        alarm_heap[alarm_queued++] = index;
     }
+    AlarmHeapFix(alarm->heap);
+}
+
+void AlarmDequeue(uint8_t index) {
+    uint8_t position = alarms[index].heap;
     
-    buffer[19] = '\0';
-    while (cur > 0 && data) {
-        --cur;
-        buffer[cur] = data % 10 + '0';
-        data /= 10;
+    if (position == ALARM_COUNT) {
+        return;
     }
+    alarms[index].heap = ALARM_COUNT;
     
-    if (flag) {
-        buffer[--cur] = '-';
+    // fill the hole with the last leaf
+    if (position < --alarm_queued) {
+        alarm_heap[position] = alarm_heap[alarm_queued];
+        alarms[alarm_heap[position]].heap = position;
+        AlarmHeapFix(position);
     }
-    
-    UART0StringPutNonBlocking((const char *)buffer + cur);
 }
 
-void I2C0Init(void) {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_I2C0);
-	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_I2C0));
-    
-    // PB2 -> I2C0_SCL, PB3 -> I2C0_SDA
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOB);
-	while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOB));
-    GPIOPinConfigure(GPIO_PB2_I2C0SCL);
-    GPIOPinConfigure(GPIO_PB3_I2C0SDA);
-    GPIOPinTypeI2CSCL(GPIO_PORTB_BASE, GPIO_PIN_2);
-    GPIOPinTypeI2C(GPIO_PORTB_BASE, GPIO_PIN_3);
-    
-    I2CMasterInitExpClk(I2C0_BASE, sys_clock_freq, true);
-	I2CMasterEnable(I2C0_BASE);
+void AlarmHeapFix(uint8_t position) {
+    // Sift up, then down, whichever way the due moved
+    uint8_t child;
     
-    // TCA6424 config
-    I2C0WriteByte(TCA6424_I2CADDR, TCA6424_CONFIG_PORT0, 0xff); // port0: input
-    I2C0WriteByte(TCA6424_I2CADDR, TCA6424_CONFIG_PORT1, 0x00); // port1: output
-    I2C0WriteByte(TCA6424_I2CADDR, TCA6424_CONFIG_PORT2, 0x00); // port2: output
+    while (position > 0 && alarms[alarm_heap[(position - 1) / 2]].due > alarms[alarm_heap[position]].due) {
+        AlarmHeapSwap(position, (position - 1) / 2);
+        position = (position - 1) / 2;
+    }
     
-    // PCA9557 config
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_CONFIG, 0x00); // port: output
-    I2C0WriteByte(PCA9557_I2CADDR, PCA9557_OUTPUT, 0xff); // turn off led1-8
+    while ((child = position * 2 + 1) < alarm_queued) {
+        if (child + 1 < alarm_queued && alarms[alarm_heap[child + 1]].due < alarms[alarm_heap[child]].due) {
+            ++child;
+        }
+        if (alarms[alarm_heap[child]].due >= alarms[alarm_heap[position]].due) {
+            break;
+        }
+        AlarmHeapSwap(position, child);
+        position = child;
+    }
 }
 
-uint8_t I2C0WriteByte(uint8_t device, uint8_t reg, uint8_t data) {
-	uint8_t error;
+void AlarmHeapSwap(uint8_t a, uint8_t b) {
+    uint8_t index = alarm_heap[a];
     
-    while (I2CMasterBusy(I2C0_BASE));
-	I2CMasterSlaveAddrSet(I2C0_BASE, device, false);
-	I2CMasterDataPut(I2C0_BASE, reg);
-	I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_START);
-    
-	while (I2CMasterBusy(I2C0_BASE));
-	error = (uint8_t)I2CMasterErr(I2C0_BASE);
+    alarm_heap[a] = alarm_heap[b];
+    alarm_heap[b] = index;
+    alarms[alarm_heap[a]].heap = a;
+    alarms[alarm_heap[b]].heap = b;
+}
 
-	I2CMasterDataPut(I2C0_BASE, data);
-	I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_FINISH);
-	while(I2CMasterBusy(I2C0_BASE));
-	error = (uint8_t)I2CMasterErr(I2C0_BASE);
+void AlarmProgram(void) {
+    // Arm the RTC match with the earliest alarm, its interrupt wakes the main loop on the second.
+    // An armed SYNC step takes the match when it comes first, SYNC_STEP_LEAD before its sub-second.
+    uint32_t due = alarm_queued ? alarms[alarm_heap[0]].due : ALARM_NEVER;
+    uint32_t subsecond = 0;
+    uint64_t wake = sync_step_at - SYNC_STEP_LEAD;
     
-	return error;
+    if (sync_step_at && wake / RTC_SUBSECONDS < due) {
+        due = (uint32_t)(wake / RTC_SUBSECONDS);
+        subsecond = (uint32_t)(wake % RTC_SUBSECONDS);
+    }
+    HibernateRTCSSMatchSet(0, subsecond);
+    HibernateRTCMatchSet(0, due);
+    if (RTCTicks() >= (uint64_t)due * RTC_SUBSECONDS + subsecond) {
+        alarm_match_flag = 1; // passed while it was being set, the match will not fire
+    }
 }
 
-uint8_t I2C0ReadByte(uint8_t device, uint8_t reg) {
-	uint8_t data, error;
+uint8_t AlarmParseRepeat(const char *word, uint8_t length, uint8_t *weekdays, uint32_t *days) {
+    // ONCE, DAILY, WEEKDAYS, WEEKENDS or a comma separated list of SUN-SAT and 1-31
+    uint8_t i, start = 0, end;
     
-    while (I2CMasterBusy(I2C0_BASE));
-	I2CMasterSlaveAddrSet(I2C0_BASE, device, false);
-	I2CMasterDataPut(I2C0_BASE, reg);
-	I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_SINGLE_SEND);
+    *weekdays = 0;
+    *days = 0;
+    if (length == 4 && strncmp(word, "ONCE", 4) == 0) {
+        return 1;
+    } else if (length == 5 && strncmp(word, "DAILY", 5) == 0) {
+        *weekdays = ALARM_DAILY;
+        return 1;
+    } else if (length == 8 && strncmp(word, "WEEKDAYS", 8) == 0) {
+        *weekdays = 0x3e;
+        return 1;
+    } else if (length == 8 && strncmp(word, "WEEKENDS", 8) == 0) {
+        *weekdays = 0x41;
+        return 1;
+    }
     
-	while (I2CMasterBusBusy(I2C0_BASE));
-	error = (uint8_t)I2CMasterErr(I2C0_BASE);
-    Delay(10);
-
-	// Receive data
-	I2CMasterSlaveAddrSet(I2C0_BASE, device, true);
-	I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_SINGLE_RECEIVE);
+    while (start < length) {
+        for (end = start; end < length && word[end] != ','; ++end);
+        
+        if (end - start == 3 && word[start] > '9') {
+            for (i = 0; i < 7 && strncmp(word + start, weekday_names[i], 3) != 0; ++i);
+            if (i == 7) {
+                return 0;
+            }
+            *weekdays |= 1 << i;
+        } else {
+            uint8_t day = 0;
+            
+            if (end - start == 0 || end - start > 2) {
+                return 0;
+            }
+            for (i = start; i < end; ++i) {
+                if (word[i] < '0' || word[i] > '9') {
+                    return 0;
+                }
+                day = day * 10 + word[i] - '0';
+            }
+            if (day < 1 || day > 31) {
+                return 0;
+            }
+            *days |= 1ul << day;
+        }
+        
+        start = end + 1;
+        if (end + 1 == length) {
+            return 0; // trailing comma
+        }
+    }
     
-	while (I2CMasterBusBusy(I2C0_BASE));
-	data = I2CMasterDataGet(I2C0_BASE);
-    Delay(10);
-	
-    return data;
+    return 1;
 }
 
-void BuzzerInit(void) {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_PWM0);
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_PWM0));
-    PWMOutputState(PWM0_BASE, PWM_OUT_3_BIT, true);
+void AlarmRepeatPut(const alarm_t *alarm) {
+    const char *separator = "";
+    uint8_t i;
     
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOF);
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_GPIOF));
-    GPIOPinConfigure(GPIO_PF3_M0PWM3);
-    GPIOPinTypePWM(GPIO_PORTF_BASE, GPIO_PIN_3);
+    if (!alarm->weekdays && !alarm->days) {
+        UART0StringPutNonBlocking("ONCE");
+        return;
+    } else if (!alarm->days && alarm->weekdays == ALARM_DAILY) {
+        UART0StringPutNonBlocking("DAILY");
+        return;
+    }
     
-    PWMGenConfigure(PWM0_BASE, PWM_GEN_1, PWM_GEN_MODE_DOWN | PWM_GEN_MODE_NO_SYNC);
+    for (i = 0; i < 7; ++i) {
+        if (alarm->weekdays & (1 << i)) {
+            UART0StringPutNonBlocking(separator);
+            UART0StringPutNonBlocking(weekday_names[i]);
+            separator = ",";
+        }
+    }
+    for (i = 1; i <= 31; ++i) {
+        if (alarm->days & (1ul << i)) {
+            UART0StringPutNonBlocking(separator);
+            UART0NumberPutNonBlocking(i);
+            separator = ",";
+        }
+    }
 }
 
-void BuzzerStart(uint32_t freq) {
-    PWMGenPeriodSet(PWM0_BASE, PWM_GEN_1, sys_clock_freq / freq);
-    PWMPulseWidthSet(PWM0_BASE, PWM_OUT_3, PWMGenPeriodGet(PWM0_BASE, PWM_GEN_1) / 2); // 0.5
-    PWMGenEnable(PWM0_BASE, PWM_GEN_1);
+void AlarmListPut(void) {
+    char buffer[16];
+    uint8_t i, count = 0;
+    
+    RTCRefresh();
+    for (i = 0; i < ALARM_COUNT; ++i) {
+        const alarm_t *alarm = &alarms[i];
+        
+        if (!alarm->used) {
+            continue;
+        }
+        ++count;
+        
+        UART0StringPutNonBlocking("#");
+        UART0NumberPutNonBlocking(i);
+        UART0StringPutNonBlocking(" ");
+        StringifyTime(alarm->time, buffer);
+        UART0StringPutNonBlocking(buffer);
+        UART0StringPutNonBlocking(" ");
+        AlarmRepeatPut(alarm);
+        
+        if (alarm->due != ALARM_NEVER) {
+            int64_t utc = rtc_epoch + alarm->due;
+            datetime_t date;
+            
+            EpochCivil(tz_view_utc ? utc : utc + TzTransitions(utc, NULL), &date); // in the display view
+            UART0StringPutNonBlocking(" Next ");
+            StringifyDate(date.year, date.month, date.day, buffer);
+            UART0StringPutNonBlocking(buffer);
+            UART0StringPutNonBlocking(" ");
+            StringifyTime(date.time, buffer);
+            UART0StringPutNonBlocking(buffer);
+        }
+        if (alarm->snoozes) {
+            UART0StringPutNonBlocking(" Snoozed ");
+            UART0NumberPutNonBlocking(alarm->snoozes);
+        }
+        UART0StringPutNonBlocking(alarm_ringing == i ? " Ringing\r\n" : "\r\n");
+    }
+    
+    if (!count) {
+        UART0StringPutNonBlocking("No Alarms\r\n");
+    }
 }
 
-void BuzzerStop(void) {
-    PWMGenDisable(PWM0_BASE, PWM_GEN_1);
+void ROMInit(void) {
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_EEPROM0);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_EEPROM0));
+    
+    EEPROMInit();
+    ROMFind();
 }
 
-void RTCInit(void) {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_HIBERNATE);
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_HIBERNATE));
-    
-    HibernateEnableExpClk(sys_clock_freq);
-    HibernateClockConfig(HIBERNATE_OSC_LOWDRIVE);
-    HibernateRTCEnable();
-    HibernateCounterMode(HIBERNATE_COUNTER_24HR);
+void ROMStoreData(void) {
+    // Request a commit, changes in quick succession are merged into one slot write
+    ++rom_requests;
+    rom_last_change = systick_ms;
+    if (!rom_dirty) {
+        rom_dirty = 1;
+        rom_first_change = rom_last_change;
+    }
 }
 
-void RTCStoreData(void) {
-    struct tm ps_time;
+void ROMLoadData(void) {
+    int64_t utc;
+    uint8_t i;
     
-    ps_time.tm_year = datetime.year - 1900;
-    ps_time.tm_mon = datetime.month - 1;
-    ps_time.tm_mday = datetime.day;
-    ps_time.tm_hour = datetime.time / 3600;
-    ps_time.tm_min = datetime.time / 60 % 60;
-    ps_time.tm_sec = datetime.time % 60;
+    if (!rom_valid) {
+        return; // no data stored
+    }
     
-    HibernateCalendarSet(&ps_time);
-    // RTC has a 1/32768s counter
-    HibernateRTCSSMatchSet(0, (uint32_t)systick_1s_counter * 32768 / 1000);
+    for (i = 0; i < ALARM_COUNT; ++i) {
+        alarms[i].time = rom_record.alarms[i][0] & 0x1ffff;
+        alarms[i].weekdays = (rom_record.alarms[i][0] >> 17) & ALARM_DAILY;
+        alarms[i].used = rom_record.alarms[i][0] >> 31;
+        alarms[i].days = rom_record.alarms[i][1];
+    }
+    uart0_baud_saved = rom_record.baud;
+    if (rom_record.flow_speed >= -2 && rom_record.flow_speed <= 2) {
+        flow_speed = rom_record.flow_speed;
+    }
+    tz_rule = rom_record.zone;
+    tz_rule.std_name[TZ_NAME_SIZE - 1] = tz_rule.dst_name[TZ_NAME_SIZE - 1] = '\0';
+    tz_view_utc = rom_record.display_utc != 0;
+    if (rom_record.brightness >= DISPLAY_BRIGHTNESS_MIN && rom_record.brightness <= 100) {
+        display_brightness = rom_record.brightness;
+    }
+    if (rom_record.dim_level <= 100 && rom_record.dim_start < 86400 && rom_record.dim_end < 86400) {
+        display_dim_level = rom_record.dim_level;
+        display_dim_start = rom_record.dim_start;
+        display_dim_end = rom_record.dim_end;
+    }
+    display_off = rom_record.display_off != 0;
+    if (rom_record.sync_freq >= -SYNC_FREQ_MAX_PPB && rom_record.sync_freq <= SYNC_FREQ_MAX_PPB) {
+        sync_freq_ppb = sync_freq_saved = rom_record.sync_freq;
+    }
     
-    ROMStoreData();
+    if (load_rom) { // the RTC is not running, best known time is the last commit
+        utc = (int64_t)DaysFromCivil(rom_record.date >> 16, (rom_record.date >> 8) & 0xff, rom_record.date & 0xff)
+            * 86400 + rom_record.time;
+        TzExpand(utc);
+        EpochCivil(utc + tz_view_offset, &datetime); // RTCStoreData reads it in the display view
+    }
 }
 
-void RTCLoadData(void) {
-    struct tm ps_time;
+void ROMPoll(void) {
+    if (rom_dirty && ((int32_t)(systick_ms - rom_last_change) >= ROM_COALESCE_MS
+        || (int32_t)(systick_ms - rom_first_change) >= ROM_MAX_DELAY_MS)) {
+        ROMCommit();
+    }
+}
+
+void ROMCommit(void) {
+    // Write the state to the slot after rom_head, the older slots stay valid if power fails meanwhile
+    rom_record_t record;
+    datetime_t utc;
+    uint32_t data[HIB_DATA_WORDS];
+    uint8_t i, slot = (rom_head + 1) % ROM_SLOTS;
     
-    if (load_rom) {
-        ROMLoadData();
-        load_rom = 0;
+    rom_dirty = 0;
+    RTCRefresh();
+    EpochCivil(epoch_seconds, &utc);
+    
+    memset(&record, 0, sizeof(record));
+    record.magic = ROM_MAGIC;
+    record.version = ROM_VERSION;
+    record.date = ((uint32_t)(utc.year) << 16) | ((uint32_t)(utc.month) << 8) | utc.day;
+    record.time = utc.time;
+    record.baud = uart0_baud_saved;
+    record.flow_speed = flow_speed;
+    record.zone = tz_rule;
+    record.display_utc = tz_view_utc;
+    record.brightness = display_brightness;
+    record.dim_level = display_dim_level;
+    record.dim_start = display_dim_start;
+    record.dim_end = display_dim_end;
+    record.display_off = display_off;
+    record.sync_freq = sync_freq_saved;
+    for (i = 0; i < ALARM_COUNT; ++i) {
+        record.alarms[i][0] = ((uint32_t)alarms[i].used << 31) | ((uint32_t)alarms[i].weekdays << 17) | alarms[i].time;
+        record.alarms[i][1] = alarms[i].days;
+    }
+    
+    // settings changed back and forth, and the time only moved on, which the RTC keeps anyway
+    if (rom_valid && !rom_clock_set && memcmp(&rom_record.baud, &record.baud,
+        (const uint8_t *)&record.crc - (const uint8_t *)&record.baud) == 0) {
+        ++rom_elided;
         return;
     }
     
-    HibernateCalendarGet(&ps_time);
+    record.sequence = rom_valid ? rom_record.sequence + 1 : 1;
+    record.crc = Crc16((const uint8_t *)&record, sizeof(record) - sizeof(record.crc));
+    
+    if (EEPROMProgram((uint32_t *)&record, ROM_ADDRESS + slot * sizeof(record), sizeof(record)) != 0) {
+        ++rom_errors;
+        rom_dirty = 1; // ROMPoll retries the same slot after ROM_COALESCE_MS, rom_clock_set is kept
+        rom_first_change = rom_last_change = systick_ms;
+        return;
+    }
+    ++rom_commits;
+    rom_clock_set = 0;
     
-    systick_1s_counter = HibernateRTCSSGet() * 1000 / 32768;
+    rom_record = record;
+    rom_valid = 1;
+    rom_head = slot;
     
-    datetime.year = ps_time.tm_year + 1900;
-    datetime.month = ps_time.tm_mon + 1;
-    datetime.day = ps_time.tm_mday;
-    datetime.time = ps_time.tm_hour * 3600 + ps_time.tm_min * 60 + ps_time.tm_sec;
+    // remember the head across resets so the next boot reads one slot instead of scanning
+    HibernateDataGet(data, HIB_DATA_WORDS);
+    data[HIB_DATA_ROM_HEAD] = slot;
+    data[HIB_DATA_ROM_HEAD + 1] = ~data[HIB_DATA_ROM_HEAD];
+    HibernateDataSet(data, HIB_DATA_WORDS);
 }
 
-void ROMInit(void) {
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_EEPROM0);
-    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_EEPROM0));
+void ROMFind(void) {
+    // Locate the newest valid record: O(1) with the head kept in hibernate memory,
+    // a scan of every slot after the battery was lost
+    rom_record_t record;
+    uint32_t data[HIB_DATA_WORDS];
+    uint8_t slot, hint;
     
-    EEPROMInit();
+    HibernateDataGet(data, HIB_DATA_WORDS);
+    hint = data[HIB_DATA_ROM_HEAD];
+    if (!load_rom && data[HIB_DATA_ROM_HEAD + 1] == ~data[HIB_DATA_ROM_HEAD] && hint < ROM_SLOTS
+        && ROMSlotRead(hint, &rom_record)) {
+        // the slot after the head must be older, otherwise the hint is stale
+        slot = (hint + 1) % ROM_SLOTS;
+        if (!ROMSlotRead(slot, &record) || record.sequence < rom_record.sequence) {
+            rom_valid = 1;
+            rom_head = hint;
+            return;
+        }
+    }
+    
+    rom_scanned = 1;
+    rom_valid = 0;
+    for (slot = 0; slot < ROM_SLOTS; ++slot) {
+        if (ROMSlotRead(slot, &record) && (!rom_valid || record.sequence > rom_record.sequence)) {
+            rom_record = record;
+            rom_valid = 1;
+            rom_head = slot;
+        }
+    }
 }
 
-void ROMStoreData(void) {
-    uint32_t data[4];
+uint8_t ROMSlotRead(uint8_t slot, rom_record_t *record) {
+    EEPROMRead((uint32_t *)record, ROM_ADDRESS + slot * sizeof(*record), sizeof(*record));
     
-    data[0] = ROM_MAGIC;
-    data[1] = ((uint32_t)(datetime.year) << 16) | ((uint32_t)(datetime.month) << 8) | datetime.day;
-    data[2] = datetime.time;
-    data[3] = alarm_time;
+    return record->magic == ROM_MAGIC && record->version == ROM_VERSION
+        && record->crc == Crc16((const uint8_t *)record, sizeof(*record) - sizeof(record->crc));
 }
 
-void ROMLoadData(void) {
-    uint32_t data[4];
-    EEPROMRead(data, ROM_ADDRESS, sizeof(data));
-    
-    if (data[0] != ROM_MAGIC) {
-        return; // no data stored
-    }
+void ROMStatsPut(void) {
+    uint32_t sequence = rom_valid ? rom_record.sequence : 0;
     
-    datetime.year = data[1] >> 16;
-    datetime.month = (data[1] >> 8) & 0xff;
-    datetime.day = data[1] & 0xff;
-    datetime.time = data[2];
-    alarm_time = data[3];
+    UART0StringPutNonBlocking("Journal: Slot ");
+    UART0NumberPutNonBlocking(rom_head);
+    UART0StringPutNonBlocking("/");
+    UART0NumberPutNonBlocking(ROM_SLOTS);
+    UART0StringPutNonBlocking(" Sequence ");
+    UART0NumberPutNonBlocking(sequence);
+    UART0StringPutNonBlocking(rom_scanned ? " (found by scan)" : " (found by hint)");
+    UART0StringPutNonBlocking(rom_dirty ? " Pending" : "");
+    UART0StringPutNonBlocking("\r\nRequests: ");
+    UART0NumberPutNonBlocking(rom_requests);
+    UART0StringPutNonBlocking(" Commits: ");
+    UART0NumberPutNonBlocking(rom_commits);
+    UART0StringPutNonBlocking(" Elided: ");
+    UART0NumberPutNonBlocking(rom_elided);
+    UART0StringPutNonBlocking(" Errors: ");
+    UART0NumberPutNonBlocking(rom_errors);
+    // slots are written in turn, so the sequence gives the writes per block, not counting
+    // any made before the journal was last started from an empty EEPROM
+    UART0StringPutNonBlocking("\r\nWear (estimated): ");
+    UART0NumberPutNonBlocking((sequence + ROM_SLOTS - 1) / ROM_SLOTS);
+    UART0StringPutNonBlocking("/");
+    UART0NumberPutNonBlocking(ROM_ENDURANCE);
+    UART0StringPutNonBlocking(" writes per block, ");
+    UART0NumberPutNonBlocking((uint32_t)ROM_SLOTS * ROM_ENDURANCE - sequence);
+    UART0StringPutNonBlocking(" commits left\r\n");
 }
 
 void SysTick_Handler(void) {
-    if (++systick_20ms_counter >= SYSTICK_FREQUENCY / 50) {
+    uint16_t step = systick_step; // ms in the period that just ended
+    
+    systick_step = systick_next_step; // reloaded by hardware at the wrap
+    ++systick_interrupts;
+    systick_ms += step; // events are stamped with the end of the period
+    if (systick_ms < step) {
+        ++systick_ms_wraps;
+    }
+    
+    if ((systick_20ms_counter += step) >= SYSTICK_FREQUENCY / 50) {
         systick_20ms_counter = 0;
-        systick_20ms_flag = 1;
+        EventPost(EVENT_TICK_20MS, 0);
     }
     
-    if (++systick_250ms_counter >= SYSTICK_FREQUENCY / 4) {
+    if ((systick_250ms_counter += step) >= SYSTICK_FREQUENCY / 4) {
         systick_250ms_counter = 0;
-        systick_250ms_flag = 1;
+        EventPost(EVENT_TICK_250MS, 0);
     }
     
-    if (++systick_500ms_counter >= SYSTICK_FREQUENCY / 2) {
+    if ((systick_500ms_counter += step) >= SYSTICK_FREQUENCY / 2) {
         systick_500ms_counter = 0;
-        systick_500ms_flag = 1;
+        EventPost(EVENT_TICK_500MS, 0);
     }
     
-    if (++systick_1s_counter >= SYSTICK_FREQUENCY) {
-        systick_1s_counter = 0;
-        systick_1s_flag = 1;
+    if ((systick_1s_counter += step) >= SYSTICK_FREQUENCY) {
+        systick_1s_counter -= SYSTICK_FREQUENCY; // keep the phase of the wall clock
+        EventPost(EVENT_TICK_1S, 0);
     }
+    
+#if SYSTICK_DYNAMIC
+    // The reload register only takes effect at the next wrap, so plan one period ahead.
+    // No counter deadline is skipped, the core sleeps through the ticks in between.
+    systick_next_step = SystickNextStep(systick_step);
+    SysTickPeriodSet(systick_next_step * (sys_clock_freq / SYSTICK_FREQUENCY));
+#endif
 }
 
 void UART0_Handler(void) {
     int32_t uart0_int_status;
     static uint8_t uart_receive_cmd_cur = 0; // pointer to index of next char
+    static uint8_t last_char = 0;
+    char *line = uart0_rx_lines[uart0_rx_head]; // free slot, not visible to main loop
     
     // Get and clear the interrrupt status.
     uart0_int_status = UARTIntStatus(UART0_BASE, true);
     UARTIntClear(UART0_BASE, uart0_int_status);
+    
+    if (uart0_int_status & UART_INT_TX) {
+        UART0TxFill(); // refill FIFO from the ring buffer
+    }
 
     // Loop while there are characters in the receive FIFO.
     while (UARTCharsAvail(UART0_BASE)) {
-        command[uart_receive_cmd_cur] = UARTCharGetNonBlocking(UART0_BASE);
-        if (command[uart_receive_cmd_cur] == '\n') {
-            // A command should end with \r\n
-            if (uart_receive_cmd_cur > 0 && command[uart_receive_cmd_cur - 1] == '\r') {
-                command[uart_receive_cmd_cur - 1] = '\0'; // directly replace \r with \0
-                command[uart_receive_cmd_cur] = '\0';
-                uart_receive_cmd_cur = 0;
-                command_ready = 1;
+        uint8_t c = UARTCharGetNonBlocking(UART0_BASE);
+        
+        ++uart0_rx_bytes;
+        if (uart0_binary ? c == 0x00 : (c == '\n' && last_char == '\r')) {
+            // A command should end with \r\n, a frame with 0x00
+            uint8_t next = (uart0_rx_head + 1) & (UART0_RX_LINES - 1);
+            
+            line[uart_receive_cmd_cur] = '\0'; // \r is held back, see below
+            uart_receive_cmd_cur = 0;
+            uart0_rx_stamps[uart0_rx_head] = RTCTicks();
+            if (uart0_int_status & UART_INT_RT) { // the receive timeout fires 32 bits after the last byte
+                uart0_rx_stamps[uart0_rx_head] -= 32 * RTC_SUBSECONDS / uart0_baud;
+            }
+            
+            if (next == uart0_rx_tail) {
+                ++uart0_rx_dropped; // main loop is behind, reuse the slot
+                uart0_rx_too_long[uart0_rx_head] = 0;
+            } else {
+                uart0_rx_head = next; // publish the line
+                line = uart0_rx_lines[uart0_rx_head];
+                uart0_rx_too_long[uart0_rx_head] = 0;
+            }
+        } else if (uart0_binary) {
+            UART0RxStore(line, &uart_receive_cmd_cur, c); // COBS bytes are never 0x00, line stays a string
+        } else {
+            if (last_char == '\r') {
+                UART0RxStore(line, &uart_receive_cmd_cur, '\r'); // not followed by \n, part of the command
             }
+            if (c != '\r') {
+                UART0RxStore(line, &uart_receive_cmd_cur, c);
+            }
+        }
+        
+        last_char = c;
+    }
+}
+
+void TIMER0A_Handler(void) {
+    uint32_t start = PerfStart();
+    uint32_t issued = i2c0_stats.shadow_issued;
+    uint32_t on = display_on_cycles;
+#if DISPLAY_BURST_WRITE
+    uint8_t data[4];
+#endif
+    
+    TimerIntClear(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+    if (!on) {
+        return; // blank, DisplayBrightnessUpdate stopped the timer
+    }
+    
+    // reload first, so the slot length does not depend on the bus
+    if (display_dark) {
+        display_dark = 0;
+        TimerLoadSet(TIMER0_BASE, TIMER_A, display_slot_cycles - on);
+        TimerEnable(TIMER0_BASE, TIMER_A);
+        ExpanderWriteAsync(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // dark until the next digit
+        display_transactions += i2c0_stats.shadow_issued - issued;
+        PerfRecord(PERF_STAGE_SCAN, start);
+        return;
+    }
+    display_dark = (on < display_slot_cycles);
+    TimerLoadSet(TIMER0_BASE, TIMER_A, display_dark ? on : display_slot_cycles);
+    TimerEnable(TIMER0_BASE, TIMER_A);
+    
+    if (I2C0_QUEUE_SIZE - 1 - I2C0QueueDepth() < 3) {
+        return; // bus is saturated, keep current digit lit
+    }
+    
+    if (++display_digit >= DISPLAY_DIGITS) {
+        display_digit = 0;
+        if (display_swap_pending) { // frame boundary, show the new frame
+            display_front = !display_front;
+            display_swap_pending = 0;
+        }
+        i2c0_stats.display_frame_transactions = display_transactions;
+        display_transactions = 0;
+    }
+    
+#if DISPLAY_BURST_WRITE
+    // PORT1, PORT2, rolls over to PORT0 (input only, value ignored), PORT1
+    data[0] = 0x00; // prevent ghost digit
+    data[1] = 0x01 << display_digit;
+    data[2] = 0xff;
+    data[3] = display_buffer[display_front][display_digit];
+    ExpanderWriteBurstAsync(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, data, 4);
+#else
+    ExpanderWriteAsync(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, 0x00); // prevent ghost digit
+    ExpanderWriteAsync(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT2, 0x01 << display_digit);
+    ExpanderWriteAsync(TCA6424_I2CADDR, TCA6424_OUTPUT_PORT1, display_buffer[display_front][display_digit]);
+#endif
+    
+    display_transactions += i2c0_stats.shadow_issued - issued;
+    PerfRecord(PERF_STAGE_SCAN, start);
+}
+
+void I2C0_Handler(void) {
+    i2c_transaction_t *transaction = &i2c0_queue[i2c0_queue_tail];
+    uint32_t error;
+    
+    I2CMasterIntClear(I2C0_BASE);
+    
+    if (i2c0_state == I2C0_STATE_IDLE) {
+        return;
+    }
+    
+    error = I2CMasterErr(I2C0_BASE);
+    if (error != I2C_MASTER_ERR_NONE) {
+        if (error & I2C_MASTER_ERR_ARB_LOST) {
+            ++i2c0_stats.arb_errors; // bus released by hardware
         } else {
-            uart_receive_cmd_cur++;
-            if (uart_receive_cmd_cur > 128) {
-                // TODO: command to long
+            if (error & (I2C_MASTER_ERR_ADDR_ACK | I2C_MASTER_ERR_DATA_ACK)) {
+                ++i2c0_stats.nak_errors;
             }
+            if (error & I2C_MASTER_ERR_CLK_TOUT) {
+                ++i2c0_stats.timeout_errors;
+            }
+            I2CMasterControl(I2C0_BASE, I2C_MASTER_CMD_BURST_SEND_ERROR_STOP);
+            while (I2CMasterBusy(I2C0_BASE)); // a few us for the stop condition
         }
+        transaction->error = error;
+        I2C0Complete();
+        return;
+    }
+    
+    switch (i2c0_state) {
+        case I2C0_STATE_WRITE:
+            if (i2c0_index < transaction->length) {
+                I2CMasterDataPut(I2C0_BASE, transaction->data[i2c0_index]);
+                ++i2c0_index;
+                I2CMasterControl(I2C0_BASE, i2c0_index == transaction->length ?
+                    I2C_MASTER_CMD_BURST_SEND_FINISH : I2C_MASTER_CMD_BURST_SEND_CONT);
+            } else {
+                I2C0Complete(); // stop condition sent
+            }
+            break;
+        case I2C0_STATE_READ_ADDR:
+            // repeated start as receiver
+            I2CMasterSlaveAddrSet(I2C0_BASE, transaction->device, true);
+            I2CMasterControl(I2C0_BASE, transaction->length == 1 ?
+                I2C_MASTER_CMD_SINGLE_RECEIVE : I2C_MASTER_CMD_BURST_RECEIVE_START);
+            i2c0_state = I2C0_STATE_READ;
+            break;
+        case I2C0_STATE_READ:
+            transaction->data[i2c0_index] = I2CMasterDataGet(I2C0_BASE);
+            ++i2c0_index;
+            if (i2c0_index < transaction->length) {
+                I2CMasterControl(I2C0_BASE, i2c0_index + 1 == transaction->length ?
+                    I2C_MASTER_CMD_BURST_RECEIVE_FINISH : I2C_MASTER_CMD_BURST_RECEIVE_CONT);
+            } else {
+                I2C0Complete();
+            }
+            break;
     }
 }
+
+void HIBERNATE_Handler(void) {
+    uint32_t status = HibernateIntStatus(true);
+    
+    HibernateIntClear(status);
+    if (status & HIBERNATE_INT_RTC_MATCH_0) {
+        EventPost(EVENT_ALARM, 0); // AlarmPoll rings it or SyncPoll steps as soon as the main loop wakes up
+    }
+}
+
+#if KEY_INTERRUPT
+void GPIOM_Handler(void) {
+    // a key changed, the read releases the INT line again
+    GPIOIntClear(KEY_INT_BASE, GPIOIntStatus(KEY_INT_BASE, true));
+    if (!I2C0ReadAsync(TCA6424_I2CADDR, TCA6424_INPUT_PORT0, 1, KeyReadComplete, NULL)) {
+        key_active = 1; // I2C queue full, retried on the 20ms tick
+    }
+}
+#endif